@@ -1,5 +1,7 @@
 #include "analyser.h"
 #include "instruction/instruction.h"
+#include "codegen/codeGenerator.h"
+#include "optimizer/expression.h"
 
 #include <climits>
 #include <sstream>
@@ -24,7 +26,8 @@ namespace miniplc0 {
             return std::make_pair(pair1,pair2);
         }
         else {
-            auto pair1 = std::make_pair(_instructions, std::optional<CompilationError>());
+            CodeGenerator generator(_passes, &_arena);
+            auto pair1 = std::make_pair(generator.generate(_program), std::optional<CompilationError>());
             auto pair2 = std::make_pair(_constants,_compilingFunctions);
             return std::make_pair(pair1,pair2);
         }
@@ -57,23 +60,60 @@ namespace miniplc0 {
                 t == TokenType::LESS_THAN_SIGN|| t == TokenType::LESS_OR_EQUAL_SIGN ||
                 t == TokenType::MORE_THAN_SIGN ||t == TokenType::MORE_OR_EQUAL_SIGN;
     }
-    std::vector<byte> Analyser::changeToBinary(int operand, int length) {
-        // 都是正数 转换成16进制就行
-        std::vector<byte> bytes;
-        for (int i=0;i<length;i++)
-            bytes.push_back(0);
-        for(int i=length-1;i>=0;i--){
-            bytes[i] = (byte)(operand>>8*(length-i-1));
+
+    /*
+     * 建立语法树结点
+     * 常量折叠在这里做：两边都是字面量的运算直接变成一个字面量
+     */
+    Expression* Analyser::makeLiteral(int32_t value) {
+        auto e = _arena.make<Expression>();
+        e->kind = Expression::Kind::Literal;
+        e->value = value;
+        return e;
+    }
+    Expression* Analyser::makeVariable(Symbol symbol) {
+        // 值已知的常量直接是字面量
+        if (symbol.getValue().has_value())
+            return makeLiteral(symbol.getValue().value());
+        auto e = _arena.make<Expression>();
+        e->kind = Expression::Kind::Variable;
+        e->level = 1 - symbol.getLevel();
+        e->offset = symbol.getOffset();
+        return e;
+    }
+    Expression* Analyser::makeNegate(Expression* operand) {
+        if (operand->kind == Expression::Kind::Literal)
+            return makeLiteral(static_cast<int32_t>(0u - static_cast<uint32_t>(operand->value)));
+        auto e = _arena.make<Expression>();
+        e->kind = Expression::Kind::Negate;
+        e->lhs = operand;
+        return e;
+    }
+    Expression* Analyser::makeBinary(TokenType op, Expression* lhs, Expression* rhs) {
+        if (lhs->kind == Expression::Kind::Literal && rhs->kind == Expression::Kind::Literal) {
+            auto value = fold(op, lhs->value, rhs->value);
+            if (value.has_value())
+                return makeLiteral(value.value());
         }
-        return bytes;
+        auto e = _arena.make<Expression>();
+        e->kind = Expression::Kind::Binary;
+        e->op = op;
+        e->lhs = lhs;
+        e->rhs = rhs;
+        return e;
+    }
+    Statement* Analyser::makeStatement(Statement::Kind kind) {
+        auto s = _arena.make<Statement>();
+        s->kind = kind;
+        return s;
     }
 
     // 添加到符号表
     // 常量表和变量表
-    void Analyser::addToSymbolList(std::optional<Token> identifier) {
+    void Analyser::addToSymbolList(std::optional<Token> identifier, std::optional<int32_t> value) {
         std::string _name = identifier.value().GetValueString();
         int _level = _current_level;
-        miniplc0::Symbol symbol(_name,_level,_offsets);
+        miniplc0::Symbol symbol(_name,_level,_offsets,value);
         _offsets++;
         if (isConstant)
             _constant_symbols.push_back(symbol);
@@ -195,6 +235,32 @@ namespace miniplc0 {
         return {};
     }
 
+    // 参数换成实参之后不超过 inline budget 条指令的话内联
+    // 实参都没有副作用也不会出错，所以少算、多算或者换了计算顺序都不影响结果
+    // 递归调用的时候被调用的函数还没分析完，不在 _functionNodes 里
+    Expression* Analyser::inlineCall(Expression* call) {
+        int budget = _passes ? _passes->inlineBudget() : 0;
+        if (budget <= 0 || call->function >= static_cast<int>(_functionNodes.size()))
+            return call;
+        auto body = _functionNodes[call->function]->inlineBody;
+        if (!body)
+            return call;
+        for (auto argument : call->arguments) {
+            if (!isPure(argument))
+                return call;
+            // 函数体里的调用可能改全局变量，实参读的全局变量必须在调用之前读
+            if (readsGlobal(argument) && hasCall(body))
+                return call;
+        }
+        auto result = transform(body, _arena, [this, call](Expression* e) -> Expression* {
+            // 被调用的函数里 level 为 0 的只有参数
+            if (isLocal(e))
+                return call->arguments[e->offset];
+            return foldConstant(e, _arena);
+        });
+        return cost(result) <= budget ? result : call;
+    }
+
     // 遇到右大括号 删除此level的常量和变量
     void Analyser::deleteCurrentLevelSymbol() {
         int n = _constant_symbols.size();
@@ -216,11 +282,14 @@ namespace miniplc0 {
     }
 
 
+
+
 	/*
 	 * 所有的递归子程序
 	 */
 	// <c0-program> ::= {<variable-declaration>} {<function_declaration>}
 	std::optional<CompilationError> Analyser::analyseProgram() {
+	    std::vector<Statement*> globals;
 	    // 变量声明语句是0个或多个
         while (true) {
             auto next = nextToken();
@@ -231,7 +300,7 @@ namespace miniplc0 {
             else {
                 if (type == TokenType::CONST) {
                     unreadToken(); //退回const
-                    auto err = analyseVariableDeclaration();
+                    auto err = analyseVariableDeclaration(globals);
                     if (err.has_value())
                         return err;
                 }
@@ -249,7 +318,7 @@ namespace miniplc0 {
                         unreadToken();
                         unreadToken();
                         unreadToken();
-                        auto err = analyseVariableDeclaration();
+                        auto err = analyseVariableDeclaration(globals);
                         if (err.has_value())
                             return err;
                     }
@@ -262,16 +331,13 @@ namespace miniplc0 {
                     break;
             }
         }
-        // 判断有没有全局变量
-        // 生成一个instruction 用offset = -1标志分界
-        Instruction divide;
-        divide.setOffsetNum(0);
-        _instructions.push_back(divide);
+        _program.globals = _arena.copy(globals);
         // 函数声明语句是0个或多个
         while (true) {
 
             auto next = nextToken();
             if (!next.has_value()) {
+                _program.functions = _arena.copy(_functionNodes);
                 if (!hasMain)
                     return std::make_optional<CompilationError>(_current_pos,ErrNoMainFunction);
                 else
@@ -279,9 +345,11 @@ namespace miniplc0 {
             }
             else {
                 unreadToken();
-                auto err = analyseFunctionDeclaration();
+                FunctionNode* function;
+                auto err = analyseFunctionDeclaration(function);
                 if (err.has_value())
                     return err;
+                _functionNodes.push_back(function);
             }
         }
     }
@@ -289,7 +357,7 @@ namespace miniplc0 {
     /* 全局变量声明部分 */
     //    <variable-declaration>
     //    <variable-declaration> ::= [<const-qualifier>]<type-specifier><init-declarator-list>';'
-    std::optional<CompilationError> Analyser::analyseVariableDeclaration() {
+    std::optional<CompilationError> Analyser::analyseVariableDeclaration(std::vector<Statement*>& declarations) {
         auto next = nextToken();
         auto type = next.value().GetType();
         // CONST类型的变量必须被显示初始化
@@ -299,7 +367,7 @@ namespace miniplc0 {
             type = next.value().GetType();
             if (type == TokenType::INT) {
                 // <init declaration list>
-                auto err = analyseInitDeclarationList();
+                auto err = analyseInitDeclarationList(declarations);
                 if (err.has_value())
                     return err;
             }
@@ -313,7 +381,7 @@ namespace miniplc0 {
             if (type == TokenType::INT) {
                 isConstant = false;
                 // init declaration list
-                auto err = analyseInitDeclarationList();
+                auto err = analyseInitDeclarationList(declarations);
                 if (err.has_value())
                     return err;
             }
@@ -327,10 +395,12 @@ namespace miniplc0 {
 	}
 
     //    <init-declarator-list> ::= <init-declarator>{','<init-declarator>}
-	std::optional<CompilationError> Analyser::analyseInitDeclarationList() {
-	    auto err = analyseInitDeclaration();
+	std::optional<CompilationError> Analyser::analyseInitDeclarationList(std::vector<Statement*>& declarations) {
+	    Statement* declaration;
+	    auto err = analyseInitDeclaration(declaration);
 	    if (err.has_value())
 	        return err;
+	    declarations.push_back(declaration);
 	    while (true) {
 	        auto next = nextToken();
 	        auto type = next.value().GetType();
@@ -339,9 +409,10 @@ namespace miniplc0 {
                 break;
 	        }
 	        else if (type == TokenType::COMMA_SIGN) {
-                err = analyseInitDeclaration();
+                err = analyseInitDeclaration(declaration);
                 if (err.has_value())
                     return err;
+                declarations.push_back(declaration);
 	        }
 	        else
 	            return std::make_optional<CompilationError>(_current_pos,ErrNoSemicolon);
@@ -350,10 +421,13 @@ namespace miniplc0 {
 	}
     //    <init-declarator> ::= <identifier>[<initializer>]
     //    <initializer> ::='='<expression>
-    std::optional<CompilationError> Analyser::analyseInitDeclaration() {
+    std::optional<CompilationError> Analyser::analyseInitDeclaration(Statement*& declaration) {
         auto next = nextToken();
         auto type = next.value().GetType();
         auto identifier = next;
+        declaration = makeStatement(Statement::Kind::Declaration);
+        declaration->level = 1 - _current_level;
+        declaration->offset = _offsets;
         if (!next.has_value() || type != TokenType::IDENTIFIER)
             return std::make_optional<CompilationError>(_current_pos,ErrorCode::ErrNeedIdentifier);
         else {
@@ -371,33 +445,25 @@ namespace miniplc0 {
             if (isConstant) {
                 if (type != TokenType::EQUAL_SIGN)
                     return std::make_optional<CompilationError>(_current_pos,ErrConstantNeedValue);
-                auto err = analyseExpression();
+                auto err = analyseExpression(declaration->expression);
                 if (err.has_value())
                     return err;
-                // 在这里初始化赋值 需要吗？
+                // 仍然占一个栈上的位置，但使用它的地方直接压值
+                std::optional<int32_t> value;
+                if (declaration->expression->kind == Expression::Kind::Literal)
+                    value = declaration->expression->value;
+                addToSymbolList(identifier, value);
+                return {};
             }
             else {
                 // 未初始化不用管 也不用给默认值
-                // 为初始化需要给分配空间
-                if (type != TokenType::EQUAL_SIGN) {
+                // 为初始化需要给分配空间，此时 expression 为空
+                if (type != TokenType::EQUAL_SIGN)
                     unreadToken();
-                    // 分配空间
-                    std::vector<int> operand;
-                    std::vector<std::vector<byte>> binary_operand;
-                    std::vector<byte> binary_opr;
-                    binary_opr.push_back(0x0c);
-                    //binary_opr.push_back(12);
-                    operand.push_back(1);
-                    std::vector<byte> bytes = changeToBinary(1,4);
-                    binary_operand.push_back(bytes);
-                    Instruction instruction(Operation::SNEW,binary_opr,operand,binary_operand,opr_offset++);
-                    _instructions.push_back(instruction);
-                }
                 else {
-                    auto err = analyseExpression();
+                    auto err = analyseExpression(declaration->expression);
                     if (err.has_value())
                         return err;
-                    // 初始化赋值 不需要吧
                 }
             }
         }
@@ -409,37 +475,20 @@ namespace miniplc0 {
     /* expression 部分*/
     //    <expression> ::=<additive-expression>
     //    <additive-expression> ::=<multiplicative-expression>{<additive-operator><multiplicative-expression>}
-    std::optional<CompilationError> Analyser::analyseExpression() {
-        auto err = analyseMulExpression();
+    std::optional<CompilationError> Analyser::analyseExpression(Expression*& expression) {
+        auto err = analyseMulExpression(expression);
         if (err.has_value())
             return err;
         while (true) {
             auto next = nextToken();
             auto type = next.value().GetType();
             if (type == TokenType::PLUS_SIGN || type == TokenType::MINUS_SIGN) {
-                err = analyseMulExpression();
+                Expression* rhs;
+                err = analyseMulExpression(rhs);
                 if (err.has_value())
                     return err;
-                // 生成指令
                 // 加减
-                if (type == TokenType::PLUS_SIGN) {
-                    std::vector<int> operand;
-                    std::vector<std::vector<byte>> binary_operand;
-                    std::vector<byte> binary_opr;
-                    binary_opr.push_back(0x30);
-                    //binary_opr.push_back(0);
-                    Instruction instruction(Operation::IADD,binary_opr,operand,binary_operand,opr_offset++);
-                    _instructions.push_back(instruction);
-                }
-                else {
-                    std::vector<int> operand;
-                    std::vector<std::vector<byte>> binary_operand;
-                    std::vector<byte> binary_opr;
-                    binary_opr.push_back(0x34);
-                    //binary_opr.push_back(4);
-                    Instruction instruction(Operation::ISUB,binary_opr,operand,binary_operand,opr_offset++);
-                    _instructions.push_back(instruction);
-                }
+                expression = makeBinary(type, expression, rhs);
             }
             else {
                 unreadToken();
@@ -450,50 +499,32 @@ namespace miniplc0 {
     }
 
     //    <multiplicative-expression> ::=<unary-expression>{<multiplicative-operator><unary-expression>}
-    std::optional<CompilationError> Analyser::analyseMulExpression() {
-        auto err = analyseUnaryExpression();
+    std::optional<CompilationError> Analyser::analyseMulExpression(Expression*& expression) {
+        auto err = analyseUnaryExpression(expression);
         if (err.has_value())
             return err;
         while (true) {
             auto next = nextToken();
             auto type = next.value().GetType();
             if (type == TokenType::MULTIPLICATION_SIGN || type == TokenType::DIVISION_SIGN) {
-                err = analyseUnaryExpression();
+                Expression* rhs;
+                err = analyseUnaryExpression(rhs);
                 if (err.has_value())
                     return err;
-                // 生成指令
                 // 乘除
-                if (type == TokenType::MULTIPLICATION_SIGN) {
-                    std::vector<int> operand;
-                    std::vector<std::vector<byte>> binary_operand;
-                    std::vector<byte> binary_opr;
-                    binary_opr.push_back(0x38);
-                    // binary_opr.push_back(8);
-                    Instruction instruction(Operation::IMUL,binary_opr,operand,binary_operand, opr_offset++);
-                    _instructions.push_back(instruction);
-                }
-                else {
-                    std::vector<int> operand;
-                    std::vector<std::vector<byte>> binary_operand;
-                    std::vector<byte> binary_opr;
-                    binary_opr.push_back(0x3c);
-                    // binary_opr.push_back(12);
-                    Instruction instruction(Operation::IDIV,binary_opr,operand,binary_operand, opr_offset++);
-                    _instructions.push_back(instruction);
-                }
+                expression = makeBinary(type, expression, rhs);
             }
             else {
                 unreadToken();
                 break;
             }
         }
-        // 生成乘除指令
         return {};
     }
 
     //    <unary-expression> ::=[<unary-operator>]<primary-expression>
     //    <primary-expression> ::='('<expression>')'|<identifier>|<integer-literal>|<function-call>
-    std::optional<CompilationError> Analyser::analyseUnaryExpression() {
+    std::optional<CompilationError> Analyser::analyseUnaryExpression(Expression*& expression) {
 	    // 预读 处理前面可能有的正负号
         auto next = nextToken();
         auto type = next.value().GetType();
@@ -503,16 +534,8 @@ namespace miniplc0 {
         }
         else if (type == TokenType::MINUS_SIGN) {
             isNegative = true;
-//            // 压进来一个 -1
-//            std::vector<int> operand;
-//            std::vector<std::string> binary_operand;
-//            operand.push_back(-1);
-//            binary_operand.emplace_back("ff ff ff ff");
-//            Instruction instruction(Operation::IPUSH,"02",operand,binary_operand);
-//            _instructions.push_back(instruction);
         }
 
-
 	    // primary-expression 部分
 	    next = nextToken();
 	    type = next.value().GetType();
@@ -521,7 +544,7 @@ namespace miniplc0 {
 	        if (next.value().GetType() == TokenType::LEFT_BRACKET) {
 	            unreadToken();
 	            unreadToken();
-	            auto err = analyseFunctionCall(true);
+	            auto err = analyseFunctionCall(true, expression);
 	            if (err.has_value())
 	                return err;
 	        }
@@ -534,57 +557,20 @@ namespace miniplc0 {
                 auto result = findIdentifier(identifier);
                 if (!result.has_value())
                     return std::make_optional<CompilationError>(_current_pos,ErrIdentifierNotDeclare);
-                else {
-                    // 不判断是否初始化了
-                    // 从栈中取出identifier到栈顶
-                    // loada 和 iload
-                    int identifier_level = result.value().getLevel();
-                    int level_diff = 1 - identifier_level;
-                    int stackOffset = result.value().getOffset();
-                    std::vector<int> operand;
-                    std::vector<std::vector<byte>> binary_operand;
-                    std::vector<byte> binary_opr;
-                    binary_opr.push_back(0x0a);
-                    //binary_opr.push_back(10);
-                    operand.push_back(level_diff);
-                    operand.push_back(stackOffset);
-                    std::vector<byte> v1 = changeToBinary(level_diff,2); // 2字节
-                    std::vector<byte> v2 = changeToBinary(stackOffset, 4); // 4字节
-                    binary_operand.push_back(v1);
-                    binary_operand.push_back(v2);
-                    Instruction instruction(Operation::LOADA,binary_opr,operand,binary_operand, opr_offset++);
-                    _instructions.push_back(instruction);
-                    // iload
-                    std::vector<int> operand2;
-                    std::vector<std::vector<byte>> binary_operand2;
-                    std::vector<byte> binary_opr2;
-                    binary_opr2.push_back(0x10);
-                    // binary_opr2.push_back(0);
-                    Instruction instruction2(Operation::ILOAD,binary_opr2,operand2,binary_operand2,opr_offset++);
-                    _instructions.push_back(instruction2);
-                }
+                // 不判断是否初始化了
+                expression = makeVariable(result.value());
 	        }
 	    }
 	    else if (type == TokenType::DECIMAL_UNSIGNED_INTEGER || type == TokenType::HEXADECIMAL_UNSIGNED_INTEGER) {
-	        // 直接压栈
 	        std::string s = next.value().GetValueString();
 	        std::stringstream ss;
 	        ss << s;
 	        int value;
 	        ss >> value;
-	        std::vector<byte> binary_value = changeToBinary(value,4);
-            std::vector<int> operand;
-            std::vector<std::vector<byte >> binary_operand;
-            operand.push_back(value);
-            binary_operand.push_back(binary_value);
-            std::vector<byte> binary_opr;
-            binary_opr.push_back(0x02);
-            // binary_opr.push_back(2);
-            Instruction instruction(Operation::IPUSH,binary_opr,operand,binary_operand ,opr_offset++);
-            _instructions.push_back(instruction);
+	        expression = makeLiteral(value);
 	    }
 	    else if (type == TokenType::LEFT_BRACKET) {
-	        auto err = analyseExpression();
+	        auto err = analyseExpression(expression);
 	        if (err.has_value())
 	            return err;
 	        next = nextToken();
@@ -594,23 +580,16 @@ namespace miniplc0 {
 	    else
 	        return std::make_optional<CompilationError>(_current_pos,ErrIncompleteExpression);
 
-	    // 如果取负数的话 ineg取负数指令
-	    if (isNegative) {
-            std::vector<int> operand;
-            std::vector<std::vector<byte>> binary_operand;
-            std::vector<byte> binary_opr;
-            binary_opr.push_back(0x40);
-            // binary_opr.push_back(0);
-            Instruction instruction(Operation::INEG,binary_opr,operand,binary_operand ,opr_offset++);
-            _instructions.push_back(instruction);
-	    }
+	    // 取负数
+	    if (isNegative)
+	        expression = makeNegate(expression);
 
         return {};
     }
 
     //    <function-call> ::=<identifier> '(' [<expression-list>] ')'
     //    <expression-list> ::=<expression>{','<expression>}
-    std::optional<CompilationError> Analyser::analyseFunctionCall(bool isExpression) {
+    std::optional<CompilationError> Analyser::analyseFunctionCall(bool isExpression, Expression*& call) {
         // 因为肯定是确认了Identifier和（ 才能进来，所以跳过
         // 判断有没有这个函数 这个函数是否满足要求
         auto identifier = nextToken(); // 这个是identifier
@@ -633,15 +612,16 @@ namespace miniplc0 {
 
         // expression-list
         // 检查类型啊
-        int paraNum = 0;
+        std::vector<Expression*> arguments;
         auto next = nextToken();
         next = nextToken();
         if (next.value().GetType() != TokenType::RIGHT_BRACKET) {
             unreadToken();
-            auto err = analyseExpression();
+            Expression* argument;
+            auto err = analyseExpression(argument);
             if (err.has_value())
                 return err;
-            paraNum++;
+            arguments.push_back(argument);
         }
         else
             unreadToken();
@@ -652,13 +632,14 @@ namespace miniplc0 {
                 unreadToken();
                 break;
             }
-            auto err = analyseExpression();
+            Expression* argument;
+            auto err = analyseExpression(argument);
             if (err.has_value())
                 return err;
-            paraNum++;
+            arguments.push_back(argument);
         }
         // 判断参数个数是否正确
-        if (number != paraNum)
+        if (number != static_cast<int>(arguments.size()))
             return std::make_optional<CompilationError>(_current_pos,ErrIncorrectParaNum);
 
         next = nextToken();
@@ -666,27 +647,21 @@ namespace miniplc0 {
         if (!next.has_value() || type != TokenType::RIGHT_BRACKET)
             return std::make_optional<CompilationError>(_current_pos,ErrNoBracket);
 
-        // 生成指令
-        // call指令
-        std::vector<int> operand;
-        std::vector<std::vector<byte>> binary_operand;
-        std::vector<byte> binary_opr;
-        binary_opr.push_back(0x80);
-        // binary_opr.push_back(0);
-        operand.push_back(oneFunction.value().getIndex());
-        std::vector<byte> s = changeToBinary(oneFunction.value().getIndex(),4);
-        binary_operand.push_back(s);
-        Instruction instruction(Operation::CALL,binary_opr,operand,binary_operand,opr_offset++);
-        _instructions.push_back(instruction);
-
-	    return {};
-	}
+        call = _arena.make<Expression>();
+        call->kind = Expression::Kind::Call;
+        call->function = oneFunction.value().getIndex();
+        call->arguments = _arena.copy(arguments);
+        // 作为语句的调用返回值会被丢掉，不内联
+        if (isExpression) {
+            call = inlineCall(call);
+        }
+        return {};
+    }
 
 	/*函数声明的头部*/
     //    <function-definition> ::=<type-specifier><identifier><parameter-clause><compound-statement>
     //    <parameter-clause> ::='(' [<parameter-declaration-list>] ')'
-    std::optional<CompilationError> Analyser::analyseFunctionDeclaration() {
-        opr_offset = 0;     //第几条指令
+    std::optional<CompilationError> Analyser::analyseFunctionDeclaration(FunctionNode*& function) {
         _offsets = 0;       //loada使用，在栈帧中的什么位置
         auto next = nextToken();
         auto type = next.value().GetType();
@@ -725,6 +700,9 @@ namespace miniplc0 {
 
 
         _offsets = 0;
+        function = _arena.make<FunctionNode>();
+        function->index = functionIndex;
+        function->isVoid = isVoid;
 
         // 判断有无参数
         next = nextToken();
@@ -752,30 +730,16 @@ namespace miniplc0 {
 
         // 函数体
         hasReturn = false;
-        auto err = analyseCompoundStatement();
+        auto err = analyseCompoundStatement(function->body);
         if (err.has_value())
             return err;
         if (!hasReturn)
             return std::make_optional<CompilationError>(_current_pos,ErrNoReturnStatement);
-
-        // 如果没有return 也要ret
-        Operation opr;
-        std::vector<byte> binary_opr;
-        std::vector<int> operand;
-        std::vector<std::vector<byte>> binary_operand;
-        if (isVoid) {
-            opr = Operation::RET;
-            binary_opr.push_back(0x88);
-            //binary_opr.push_back(8);
-        }
-        else {
-            opr = Operation::IRET;
-            binary_opr.push_back(0x89);
-            //binary_opr.push_back(9);
-        }
-        Instruction instruction(opr,binary_opr,operand,binary_operand ,opr_offset++);
-        _instructions.push_back(instruction);
-
+        function->frameSize = _offsets;
+        // 没有局部变量：栈帧里只有参数
+        if (function->body->body.size == 1 && function->body->body[0]->kind == Statement::Kind::Return
+            && function->body->body[0]->expression && _offsets == _compilingFunctions.back().getNum())
+            function->inlineBody = function->body->body[0]->expression;
         return {};
     }
 
@@ -857,20 +821,23 @@ namespace miniplc0 {
         return {};
     }
 
+
     /* 函数体 */
     //    <compound-statement> ::='{' {<variable-declaration>} <statement-seq> '}'
-    std::optional<CompilationError> Analyser::analyseCompoundStatement() {
+    std::optional<CompilationError> Analyser::analyseCompoundStatement(Statement*& block) {
         auto next = nextToken();
         auto type = next.value().GetType();
         if (!next.has_value() || type != TokenType::BIG_LEFT_BRACKET)
             return std::make_optional<CompilationError>(_current_pos,ErrNoBigBracket);
         _current_level++;
+        // 声明和语句放在同一个块里，声明在前
+        std::vector<Statement*> body;
         while(true) {
             next = nextToken();
             type = next.value().GetType();
             if (type == TokenType::INT || type == TokenType::CONST) {
                 unreadToken();
-                auto err = analyseVariableDeclaration();
+                auto err = analyseVariableDeclaration(body);
                 if (err.has_value())
                     return err;
             }
@@ -879,7 +846,7 @@ namespace miniplc0 {
                 break;
             }
         }
-        auto err = analyseStatementSeq();
+        auto err = analyseStatementSeq(body);
         if (err.has_value())
             return err;
         next = nextToken();
@@ -889,10 +856,12 @@ namespace miniplc0 {
         // 删除这个level的常量和变量
         deleteCurrentLevelSymbol();
         _current_level--;
+        block = makeStatement(Statement::Kind::Block);
+        block->body = _arena.copy(body);
         return {};
     }
     //    <statement-seq> ::={<statement>}
-    std::optional<CompilationError> Analyser::analyseStatementSeq() {
+    std::optional<CompilationError> Analyser::analyseStatementSeq(std::vector<Statement*>& statements) {
         while (true) {
             // 预读 判断是否结束了
             auto next = nextToken();
@@ -902,20 +871,25 @@ namespace miniplc0 {
                 break;
             }
             unreadToken();
-            auto err = analyseStatement();
+            Statement* statement;
+            auto err = analyseStatement(statement);
             if (err.has_value())
                 return err;
+            if (statement)
+                statements.push_back(statement);
         }
         return {};
     }
     //    <statement> ::='{' <statement-seq> '}'|<condition-statement>|<loop-statement>|<jump-statement>
     //             |<print-statement>|<scan-statement>|<assignment-expression>';'|<function-call>';'|';'
-    std::optional<CompilationError> Analyser::analyseStatement() {
+    std::optional<CompilationError> Analyser::analyseStatement(Statement*& statement) {
+         statement = nullptr;
          auto next = nextToken();
          auto type = next.value().GetType();
          if (type == TokenType::BIG_LEFT_BRACKET) {
              _current_level++;
-             auto err = analyseStatementSeq();
+             std::vector<Statement*> body;
+             auto err = analyseStatementSeq(body);
              if (err.has_value())
                  return err;
              next = nextToken();
@@ -925,34 +899,36 @@ namespace miniplc0 {
              // 删除
              deleteCurrentLevelSymbol();
              _current_level--;
+             statement = makeStatement(Statement::Kind::Block);
+             statement->body = _arena.copy(body);
          }
          else if (type == TokenType::IF) {
              unreadToken();
-             auto err = analyseConditionStatement();
+             auto err = analyseConditionStatement(statement);
              if (err.has_value())
                  return err;
          }
          else if (type == TokenType::WHILE) {
              unreadToken();
-             auto err = analyseLoopStatement();
+             auto err = analyseLoopStatement(statement);
              if (err.has_value())
                  return err;
          }
          else if (type == TokenType::RETURN) {
              unreadToken();
-             auto err = analyseJumpStatement();
+             auto err = analyseJumpStatement(statement);
              if (err.has_value())
                  return err;
          }
          else if (type == TokenType::SCAN) {
              unreadToken();
-             auto err = analyseScanStatement();
+             auto err = analyseScanStatement(statement);
              if (err.has_value())
                  return err;
          }
          else if (type == TokenType::PRINT) {
              unreadToken();
-             auto err = analysePrintStatement();
+             auto err = analysePrintStatement(statement);
              if (err.has_value())
                  return err;
          }
@@ -962,14 +938,15 @@ namespace miniplc0 {
              if (type == TokenType::EQUAL_SIGN) {
                  unreadToken();
                  unreadToken();
-                 auto err = analyseAssignmentExpression();
+                 auto err = analyseAssignmentExpression(statement);
                  if (err.has_value())
                      return err;
              }
              else if (type == TokenType::LEFT_BRACKET) {
                  unreadToken();
                  unreadToken();
-                 auto err = analyseFunctionCall(false);
+                 statement = makeStatement(Statement::Kind::Call);
+                 auto err = analyseFunctionCall(false, statement->expression);
                  if (err.has_value())
                      return err;
              }
@@ -986,150 +963,48 @@ namespace miniplc0 {
     }
 
     //    <condition> ::=<expression>[<relational-operator><expression>]
-    std::optional<CompilationError> Analyser::analyseCondition() {
-        auto err = analyseExpression();
+    std::optional<CompilationError> Analyser::analyseCondition(Condition& condition) {
+        condition.rhs = nullptr;
+        auto err = analyseExpression(condition.lhs);
         if (err.has_value())
             return err;
         auto next = nextToken();
         auto type = next.value().GetType();
         if (isRelationalOperator(type)) {
-            err = analyseExpression();
+            condition.op = type;
+            err = analyseExpression(condition.rhs);
             if (err.has_value())
                 return err;
-            // 比较操作 cmp
-            std::vector<int> operand;
-            std::vector<std::vector<byte>> binary_operand;
-            std::vector<byte> binary_opr;
-            binary_opr.push_back(0x44);
-            // binary_opr.push_back(4);
-            Instruction instruction(Operation::ICMP,binary_opr,operand,binary_operand ,opr_offset++);
-            _instructions.push_back(instruction);
-            // 根据具体是什么符号 跳转 不满足if条件的时候跳转 也就是相反的时候
-            Operation opr;
-            std::vector<byte> _binary_opr;
-            switch (type) {
-                case TokenType::IS_EQUAL_SIGN :
-                    _binary_opr.push_back(0x72);
-                    opr = Operation::JNE;
-                    break;
-                case TokenType::NOT_EQUAL_SIGN :
-                    _binary_opr.push_back(0x71);
-                    opr = Operation::JE;
-                    break;
-                case TokenType::LESS_THAN_SIGN :
-                    _binary_opr.push_back(0x74);
-                    opr = Operation::JGE;
-                    break;
-                case TokenType::LESS_OR_EQUAL_SIGN :
-                    _binary_opr.push_back(0x75);
-                    opr = Operation::JG;
-                    break;
-                case TokenType::MORE_THAN_SIGN :
-                    _binary_opr.push_back(0x76);
-                    opr = Operation::JLE;
-                    break;
-                case TokenType::MORE_OR_EQUAL_SIGN :
-                    _binary_opr.push_back(0x73);
-                    opr = Operation::JL;
-                    break;
-                default:
-                    opr = Operation::JMP;
-                    break;
-            }
-            std::vector<int> _operand;
-            std::vector<std::vector<byte>> _binary_operand;
-            Instruction instruction1(opr,_binary_opr,_operand,_binary_operand,opr_offset++);
-            _instructions.push_back(instruction1);
-
-            // 之后还要回填这个offset
         }
-        else {
-            unreadToken();
+        else
             // 如果没有关系运算符的话 通过这个expression来判断 true or false
-            // 如果value不是0 跳转 jne
-            std::vector<int> operand;
-            std::vector<std::vector<byte>> binary_operand;
-            std::vector<byte> binary_opr;
-            binary_opr.push_back(0x71);
-            // binary_opr.push_back(2);
-            Instruction instruction(Operation::JE,binary_opr,operand,binary_operand ,opr_offset++);
-            _instructions.push_back(instruction);
-
-            // 要回填这个offset
-        }
+            unreadToken();
         return {};
     }
     //    <condition-statement> ::='if' '(' <condition> ')' <statement> ['else' <statement>]
-    std::optional<CompilationError> Analyser::analyseConditionStatement() {
+    std::optional<CompilationError> Analyser::analyseConditionStatement(Statement*& statement) {
         isLoop = false;
+        statement = makeStatement(Statement::Kind::If);
         auto next = nextToken();
         next = nextToken();
         auto type = next.value().GetType();
         if (!next.has_value() || type != TokenType::LEFT_BRACKET)
             return std::make_optional<CompilationError>(_current_pos,ErrNoBracket);
-        auto err = analyseCondition();
+        auto err = analyseCondition(statement->condition);
         if (err.has_value())
             return err;
         next = nextToken();
         if (!next.has_value() || next.value().GetType() != TokenType::RIGHT_BRACKET)
             return std::make_optional<CompilationError>(_current_pos,ErrNoBracket);
-        err = analyseStatement();
+        err = analyseStatement(statement->then);
         if (err.has_value())
             return err;
 
-        // 回填
-        // else 或者其他指令
-        // 将当前的偏移 +1 回填到跳转指令的offset
-        int n = _instructions.size();
-        for (int i=n-1;i>=0;i--) {
-            Instruction tmp = _instructions[i];
-            if (tmp.getOpr() == Operation::JE || tmp.getOpr() == Operation::JNE || tmp.getOpr() == Operation::JL
-                || tmp.getOpr() == Operation::JLE || tmp.getOpr() == Operation::JGE || tmp.getOpr() == Operation::JG)
-            {
-                if (tmp.getOperand().size() == 0) {
-                    next = nextToken();
-                    if (next.value().GetType() == TokenType::ELSE) {
-                        _instructions[i].addOperand(opr_offset+1);
-                        _instructions[i].addBinaryOperand(changeToBinary(opr_offset+1,2));
-                    }
-                    else {
-                        _instructions[i].addOperand(opr_offset);
-                        _instructions[i].addBinaryOperand(changeToBinary(opr_offset,2));
-                    }
-                    unreadToken();
-                    break;
-                }
-            }
-        }
-
         next = nextToken();
         if (next.value().GetType() == TokenType::ELSE) {
-            // 如果有else的话 生成跳转指令 跳转到 else 的statement之后的一句
-            // 等待回填
-            std::vector<int> operand;
-            std::vector<std::vector<byte>> binary_operand;
-            std::vector<byte> binary_opr;
-            binary_opr.push_back(0x70);
-            // binary_opr.push_back(0);
-            Instruction instruction(Operation::JMP,binary_opr,operand,binary_operand ,opr_offset++);
-            _instructions.push_back(instruction);
-
-            err = analyseStatement();
+            err = analyseStatement(statement->otherwise);
             if (err.has_value())
                 return err;
-
-            // 分析完了 回填
-            n = _instructions.size();
-            for (int i=n-1;i>=0;i--) {
-                Instruction tmp = _instructions[i];
-                if (tmp.getOpr() == Operation::JMP) {
-                    if (tmp.getOperand().size() == 0) {
-                        _instructions[i].addOperand(opr_offset);
-                        _instructions[i].addBinaryOperand(changeToBinary(opr_offset,2));
-                        break;
-                    }
-                }
-            }
         }
         else {
             unreadToken();
@@ -1137,56 +1012,30 @@ namespace miniplc0 {
         return {};
     }
     //    <loop-statement> ::='while' '(' <condition> ')' <statement>
-    std::optional<CompilationError> Analyser::analyseLoopStatement() {
+    std::optional<CompilationError> Analyser::analyseLoopStatement(Statement*& statement) {
         isLoop = true;
+        statement = makeStatement(Statement::Kind::While);
         auto next = nextToken();
         next = nextToken();
         auto type = next.value().GetType();
         if (!next.has_value() || type != TokenType::LEFT_BRACKET)
             return std::make_optional<CompilationError>(_current_pos,ErrNoBracket);
 
-        int while_offset = opr_offset + 1;
-
-        auto err = analyseCondition();
+        auto err = analyseCondition(statement->condition);
         if (err.has_value())
             return err;
         next = nextToken();
         if (!next.has_value() || next.value().GetType() != TokenType::RIGHT_BRACKET)
             return std::make_optional<CompilationError>(_current_pos,ErrNoBracket);
-        err = analyseStatement();
+        err = analyseStatement(statement->then);
         if (err.has_value())
             return err;
-
-        // 回填这个地方的offset
-        int n = _instructions.size();
-        for (int i=n-1;i>=0;i--) {
-            Instruction tmp = _instructions[i];
-            if (tmp.getOpr() == Operation::JE || tmp.getOpr() == Operation::JNE || tmp.getOpr() == Operation::JL
-                || tmp.getOpr() == Operation::JLE || tmp.getOpr() == Operation::JGE || tmp.getOpr() == Operation::JG)
-            {
-                if (tmp.getOperand().size() == 0) {
-                    _instructions[i].addOperand(opr_offset+1);
-                    _instructions[i].addBinaryOperand(changeToBinary(opr_offset+1,2));
-                    break;
-                }
-            }
-        }
-        // 跳回原来的condition 语句
-        std::vector<int> operand;
-        std::vector<std::vector<byte>> binary_operand;
-        std::vector<byte> binary_opr;
-        binary_opr.push_back(0x70);
-        // binary_opr.push_back(0);
-        operand.push_back(while_offset-1);
-        binary_operand.push_back(changeToBinary(while_offset-1,2));
-        Instruction instruction(Operation::JMP,binary_opr,operand,binary_operand ,opr_offset++);
-        _instructions.push_back(instruction);
-
         return {};
     }
     //    <jump-statement> ::= <return-statement>
     //    <return-statement> ::= 'return' [<expression>] ';'
-    std::optional<CompilationError> Analyser::analyseJumpStatement() {
+    std::optional<CompilationError> Analyser::analyseJumpStatement(Statement*& statement) {
+        statement = makeStatement(Statement::Kind::Return);
         auto next = nextToken();
         next = nextToken();
         auto type = next.value().GetType();
@@ -1195,7 +1044,7 @@ namespace miniplc0 {
             if (type == TokenType::SEMICOLON)
                 return std::make_optional<CompilationError>(_current_pos,ErrIncorrectReturnType);
             unreadToken();
-            auto err = analyseExpression();
+            auto err = analyseExpression(statement->expression);
             if (err.has_value())
                 return err;
             next = nextToken();
@@ -1203,29 +1052,10 @@ namespace miniplc0 {
         if (!next.has_value() || next.value().GetType() != TokenType::SEMICOLON)
             return std::make_optional<CompilationError>(_current_pos,ErrNoSemicolon);
         hasReturn = true;
-
-        // ret 或者 iret
-        Operation opr;
-        std::vector<byte> binary_opr;
-        std::vector<int> operand;
-        std::vector<std::vector<byte>> binary_operand;
-        if (isVoid) {
-            opr = Operation::RET;
-            binary_opr.push_back(0x88);
-            // binary_opr.push_back(8);
-        }
-        else {
-            opr = Operation::IRET;
-            binary_opr.push_back(0x89);
-            // binary_opr.push_back(9);
-        }
-        Instruction instruction(opr,binary_opr,operand,binary_operand ,opr_offset++);
-        _instructions.push_back(instruction);
-
         return {};
     }
     //    <scan-statement>  ::= 'scan' '(' <identifier> ')' ';'
-    std::optional<CompilationError> Analyser::analyseScanStatement() {
+    std::optional<CompilationError> Analyser::analyseScanStatement(Statement*& statement) {
         auto next = nextToken();
         next = nextToken();
         auto type = next.value().GetType();
@@ -1240,45 +1070,10 @@ namespace miniplc0 {
             auto symbol = findVariableIdentifier(identifier);
             if (!symbol.has_value())
                 return std::make_optional<CompilationError>(_current_pos,ErrIdentifierNotDeclare);
-//            auto symbol1 = findConstantIdentifier(identifier);
-//            if (symbol1.has_value())
-//                return std::make_optional<CompilationError>(_current_pos,ErrAssignToConstant);
-
-
-            // 有的话 给赋值
-            // 先把identifier的地址加载过来 loada
-            int level_diff = 1 - symbol.value().getLevel();
-            int stack_offset = symbol.value().getOffset();
-            std::vector<int> operand1;
-            std::vector<std::vector<byte>> binary_operand1;
-            std::vector<byte> binary_opr1;
-            binary_opr1.push_back(0x0a);
-            // binary_opr1.push_back(10);
-            operand1.push_back(level_diff);
-            operand1.push_back(stack_offset);
-            binary_operand1.push_back(changeToBinary(level_diff,2));
-            binary_operand1.push_back(changeToBinary(stack_offset,4));
-            Instruction instruction1(Operation::LOADA,binary_opr1,operand1,binary_operand1 ,opr_offset++);
-            _instructions.push_back(instruction1);
-
-            // 先生成iscan指令
-            std::vector<int> operand;
-            std::vector<std::vector<byte>> binary_operand;
-            std::vector<byte> binary_opr;
-            binary_opr.push_back(0xb0);
-            // binary_opr.push_back(0);
-            Instruction instruction(Operation::ISCAN,binary_opr,operand,binary_operand ,opr_offset++);
-            _instructions.push_back(instruction);
-
-            // 储存给变量
-            std::vector<int> operand2;
-            std::vector<std::vector<byte>> binary_operand2;
-            std::vector<byte> binary_opr2;
-            binary_opr2.push_back(0x20);
-            // binary_opr2.push_back(0);
-            Instruction instruction2(Operation::ISTORE,binary_opr2,operand2,binary_operand2 ,opr_offset++);
-            _instructions.push_back(instruction2);
-
+            // 读入之后存给变量
+            statement = makeStatement(Statement::Kind::Scan);
+            statement->level = 1 - symbol.value().getLevel();
+            statement->offset = symbol.value().getOffset();
         }
         else
             return std::make_optional<CompilationError>(_current_pos,ErrNeedIdentifier);
@@ -1293,7 +1088,8 @@ namespace miniplc0 {
         return {};
     }
     //    <print-statement> ::= 'print' '(' [<printable-list>] ')' ';'
-    std::optional<CompilationError> Analyser::analysePrintStatement() {
+    std::optional<CompilationError> Analyser::analysePrintStatement(Statement*& statement) {
+        statement = makeStatement(Statement::Kind::Print);
         auto next = nextToken();
         next = nextToken();
         auto type = next.value().GetType();
@@ -1302,9 +1098,11 @@ namespace miniplc0 {
         next = nextToken();
         if (next.value().GetType() != TokenType::RIGHT_BRACKET) {
             unreadToken();
-            auto err = analysePrintableList();
+            std::vector<Expression*> printables;
+            auto err = analysePrintableList(printables);
             if (err.has_value())
                 return err;
+            statement->printables = _arena.copy(printables);
             next = nextToken();
         }
         if (!next.has_value() || next.value().GetType() != RIGHT_BRACKET)
@@ -1317,109 +1115,45 @@ namespace miniplc0 {
     }
     //    <printable-list>  ::= <printable> {',' <printable>}
     //    <printable> ::= <expression>
-    std::optional<CompilationError> Analyser::analysePrintableList() {
-        auto err = analyseExpression();
+    std::optional<CompilationError> Analyser::analysePrintableList(std::vector<Expression*>& printables) {
+        Expression* printable;
+        auto err = analyseExpression(printable);
         if (err.has_value())
             return err;
-        // 输出指令
-        std::vector<int> operand;
-        std::vector<std::vector<byte>> binary_operand;
-        std::vector<byte> binary_opr;
-        // binary_opr.push_back(10);
-        binary_opr.push_back(0xa0);
-        Instruction instruction(Operation::IPRINT,binary_opr,operand,binary_operand ,opr_offset++);
-        _instructions.push_back(instruction);
-
+        printables.push_back(printable);
         while (true) {
             auto next = nextToken();
             if (next.value().GetType() == TokenType::COMMA_SIGN) {
-                // 遇到一个逗号 输出一个空格
-                // bipush 32
-                std::vector<byte> binary_value = changeToBinary(32,4);
-                std::vector<int> operand10;
-                std::vector<std::vector<byte>> binary_operand10;
-                std::vector<byte> binary_opr10;
-                binary_opr10.push_back(0x01);
-                operand10.push_back(32);
-                binary_operand10.push_back(binary_value);
-                Instruction instruction10(Operation::BIPUSH,binary_opr10,operand10,binary_operand10 ,opr_offset++);
-                _instructions.push_back(instruction10);
-                // cprint
-                std::vector<int> operand20;
-                std::vector<std::vector<byte>> binary_operand20;
-                std::vector<byte> binary_opr20;
-                binary_opr20.push_back(0xa2);
-                Instruction instruction20(Operation::CPRINT,binary_opr20,operand20,binary_operand20 ,opr_offset++);
-                _instructions.push_back(instruction20);
-
-                err = analyseExpression();
+                err = analyseExpression(printable);
                 if (err.has_value())
                     return err;
-                // 输出指令
-                std::vector<int> operand1;
-                std::vector<std::vector<byte>> binary_operand1;
-                std::vector<byte> binary_opr1;
-                // binary_opr1.push_back(10);
-                binary_opr1.push_back(0xa0);
-                Instruction instruction1(Operation::IPRINT,binary_opr1,operand1,binary_operand1 ,opr_offset++);
-                _instructions.push_back(instruction1);
+                printables.push_back(printable);
             }
             else{
                 unreadToken();
                 break;
             }
         }
-        // 所有输出完了之后 输出一个换行
-        std::vector<int> operand30;
-        std::vector<std::vector<byte>> binary_operand30;
-        std::vector<byte> binary_opr30;
-        binary_opr30.push_back(0xaf);
-        Instruction instruction30(Operation::PRINTL,binary_opr30,operand30,binary_operand30 ,opr_offset++);
-        _instructions.push_back(instruction30);
-
         return {};
     }
     //    <assignment-expression> ::=<identifier><assignment-operator><expression>
-    std::optional<CompilationError> Analyser::analyseAssignmentExpression() {
+    std::optional<CompilationError> Analyser::analyseAssignmentExpression(Statement*& statement) {
         auto identifier = nextToken();
         // 有且不能是常量
         auto symbol = findVariableIdentifier(identifier);
         if (!symbol.has_value())
             return std::make_optional<CompilationError>(_current_pos,ErrIdentifierNotDeclare);
-//        auto symbol1 = findConstantIdentifier(identifier);
-//        if (symbol1.has_value())
-//            return std::make_optional<CompilationError>(_current_pos,ErrAssignToConstant);
 
-        // 将要被赋值的identifier的地址拿出来
-        int level_diff = 1 - symbol.value().getLevel();
-        int stack_offset = symbol.value().getOffset();
-        std::vector<int> operand1;
-        std::vector<std::vector<byte>> binary_operand1;
-        std::vector<byte> binary_opr1;
-        binary_opr1.push_back(0x0a);
-        // binary_opr1.push_back(10);
-        operand1.push_back(level_diff);
-        operand1.push_back(stack_offset);
-        binary_operand1.push_back(changeToBinary(level_diff,2));
-        binary_operand1.push_back(changeToBinary(stack_offset,4));
-        Instruction instruction1(Operation::LOADA,binary_opr1,operand1,binary_operand1 ,opr_offset++);
-        _instructions.push_back(instruction1);
+        // 将要被赋值的identifier的位置
+        statement = makeStatement(Statement::Kind::Assign);
+        statement->level = 1 - symbol.value().getLevel();
+        statement->offset = symbol.value().getOffset();
 
         // expression 就将 value放到了栈顶
         auto next = nextToken();
-        auto err = analyseExpression();
+        auto err = analyseExpression(statement->expression);
         if (err.has_value())
             return err;
-
-        // istore 存储值就 OK
-        std::vector<int> operand2;
-        std::vector<std::vector<byte>> binary_operand2;
-        std::vector<byte> binary_opr2;
-        binary_opr2.push_back(0x20);
-        // binary_opr2.push_back(0);
-        Instruction instruction2(Operation::ISTORE,binary_opr2,operand2,binary_operand2 ,opr_offset++);
-        _instructions.push_back(instruction2);
-
         return {};
     }
-}
\ No newline at end of file
+}
@@ -2,6 +2,9 @@
 
 #include "error/error.h"
 #include "instruction/instruction.h"
+#include "analyser/arena.h"
+#include "analyser/ast.h"
+#include "optimizer/passManager.h"
 #include "tokenizer/token.h"
 #include "table/constant.h"
 #include "table/function.h"
@@ -50,14 +53,19 @@ namespace miniplc0 {
         bool hasReturn;
         int _offsets; // 每当声明一个新函数的时候让offsets=0,在栈中的偏移
         int functionIndex;
-        int opr_offset; //每当函数声明时候=0，是这个函数的第几个指令
         bool isLoop;
         bool hasGlobal;
 
+        // 语法树，结点都在 _arena 里，随 Analyser 一起释放
+        Arena _arena;
+        Program _program;
+        // 已经分析完的函数，下标就是函数的 index
+        std::vector<FunctionNode*> _functionNodes;
+        // 为空的话不优化，多个 Analyser 可以共用一个
+        PassManager* _passes;
+
         // “目标代码生成”时使用
-        // 这三个vector是存储最后要输出的信息，并不是程序运行时候所需要的数据结构
-        // 指令表，用来构造 .s0 /.o0 文件
-        std::vector<Instruction> _instructions;
+        // 这两个vector是存储最后要输出的信息，并不是程序运行时候所需要的数据结构
         // 常量表和符号表
         std::vector<Constant> _constants;
         std::vector<Function> _functions;
@@ -69,15 +77,16 @@ namespace miniplc0 {
 
 	public:
 	    // 构造函数
-		explicit Analyser(std::vector<Token> v)
+		explicit Analyser(std::vector<Token> v, PassManager* passes = nullptr)
 		    : _tokens(std::move(v)), _current_pos(0,0),
 		    _constant_symbols({}),_variable_symbols({}),
 		    isConstant(false),_current_level(0),isVoid(false),
 		    isMain(false),hasMain(false),hasReturn(false),
-		    _offsets(0), functionIndex(0), opr_offset(0), isLoop(false),hasGlobal(false),
-            _instructions({}), _constants({}), _functions({}),
+		    _offsets(0), functionIndex(0), isLoop(false),hasGlobal(false),
+            _program(), _passes(passes), _constants({}), _functions({}),
             _offset(0), _nextTokenIndex(0) {}
 		// 唯一接口
+		// 先建语法树，再由 CodeGenerator 生成指令
 		std::pair<
 		std::pair<std::vector<Instruction>, std::optional<CompilationError>>,
 		std::pair<std::vector<Constant>, std::vector<CompilingFunction>>> Analyse();
@@ -92,42 +101,51 @@ namespace miniplc0 {
 		// bool isTypeSpecifier(TokenType t);
 		static bool isRelationalOperator(TokenType t);
 		// 添加
-        void addToSymbolList(std::optional<Token> identifier);
+        void addToSymbolList(std::optional<Token> identifier, std::optional<int32_t> value = {});
         void addToCompilingFunctions(std::optional<Token> identifier, int paraNum, std::string type);
         // 查找
         std::optional<CompilingFunction> findFunction(std::optional<Token> identifier);
+        // 调用很小的函数的话把函数体代入进来，不能内联的返回 call 本身
+        Expression* inlineCall(Expression* call);
         std::optional<Symbol> findIdentifier(std::optional<Token> identifier);
         std::optional<Symbol> findConstantIdentifier(std::optional<Token> identifier);
         std::optional<Symbol> findVariableIdentifier(std::optional<Token> identifier);
         // 删除
         void deleteCurrentLevelSymbol();
-        // std::string changeToBinary(int operand, int length);
-        // 十进制转换成十六进制的
-        std::vector<byte> changeToBinary(int operand, int length);
+
+        /* 建立语法树结点 */
+        Expression* makeLiteral(int32_t value);
+        Expression* makeVariable(Symbol symbol);
+        // 两边都是字面量的时候直接在编译期算出来（常量折叠）
+        Expression* makeNegate(Expression* operand);
+        Expression* makeBinary(TokenType op, Expression* lhs, Expression* rhs);
+        Statement* makeStatement(Statement::Kind kind);
 
 
         // 所有的递归子程序
+        // 分析出来的语法树结点通过引用参数带回
         std::optional<CompilationError> analyseProgram();
-        std::optional<CompilationError> analyseVariableDeclaration();
-        std::optional<CompilationError> analyseFunctionDeclaration();
-        std::optional<CompilationError> analyseInitDeclarationList();
-        std::optional<CompilationError> analyseInitDeclaration();
-        std::optional<CompilationError> analyseExpression();
-        std::optional<CompilationError> analyseMulExpression();
-        std::optional<CompilationError> analyseUnaryExpression();
-        std::optional<CompilationError> analyseFunctionCall(bool isExpression);
+        std::optional<CompilationError> analyseVariableDeclaration(std::vector<Statement*>& declarations);
+        std::optional<CompilationError> analyseFunctionDeclaration(FunctionNode*& function);
+        std::optional<CompilationError> analyseInitDeclarationList(std::vector<Statement*>& declarations);
+        std::optional<CompilationError> analyseInitDeclaration(Statement*& declaration);
+        std::optional<CompilationError> analyseExpression(Expression*& expression);
+        std::optional<CompilationError> analyseMulExpression(Expression*& expression);
+        std::optional<CompilationError> analyseUnaryExpression(Expression*& expression);
+        std::optional<CompilationError> analyseFunctionCall(bool isExpression, Expression*& call);
         std::optional<CompilationError> analyseParasList(std::optional<Token> functionType);
-        std::optional<CompilationError> analyseCompoundStatement();
+        std::optional<CompilationError> analyseCompoundStatement(Statement*& block);
         std::optional<CompilationError> analyseParasDeclaration();
-        std::optional<CompilationError> analyseStatementSeq();
-        std::optional<CompilationError> analyseStatement();
-        std::optional<CompilationError> analyseCondition();
-        std::optional<CompilationError> analyseConditionStatement();
-        std::optional<CompilationError> analyseLoopStatement();
-        std::optional<CompilationError> analyseJumpStatement();
-        std::optional<CompilationError> analysePrintStatement();
-        std::optional<CompilationError> analysePrintableList();
-        std::optional<CompilationError> analyseScanStatement();
-        std::optional<CompilationError> analyseAssignmentExpression();
+        std::optional<CompilationError> analyseStatementSeq(std::vector<Statement*>& statements);
+        // 空语句为空
+        std::optional<CompilationError> analyseStatement(Statement*& statement);
+        std::optional<CompilationError> analyseCondition(Condition& condition);
+        std::optional<CompilationError> analyseConditionStatement(Statement*& statement);
+        std::optional<CompilationError> analyseLoopStatement(Statement*& statement);
+        std::optional<CompilationError> analyseJumpStatement(Statement*& statement);
+        std::optional<CompilationError> analysePrintStatement(Statement*& statement);
+        std::optional<CompilationError> analysePrintableList(std::vector<Expression*>& printables);
+        std::optional<CompilationError> analyseScanStatement(Statement*& statement);
+        std::optional<CompilationError> analyseAssignmentExpression(Statement*& statement);
 	};
 }
\ No newline at end of file
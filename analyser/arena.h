@@ -0,0 +1,82 @@
+#ifndef CC0_ARENA_H
+#define CC0_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// 语法树用的内存池
+// 一次编译的所有结点都从这里按顺序分配，编译结束的时候一次性释放，结点不会被单独析构
+namespace miniplc0 {
+
+    // 分配在内存池里的定长数组
+    template <typename T>
+    struct List {
+        T* data;
+        std::size_t size;
+
+        T* begin() const { return data; }
+        T* end() const { return data + size; }
+        bool empty() const { return size == 0; }
+        T& operator[](std::size_t i) const { return data[i]; }
+    };
+
+    class Arena final {
+    public:
+        explicit Arena(std::size_t chunkSize = 64 * 1024)
+            : _chunkSize(chunkSize), _current(nullptr), _left(0), _used(0) {}
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* allocate(std::size_t size, std::size_t align) {
+            auto padding = (align - reinterpret_cast<std::uintptr_t>(_current) % align) % align;
+            if (padding + size > _left) {
+                // 大于一块的直接单独分配
+                auto n = std::max(_chunkSize, size + align);
+                _chunks.push_back(std::make_unique<char[]>(n));
+                _current = _chunks.back().get();
+                _left = n;
+                padding = (align - reinterpret_cast<std::uintptr_t>(_current) % align) % align;
+            }
+            auto p = _current + padding;
+            _current = p + size;
+            _left -= padding + size;
+            _used += size;
+            return p;
+        }
+
+        template <typename T, typename... Args>
+        T* make(Args&&... args) {
+            static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+            return new (allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+        }
+
+        template <typename T>
+        List<T> copy(const std::vector<T>& v) {
+            static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+            if (v.empty())
+                return {nullptr, 0};
+            auto p = static_cast<T*>(allocate(sizeof(T) * v.size(), alignof(T)));
+            std::uninitialized_copy(v.begin(), v.end(), p);
+            return {p, v.size()};
+        }
+
+        // 分配出去的字节数
+        std::size_t used() const { return _used; }
+
+    private:
+        std::size_t _chunkSize;
+        std::vector<std::unique_ptr<char[]>> _chunks;
+        char* _current;
+        std::size_t _left;
+        std::size_t _used;
+    };
+
+}
+
+#endif //CC0_ARENA_H
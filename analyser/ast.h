@@ -0,0 +1,106 @@
+#ifndef CC0_AST_H
+#define CC0_AST_H
+
+#include "analyser/arena.h"
+#include "tokenizer/token.h"
+
+#include <cstdint>
+#include <optional>
+
+// 语法树
+// 由 Analyser 在语法分析和语义分析的时候建立，标识符都已经解析成了栈上的位置，函数解析成了函数表的下标
+// 之后由 CodeGenerator 遍历生成指令
+// 所有结点都分配在 Arena 里
+namespace miniplc0 {
+
+    struct Expression {
+        enum class Kind {
+            Literal,    // value
+            Variable,   // level offset
+            Negate,     // lhs
+            Binary,     // op lhs rhs
+            Call,       // function arguments
+        };
+        Kind kind;
+        int32_t value;
+        // loada 的两个操作数，level 是层次差
+        int level;
+        int offset;
+        TokenType op;
+        Expression* lhs;
+        Expression* rhs;
+        int function;
+        List<Expression*> arguments;
+    };
+
+    // <condition> ::=<expression>[<relational-operator><expression>]
+    // 没有关系运算符的时候 rhs 为空
+    struct Condition {
+        Expression* lhs;
+        TokenType op;
+        Expression* rhs;
+    };
+
+    struct Statement {
+        enum class Kind {
+            Block,          // body
+            Declaration,    // level offset expression，未初始化的变量 expression 为空
+            If,             // condition then otherwise，没有 else 的时候 otherwise 为空
+            While,          // condition then
+            Return,         // expression，void 函数为空
+            Print,          // printables
+            Scan,           // level offset
+            Assign,         // level offset expression
+            Call,           // expression
+        };
+        Kind kind;
+        List<Statement*> body;
+        Expression* expression;
+        Condition condition;
+        Statement* then;
+        Statement* otherwise;
+        List<Expression*> printables;
+        int level;
+        int offset;
+    };
+
+    struct FunctionNode {
+        int index;
+        bool isVoid;
+        Statement* body;
+        // 参数和局部变量一共占的栈空间
+        int frameSize;
+        // 函数体只有一个 return <表达式>、没有局部变量的时候是这个表达式，可以内联，否则为空
+        Expression* inlineBody;
+    };
+
+    // 编译期计算 lhs op rhs，和虚拟机一样按32位补码回绕
+    // 会在运行时出错的（除以0，INT_MIN/-1）不计算，留到运行时
+    inline std::optional<int32_t> fold(TokenType op, int32_t lhs, int32_t rhs) {
+        auto l = static_cast<uint32_t>(lhs);
+        auto r = static_cast<uint32_t>(rhs);
+        switch (op) {
+            case TokenType::PLUS_SIGN:
+                return static_cast<int32_t>(l + r);
+            case TokenType::MINUS_SIGN:
+                return static_cast<int32_t>(l - r);
+            case TokenType::MULTIPLICATION_SIGN:
+                return static_cast<int32_t>(l * r);
+            case TokenType::DIVISION_SIGN:
+                if (rhs == 0 || (lhs == INT32_MIN && rhs == -1))
+                    return {};
+                return lhs / rhs;
+            default:
+                return {};
+        }
+    }
+
+    struct Program {
+        // 全局变量的声明，在 .start 里执行
+        List<Statement*> globals;
+        List<FunctionNode*> functions;
+    };
+
+}
+
+#endif //CC0_AST_H
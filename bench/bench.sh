@@ -0,0 +1,359 @@
+#!/usr/bin/env bash
+# Benchmarks of cc0, every section prints the minimum wall time of ROUNDS runs of each variant.
+#   bench/bench.sh [-c cc0] [-b baseline-cc0] [-r rounds] [section...]
+# -c is the cc0 to measure, ./_gate_build/cc0 by default, build it in Release for meaningful times;
+# -b is an older cc0 to compare with in the sections that measure a change of the VM or the compiler,
+# they only time the current one without it. The workloads are generated into a temporary directory.
+# With no section given, all of them are run.
+set -euo pipefail
+
+here=$(cd "$(dirname "$0")" && pwd)
+cc0=./_gate_build/cc0
+base=
+rounds=5
+while getopts "c:b:r:" opt; do
+    case $opt in
+        c) cc0=$OPTARG ;;
+        b) base=$OPTARG ;;
+        r) rounds=$OPTARG ;;
+        *) exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+cc0=$(realpath "$cc0")
+[ -n "$base" ] && base=$(realpath "$base")
+cores=$(nproc)
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+# the minimum wall time in milliseconds of $rounds runs of the command, which has to succeed
+ms() {
+    local best=
+    for _ in $(seq "$rounds"); do
+        local start end
+        start=$(date +%s%N)
+        if ! "$@" </dev/null >/dev/null 2>"$work/stderr"; then
+            echo "failed: $*" >&2
+            cat "$work/stderr" >&2
+            exit 1
+        fi
+        end=$(date +%s%N)
+        local t=$(((end - start) / 1000))
+        if [ -z "$best" ] || [ "$t" -lt "$best" ]; then
+            best=$t
+        fi
+    done
+    printf "%d.%03d" $((best / 1000)) $((best % 1000))
+}
+
+row() {
+    printf "  %-36s %12s\n" "$1" "$2"
+}
+
+# a / b with 2 decimals
+ratio() {
+    awk -v a="$1" -v b="$2" 'BEGIN { printf "%.2f", a / b }'
+}
+
+# 1 2 4 ... up to the number of cores, which is always included
+job_counts() {
+    local jobs=1
+    while [ "$jobs" -lt "$cores" ]; do
+        echo "$jobs"
+        jobs=$((jobs * 2))
+    done
+    echo "$cores"
+}
+
+# --batch from 1 thread to all the cores, 64 inputs of fib(24)
+bench_batch() {
+    echo "batch: 64 runs of fib(24), ms"
+    "$cc0" -c "$here/fib.c0" -o fib.o0
+    : > inputs
+    for i in $(seq 64); do
+        echo 24 > "in$i"
+        echo "in$i" >> inputs
+    done
+    local one=
+    for jobs in $(job_counts); do
+        local t
+        t=$(ms "$cc0" -r fib.o0 --batch inputs -j "$jobs")
+        [ -z "$one" ] && one=$t
+        row "-j $jobs" "$t  x$(ratio "$one" "$t")"
+    done
+}
+
+# 300 small sources, one cc0 process per file against one @list from 1 thread to all the cores
+bench_compile() {
+    echo "compile: 300 sources of 4 functions, ms"
+    : > sources
+    for i in $(seq 300); do
+        cat > "src$i.c0" <<C0
+int g = $i;
+int twice(int x) { return x * 2 + g; }
+int sum(int n) {
+    int s = 0;
+    int i = 0;
+    while (i < n) {
+        s = s + twice(i) - $i;
+        i = i + 1;
+    }
+    return s;
+}
+int pick(int n) {
+    if (n > $i) return sum(n);
+    else return sum($i - n);
+}
+int main() {
+    int n;
+    scan(n);
+    print(pick(n), sum(n / 17));
+    return 0;
+}
+C0
+        echo "src$i.c0" >> sources
+    done
+    local each
+    each=$(ms bash -c "for f in \$(cat sources); do '$cc0' -c -O2 \$f -o \${f%.c0}.o0; done")
+    row "one process per file" "$each  x1.00"
+    for jobs in $(job_counts); do
+        local t
+        t=$(ms "$cc0" -c -O2 @sources -j "$jobs")
+        row "@list -j $jobs" "$t  x$(ratio "$each" "$t")"
+    done
+}
+
+# the front end and the code generation on one large source, against the baseline
+bench_codegen() {
+    echo "codegen: -O0 of one source of 3000 functions, ms"
+    {
+        echo "int g = 1;"
+        for i in $(seq 3000); do
+            cat <<C0
+int f$i(int a, int b) {
+    int i = 0;
+    int s = a * $i + (b - g) / 3;
+    while (i < b) {
+        if (s > a * 2 + $i) s = s - (a + i) * 2;
+        else s = s + i * (b - $i) + g;
+        i = i + 1;
+    }
+    print(s, -s, s * $i - a);
+    return s + f$((i > 1 ? i - 1 : 1))(b, a);
+}
+C0
+        done
+        echo "int main() { print(f1(1, 2)); return 0; }"
+    } > large.c0
+    [ -n "$base" ] && row "baseline" "$(ms "$base" -s large.c0 -o large.s0)"
+    row "current" "$(ms "$cc0" -s large.c0 -o large.s0)"
+}
+
+# loading a binary file of many functions of which main calls one, against the baseline
+bench_load() {
+    echo "load: cc0 -r of 20000 functions, main calls one, ms"
+    {
+        for i in $(seq 20000); do
+            cat <<C0
+int f$i(int a) {
+    int s = a * $i;
+    while (s > 100) s = s / 3 - a;
+    print(s, a + $i);
+    return s;
+}
+C0
+        done
+        echo "int main() { print(f15000(9)); return 0; }"
+    } > load.c0
+    if [ -n "$base" ]; then
+        "$base" -c load.c0 -o load-base.o0
+        row "baseline" "$(ms "$base" -r load-base.o0)"
+    fi
+    "$cc0" -c load.c0 -o load.o0
+    row "current" "$(ms "$cc0" -r load.o0)"
+}
+
+# a main of about 50000 instructions run 300 times, so its code does not stay in the L1 cache,
+# against the baseline
+bench_code() {
+    echo "code: 300 runs through a main of 3000 statements, -O0, ms"
+    {
+        echo "int main() {"
+        echo "    int i = 0;"
+        echo "    int s = 0;"
+        echo "    while (i < 300) {"
+        for k in $(seq 3000); do
+            echo "        s = s + i * $k - s / 7;"
+        done
+        echo "        i = i + 1;"
+        echo "    }"
+        echo "    print(s);"
+        echo "    return 0;"
+        echo "}"
+    } > code.c0
+    if [ -n "$base" ]; then
+        "$base" -c code.c0 -o code-base.o0
+        row "baseline" "$(ms "$base" -r code-base.o0)"
+    fi
+    "$cc0" -c code.c0 -o code.o0
+    row "current" "$(ms "$cc0" -r code.o0)"
+}
+
+# programs made of calls, against the baseline
+bench_calls() {
+    echo "calls: fib(30) and ackermann(2, 2000) + ackermann(3, 7), -O0, ms"
+    cat > ack.c0 <<C0
+int ack(int m, int n) {
+    if (m == 0) return n + 1;
+    if (n == 0) return ack(m - 1, 1);
+    return ack(m - 1, ack(m, n - 1));
+}
+int main() {
+    print(ack(2, 2000) + ack(3, 7));
+    return 0;
+}
+C0
+    echo 30 > fib.in
+    local program
+    for program in fib ack; do
+        local source=$program.c0
+        [ "$program" = fib ] && source=$here/fib.c0
+        if [ -n "$base" ]; then
+            "$base" -c "$source" -o "$program-base.o0"
+            row "$program baseline" "$(ms bash -c "'$base' -r $program-base.o0 < fib.in")"
+        fi
+        "$cc0" -c "$source" -o "$program.o0"
+        row "$program current" "$(ms bash -c "'$cc0' -r $program.o0 < fib.in")"
+    done
+}
+
+# variables of outer frames read through loada, against the baseline, -b an older cc0 that has -r
+bench_globals() {
+    echo "globals: 10^6 iterations reading and writing two globals in main and in a callee, -O0, ms"
+    cat > globals.c0 <<C0
+int a = 0;
+int b = 1;
+void step(int i) {
+    a = a + b * i;
+    b = b + 1 - a / 1000000;
+    return;
+}
+int main() {
+    int i = 0;
+    int n;
+    scan(n);
+    while (i < n) {
+        step(i);
+        a = a - b;
+        i = i + 1;
+    }
+    print(a, b);
+    return 0;
+}
+C0
+    if [ -n "$base" ]; then
+        "$base" -c globals.c0 -o globals-base.o0
+        row "baseline" "$(ms bash -c "echo 1000000 | '$base' -r globals-base.o0")"
+    fi
+    "$cc0" -c globals.c0 -o globals.o0
+    row "current" "$(ms bash -c "echo 1000000 | '$cc0' -r globals.o0")"
+}
+
+# the same program on the stack vm and translated for the register vm
+bench_regvm() {
+    echo "regvm: fib(27)"
+    "$cc0" -c "$here/fib.c0" -o fib.o0
+    echo 27 > fib.in
+    row "vm" "instructions        ms"
+    local flags
+    for flags in "" "--regvm"; do
+        local count
+        count=$("$cc0" -r fib.o0 $flags --count-instructions < fib.in 2>&1 >/dev/null | awk '/^executed/ { print $2 }')
+        local t
+        t=$(ms bash -c "'$cc0' -r fib.o0 $flags < fib.in")
+        row "${flags:-stack}" "$(printf "%12d %9s" "$count" "$t")"
+    done
+}
+
+# the cost of the limits on a run that never reaches them
+bench_limits() {
+    echo "limits: fib(27), ms"
+    "$cc0" -c "$here/fib.c0" -o fib.o0
+    echo 27 > fib.in
+    local none
+    none=$(ms bash -c "'$cc0' -r fib.o0 < fib.in")
+    row "no limit" "$none  x1.00"
+    local flags
+    for flags in "--max-instructions 1000000000000" "--time-limit 1000000" "--max-heap 1000000"; do
+        local t
+        t=$(ms bash -c "'$cc0' -r fib.o0 $flags < fib.in")
+        row "$flags" "$t  x$(ratio "$t" "$none")"
+    done
+}
+
+# the cost of --profile, the samples taken are counted from the folded stacks
+bench_profile() {
+    echo "profile: fib(30), ms"
+    "$cc0" -c "$here/fib.c0" -o fib.o0
+    echo 30 > fib.in
+    local none
+    none=$(ms bash -c "'$cc0' -r fib.o0 < fib.in")
+    row "no profile" "$none  x1.00"
+    local hz
+    for hz in 100 1000; do
+        local t
+        t=$(ms bash -c "'$cc0' -r fib.o0 --profile profile.txt --profile-hz $hz < fib.in")
+        local samples
+        samples=$(awk '{ n += $NF } END { print n + 0 }' profile.txt)
+        row "--profile-hz $hz" "$t  x$(ratio "$t" "$none")  $samples samples"
+    done
+}
+
+# the instructions executed and the time of a loop heavy program at each optimization level,
+# the count is read from the size of the --trace file, a header of 8 bytes and 17 bytes a record
+bench_opt() {
+    echo "opt: a loop with invariant, common and dead expressions"
+    cat > opt.c0 <<C0
+int g = 3;
+int work(int a, int b, int n) {
+    int i = 0;
+    int s = 0;
+    int c;
+    int unused;
+    while (i < n) {
+        c = a;
+        unused = c * b;
+        s = s + (a * b + g) - (a * b + g) / 2 + c * 4;
+        if (0) print(s);
+        i = i + 1;
+    }
+    return s;
+}
+int main() {
+    int n;
+    scan(n);
+    print(work(7, 9, n));
+    return 0;
+}
+C0
+    row "level" "instructions        ms"
+    local level
+    for level in 0 1 2; do
+        "$cc0" -c -O$level opt.c0 -o opt$level.o0
+        echo 20000 > small
+        "$cc0" -r opt$level.o0 --trace opt$level.trace < small > /dev/null
+        local count=$((($(stat -c %s opt$level.trace) - 8) / 17))
+        local t
+        t=$(ms bash -c "echo 500000 | '$cc0' -r opt$level.o0")
+        row "-O$level" "$(printf "%12d %9s" "$count" "$t")"
+    done
+}
+
+sections=(batch compile codegen load code calls globals regvm limits profile opt)
+[ $# -gt 0 ] && sections=("$@")
+for section in "${sections[@]}"; do
+    "bench_$section"
+    echo
+done
@@ -54,6 +54,18 @@ public:
     }
 };
 
+// a limit set with VM::setLimits was reached
+class ResourceExhausted : public std::exception {
+public:
+    ResourceExhausted(std::string msg) : msg(std::move(msg)) {}
+    virtual ~ResourceExhausted() {}
+    virtual const char* what() const noexcept {
+        return msg.c_str();
+    }
+private:
+    std::string msg;
+};
+
 class InvalidInstruction : public std::exception {
 public:
     InvalidInstruction() {}
@@ -12,6 +12,10 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <array>
+#include <iterator>
+#include <mutex>
+#include <memory>
 
 File::File(
     vm::u4 version, 
@@ -51,139 +55,298 @@ void File::output_text(std::ostream& out) {
     for (auto& fun : functions) {
         printfmt(out, ".F{}: # {}", i, names.at(i)); println(out);
         int j = 0;
-        for (auto& ins : fun.instructions) {
+        for (auto& ins : fun.instructions()) {
             println(out, j++, ins);
         }
         ++i;
     }
 }
 
-void File::output_binary(std::ofstream& out) {
+void File::strip() {
+    auto mainIndex = std::find_if(functions.begin(), functions.end(), [this](const vm::Function& fun) {
+        auto& name = constants.at(fun.nameIndex);
+        return name.type == vm::Constant::Type::STRING && std::get<vm::str_t>(name.value) == "main";
+    });
+    if (mainIndex == functions.end()) {
+        // leave it to the vm to complain
+        return;
+    }
 
-    char bytes[8];
-    const auto writeNBytes = [&](void* addr, int count) {
-        assert(0 < count && count <= 8);
-        char* p = reinterpret_cast<char*>(addr) + (count-1);
-        for (int i = 0; i < count; ++i) {
-            bytes[i] = *p--;
+    // the call graph from .start and main
+    std::vector<bool> called(functions.size(), false);
+    std::vector<std::size_t> work;
+    const auto visit = [&](std::size_t index) {
+        if (index < functions.size() && !called[index]) {
+            called[index] = true;
+            work.push_back(index);
         }
-        out.write(bytes, count);
     };
+    const auto isCall = [](vm::OpCode op) {
+        return op == vm::OpCode::call || op == vm::OpCode::tailcall;
+    };
+    for (auto& ins : start) {
+        if (isCall(ins.op)) {
+            visit(ins.x);
+        }
+    }
+    visit(mainIndex - functions.begin());
+    while (!work.empty()) {
+        auto index = work.back();
+        work.pop_back();
+        for (auto& ins : functions[index].instructions()) {
+            if (isCall(ins.op)) {
+                visit(ins.x);
+            }
+        }
+    }
 
-    // magic
-    out.write("\x43\x30\x3A\x29", 4);
-    // version
-    out.write("\x00\x00\x00\x01", 4);
-    // constants_count
-    vm::u2 constants_count = constants.size();
-    writeNBytes(&constants_count, sizeof constants_count);
-    // constants
-    for (auto& constant : constants) {
-        switch (constant.type)
-        {
-        case vm::Constant::Type::STRING: {
-            out.write("\x00", 1);
-            std::string v = std::get<vm::str_t>(constant.value);
-            vm::u2 len = v.length();
-            writeNBytes(&len, sizeof len);
-            out.write(v.c_str(), len);
-        } break;
-        case vm::Constant::Type::INT: {
-            out.write("\x01", 1);
-            vm::int_t v = std::get<vm::int_t>(constant.value);
-            writeNBytes(&v, sizeof v);
-        } break;
-        case vm::Constant::Type::DOUBLE: {
-            out.write("\x02", 1);
-            vm::double_t v = std::get<vm::double_t>(constant.value);
-            writeNBytes(&v, sizeof v);
-        } break;
-        default: assert(("unexpected error", false)); break;
+    std::vector<bool> referenced(constants.size(), false);
+    const auto reference = [&](const std::vector<vm::Instruction>& instructions) {
+        for (auto& ins : instructions) {
+            if (ins.op == vm::OpCode::loadc && ins.x < constants.size()) {
+                referenced[ins.x] = true;
+            }
+        }
+    };
+    reference(start);
+    for (std::size_t i = 0; i < functions.size(); ++i) {
+        if (called[i]) {
+            referenced[functions[i].nameIndex] = true;
+            reference(functions[i].instructions());
         }
     }
 
-    auto to_binary = [&](const std::vector<vm::Instruction>& v) {
-        vm::u2 instructions_count = v.size();
-        writeNBytes(&instructions_count, sizeof instructions_count);
-        for (auto& ins : v) {
-            vm::u1 op = static_cast<vm::u1>(ins.op); 
-            writeNBytes(&op, sizeof op);
+    // old index -> new index, out of range operands are kept for the vm to reject
+    std::vector<vm::u4> constantIndex(constants.size());
+    std::vector<vm::Constant> keptConstants;
+    for (std::size_t i = 0; i < constants.size(); ++i) {
+        constantIndex[i] = keptConstants.size();
+        if (referenced[i]) {
+            keptConstants.push_back(std::move(constants[i]));
+        }
+    }
+    std::vector<vm::u4> functionIndex(functions.size());
+    std::vector<vm::Function> keptFunctions;
+    for (std::size_t i = 0; i < functions.size(); ++i) {
+        functionIndex[i] = keptFunctions.size();
+        if (called[i]) {
+            keptFunctions.push_back(std::move(functions[i]));
+        }
+    }
+    const auto renumber = [&](std::vector<vm::Instruction>& instructions) {
+        for (auto& ins : instructions) {
+            if (ins.op == vm::OpCode::loadc && ins.x < constantIndex.size()) {
+                ins.x = constantIndex[ins.x];
+            }
+            else if (isCall(ins.op) && ins.x < functionIndex.size()) {
+                ins.x = functionIndex[ins.x];
+            }
+        }
+    };
+    renumber(start);
+    for (auto& fun : keptFunctions) {
+        fun.nameIndex = constantIndex[fun.nameIndex];
+        renumber(fun.instructions());
+    }
+    constants = std::move(keptConstants);
+    functions = std::move(keptFunctions);
+}
+
+vm::u4 File::minimumVersion() const {
+    const auto fits = [](std::size_t n) {
+        return n <= U2_MAX;
+    };
+    const auto instructionsFit = [&](const std::vector<vm::Instruction>& instructions) {
+        if (!fits(instructions.size())) {
+            return false;
+        }
+        for (auto& ins : instructions) {
             if (auto it = vm::paramSizeOfOpCode.find(ins.op); it != vm::paramSizeOfOpCode.end()) {
-                auto paramSizes = it->second;
-                switch (paramSizes[0]) {
-                #define CASE(n) case n: { vm::u##n x = ins.x; writeNBytes(&x, n); }
-                CASE(1); break; 
-                CASE(2); break;
-                CASE(4); break;
-                #undef CASE
-                default: assert(("unexpected error", false));
+                auto& paramSizes = it->second;
+                if ((paramSizes[0] == 2 && !fits(ins.x)) || (paramSizes.size() == 2 && paramSizes[1] == 2 && !fits(ins.y))) {
+                    return false;
                 }
+            }
+        }
+        return true;
+    };
+    bool v1 = fits(constants.size()) && fits(functions.size()) && instructionsFit(start);
+    for (auto& constant : constants) {
+        v1 = v1 && (constant.type != vm::Constant::Type::STRING || fits(std::get<vm::str_t>(constant.value).length()));
+    }
+    for (auto& fun : functions) {
+        v1 = v1 && fits(fun.nameIndex) && instructionsFit(fun.instructions());
+    }
+    return v1 ? 1 : 2;
+}
+
+void File::output_binary(std::ostream& out) {
+    if (version != 1 && version != 2) {
+        throw InvalidFile("unsupported version");
+    }
+    if (version < minimumVersion()) {
+        throw InvalidFile("too large for a version 1 file");
+    }
+
+    // big-endian
+    const auto write = [](std::ostream& out, auto value) {
+        char bytes[sizeof value];
+        auto p = reinterpret_cast<const char*>(&value);
+        std::reverse_copy(p, p + sizeof value, bytes);
+        out.write(bytes, sizeof value);
+    };
+    const auto writeCount = [&](std::ostream& out, std::size_t count) {
+        if (version == 1) {
+            write(out, static_cast<vm::u2>(count));
+        }
+        else {
+            write(out, static_cast<vm::u4>(count));
+        }
+    };
+    const auto writeOperand = [&](std::ostream& out, vm::u4 value, int size) {
+        switch (vm::paramSizeInVersion(size, version)) {
+        case 1: write(out, static_cast<vm::u1>(value)); break;
+        case 2: write(out, static_cast<vm::u2>(value)); break;
+        case 4: write(out, static_cast<vm::u4>(value)); break;
+        default: assert(("unexpected error", false));
+        }
+    };
+    const auto writeConstants = [&](std::ostream& out) {
+        writeCount(out, constants.size());
+        for (auto& constant : constants) {
+            switch (constant.type)
+            {
+            case vm::Constant::Type::STRING: {
+                out.write("\x00", 1);
+                auto& v = std::get<vm::str_t>(constant.value);
+                writeCount(out, v.length());
+                out.write(v.c_str(), v.length());
+            } break;
+            case vm::Constant::Type::INT: {
+                out.write("\x01", 1);
+                write(out, std::get<vm::int_t>(constant.value));
+            } break;
+            case vm::Constant::Type::DOUBLE: {
+                out.write("\x02", 1);
+                write(out, std::get<vm::double_t>(constant.value));
+            } break;
+            default: assert(("unexpected error", false)); break;
+            }
+        }
+    };
+    const auto writeInstructions = [&](std::ostream& out, const std::vector<vm::Instruction>& v) {
+        for (auto& ins : v) {
+            write(out, static_cast<vm::u1>(ins.op));
+            if (auto it = vm::paramSizeOfOpCode.find(ins.op); it != vm::paramSizeOfOpCode.end()) {
+                auto& paramSizes = it->second;
+                writeOperand(out, ins.x, paramSizes[0]);
                 if (paramSizes.size() == 2) {
-                    switch (paramSizes[1]) {
-                    #define CASE(n) case n: { vm::u##n y = ins.y; writeNBytes(&y, n); }
-                    CASE(1); break; 
-                    CASE(2); break;
-                    CASE(4); break;
-                    #undef CASE
-                    default: assert(("unexpected error", false));
-                    }
+                    writeOperand(out, ins.y, paramSizes[1]);
                 }
             }
         }
     };
 
-    // start
-    to_binary(start);
-    // functions_count
-    vm::u2 functions_count = functions.size();
-    writeNBytes(&functions_count, sizeof functions_count);
-    // functions
+    // magic
+    out.write("\x43\x30\x3A\x29", 4);
+    write(out, version);
+    if (version == 1) {
+        writeConstants(out);
+        writeCount(out, start.size());
+        writeInstructions(out, start);
+        writeCount(out, functions.size());
+        for (auto& fun : functions) {
+            write(out, static_cast<vm::u2>(fun.nameIndex));
+            write(out, fun.paramSize);
+            write(out, fun.level);
+            writeCount(out, fun.instructions().size());
+            writeInstructions(out, fun.instructions());
+        }
+        return;
+    }
+
+    std::ostringstream constantsSection, startSection, functionsSection, codeSection;
+    writeConstants(constantsSection);
+    writeCount(startSection, start.size());
+    writeInstructions(startSection, start);
+    writeCount(functionsSection, functions.size());
     for (auto& fun : functions) {
-        vm::u2 v;
-        v = fun.nameIndex; writeNBytes(&v, sizeof v);
-        v = fun.paramSize; writeNBytes(&v, sizeof v);
-        v = fun.level;     writeNBytes(&v, sizeof v);
-        to_binary(fun.instructions);
+        auto offset = static_cast<vm::u4>(codeSection.tellp());
+        writeInstructions(codeSection, fun.instructions());
+        write(functionsSection, fun.nameIndex);
+        write(functionsSection, fun.paramSize);
+        write(functionsSection, fun.level);
+        write(functionsSection, offset);
+        write(functionsSection, static_cast<vm::u4>(codeSection.tellp()) - offset);
+        write(functionsSection, static_cast<vm::u4>(fun.instructions().size()));
+    }
+    std::string sections[] = {constantsSection.str(), startSection.str(), functionsSection.str(), codeSection.str()};
+    // magic, version and the 4 offsets
+    vm::u4 offset = 24;
+    for (auto& section : sections) {
+        write(out, offset);
+        offset += section.size();
+    }
+    for (auto& section : sections) {
+        out.write(section.data(), section.size());
     }
 }
 
-File File::parse_file_binary(std::ifstream& in) {
-    // read raw
-    const std::vector<unsigned char> buffer(std::istreambuf_iterator<char>(in), {});
-    size_t pos = 0;
-    const auto bufferSize = buffer.size();
-    const auto readByte = [&]() {
-        if (pos + 1 > bufferSize) {
-            throw InvalidFile("incomplete binary file");
-        }
-        vm::u1 rtv = static_cast<vm::u1>(buffer[pos]);
-        pos += 1;
-        return rtv;
-    };
-    const auto read2bytes = [&] {
-        if (pos + 2 > bufferSize) {
-            throw InvalidFile("incomplete binary file");
+namespace {
+
+// the operands of every opcode in a version, looked up for every instruction
+struct OperandSizes {
+    bool valid;
+    int count;
+    int size[2];
+};
+
+const OperandSizes& operandSizes(vm::OpCode op, vm::u4 version) {
+    static const auto tables = [] {
+        std::array<std::array<OperandSizes, 256>, 2> tables{};
+        for (vm::u4 version = 1; version <= 2; ++version) {
+            auto& table = tables[version - 1];
+            for (auto& [op, name] : vm::nameOfOpCode) {
+                auto& sizes = table[static_cast<vm::u1>(op)];
+                sizes.valid = true;
+                if (auto it = vm::paramSizeOfOpCode.find(op); it != vm::paramSizeOfOpCode.end()) {
+                    for (auto paramSize : it->second) {
+                        sizes.size[sizes.count++] = vm::paramSizeInVersion(paramSize, version);
+                    }
+                }
+            }
         }
-        vm::u2 rtv = static_cast<vm::u2>(
-            (buffer[pos] << 8) | buffer[pos+1]
-        );
+        return tables;
+    }();
+    return tables[version - 1][static_cast<vm::u1>(op)];
+}
+
+// reads the big-endian numbers of a binary file from `pos`
+class BinaryReader {
+public:
+    BinaryReader(const std::vector<unsigned char>& buffer, vm::u4 version, std::size_t pos = 0)
+        : buffer(buffer), version(version), pos(pos) {}
+
+    vm::u1 readByte() {
+        ensure(1, "incomplete binary file");
+        return buffer[pos++];
+    }
+    vm::u2 read2bytes() {
+        ensure(2, "incomplete binary file");
+        vm::u2 rtv = static_cast<vm::u2>((buffer[pos] << 8) | buffer[pos+1]);
         pos += 2;
         return rtv;
-    };
-    const auto read4bytes = [&]() {
-        if (pos + 4 > bufferSize) {
-            throw InvalidFile("incomplete binary file");
-        }
+    }
+    vm::u4 read4bytes() {
+        ensure(4, "incomplete binary file");
         vm::u4 rtv = static_cast<vm::u4>(
             (buffer[pos] << 24) | (buffer[pos+1] << 16) | (buffer[pos+2] << 8) | buffer[pos+3]
         );
         pos += 4;
         return rtv;
-    };
-    const auto readDouble = [&]() {
-        if (pos + 8 > bufferSize) {
-            throw InvalidFile("invalid binary file: incomplete double constant");
-        }
+    }
+    vm::double_t readDouble() {
+        ensure(8, "invalid binary file: incomplete double constant");
         union {
             vm::double_t d;
             unsigned char b[8];
@@ -192,64 +355,191 @@ File File::parse_file_binary(std::ifstream& in) {
             rtv.b[i] = buffer[pos++];
         }
         return rtv.d;
-    };
-    const auto readString = [&](vm::u2 length) {
-        if (pos + length > bufferSize) {
-            throw InvalidFile("invalid binary file: incomplete string constant");
-        }
-        vm::str_t rtv;
-        while (length-- ) {
-            rtv += buffer[pos++];
-        }
+    }
+    vm::str_t readString(vm::u4 length) {
+        ensure(length, "invalid binary file: incomplete string constant");
+        vm::str_t rtv(buffer.begin() + pos, buffer.begin() + pos + length);
+        pos += length;
         return rtv;
-    };
-    const auto readInstruction = [&]() {
-        vm::Instruction ins;
+    }
+    vm::u4 readCount() {
+        return version == 1 ? read2bytes() : read4bytes();
+    }
+    vm::u4 readOperand(int size) {
+        switch (size) {
+        case 1: return readByte();
+        case 2: return read2bytes();
+        default: return read4bytes();
+        }
+    }
+    vm::Instruction readInstruction() {
+        vm::Instruction ins{};
         ins.op = static_cast<vm::OpCode>(readByte());
-        if (vm::nameOfOpCode.count(ins.op) == 0) {
+        auto& sizes = operandSizes(ins.op, version);
+        if (!sizes.valid) {
             throw InvalidFile("invalid binary file: invalid opcode");
         }
-        if (auto it = vm::paramSizeOfOpCode.find(ins.op); it != vm::paramSizeOfOpCode.end()) {
-            auto paramSizes = it->second;
-            switch (paramSizes[0]) {
-            case 1: ins.x = readByte(); break;
-            case 2: ins.x = read2bytes(); break;
-            case 4: ins.x = read4bytes(); break;
-            default: assert(("unexpected error", false));
+        if (sizes.count > 0) {
+            ins.x = readOperand(sizes.size[0]);
+        }
+        if (sizes.count > 1) {
+            ins.y = readOperand(sizes.size[1]);
+        }
+        return ins;
+    }
+    std::vector<vm::Instruction> readInstructions(vm::u4 count) {
+        std::vector<vm::Instruction> rtv;
+        // every instruction takes at least a byte, do not trust the count further than that
+        rtv.reserve(std::min<std::size_t>(count, buffer.size() - pos));
+        for (vm::u4 j = 0; j < count; ++j) {
+            rtv.push_back(readInstruction());
+        }
+        return rtv;
+    }
+    // check the opcodes and find the end of the instructions without decoding them
+    void skipInstructions(vm::u4 count) {
+        for (vm::u4 j = 0; j < count; ++j) {
+            auto& sizes = operandSizes(static_cast<vm::OpCode>(readByte()), version);
+            if (!sizes.valid) {
+                throw InvalidFile("invalid binary file: invalid opcode");
             }
-            if (paramSizes.size() == 2) {
-                ins.y = read4bytes();
+            std::size_t size = 0;
+            for (int k = 0; k < sizes.count; ++k) {
+                size += sizes.size[k];
             }
+            ensure(size, "incomplete binary file");
+            pos += size;
         }
-        return ins;
+    }
+
+    const std::vector<unsigned char>& buffer;
+    const vm::u4 version;
+    std::size_t pos;
+
+private:
+    void ensure(std::size_t count, const char* msg) const {
+        if (pos + count > buffer.size()) {
+            throw InvalidFile(msg);
+        }
+    }
+};
+
+// the code of the functions of a binary file, it keeps the whole file
+// and decodes a function the first time the vm calls it
+class BinaryCode final : public vm::CodeSource {
+public:
+    BinaryCode(std::shared_ptr<const std::vector<unsigned char>> image, vm::u4 version, vm::u4 functionsCount)
+        : _image(std::move(image)), _version(version),
+          _once(new std::once_flag[functionsCount]), _decoded(functionsCount) {
+        _ranges.reserve(functionsCount);
+    }
+
+    // `count` instructions in `size` bytes from `offset` of the file
+    void add(std::size_t offset, vm::u4 size, vm::u4 count) {
+        _ranges.push_back({offset, size, count});
+    }
+
+    const std::vector<vm::Instruction>& instructions(vm::u4 index) const override {
+        std::call_once(_once[index], [this, index] {
+            auto& range = _ranges[index];
+            BinaryReader reader(*_image, _version, range.offset);
+            auto instructions = reader.readInstructions(range.count);
+            if (reader.pos != range.offset + range.size) {
+                throw InvalidFile("invalid binary file: invalid function size");
+            }
+            _decoded[index] = std::move(instructions);
+        });
+        return _decoded[index];
+    }
+
+private:
+    struct Range {
+        std::size_t offset;
+        vm::u4 size;
+        vm::u4 count;
     };
+    std::shared_ptr<const std::vector<unsigned char>> _image;
+    vm::u4 _version;
+    std::vector<Range> _ranges;
+    std::unique_ptr<std::once_flag[]> _once;
+    // every element is only written once, by the thread that decodes it
+    mutable std::vector<std::vector<vm::Instruction>> _decoded;
+};
+
+std::shared_ptr<const std::vector<unsigned char>> readAll(std::ifstream& in) {
+    auto image = std::make_shared<std::vector<unsigned char>>();
+    auto begin = in.tellg();
+    if (in.seekg(0, std::ios::end) && begin != std::streampos(-1)) {
+        auto end = in.tellg();
+        in.seekg(begin);
+        image->resize(static_cast<std::size_t>(end - begin));
+        in.read(reinterpret_cast<char*>(image->data()), static_cast<std::streamsize>(image->size()));
+        image->resize(static_cast<std::size_t>(in.gcount()));
+    }
+    else {
+        // not seekable
+        in.clear();
+        image->assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    return image;
+}
+
+}
+
+File File::parse_file_binary(std::ifstream& in) {
+    // read raw, the code of the functions keeps it until they are decoded
+    auto image = readAll(in);
+    auto bufferSize = image->size();
 
     // parse magic
-    auto magic = read4bytes(); 
+    BinaryReader header(*image, 1);
+    auto magic = header.read4bytes();
     if (magic != magic_v) {
         throw InvalidFile("invalid binary file: invalid magic");
     }
 
     // parse version
-    auto version = read4bytes(); 
+    auto version = header.read4bytes();
+    if (version != 1 && version != 2) {
+        throw InvalidFile("invalid binary file: unsupported version");
+    }
+    BinaryReader reader(*image, version, header.pos);
+
+    // the offsets of the sections of version 2
+    vm::u4 offsets[4] = {};
+    if (version == 2) {
+        for (auto& offset : offsets) {
+            offset = reader.read4bytes();
+        }
+        if (offsets[0] != reader.pos || !std::is_sorted(std::begin(offsets), std::end(offsets)) || offsets[3] > bufferSize) {
+            throw InvalidFile("invalid binary file: invalid section offsets");
+        }
+    }
+    const auto expectSection = [&](int section) {
+        if (version == 2 && reader.pos != offsets[section]) {
+            throw InvalidFile("invalid binary file: invalid section offsets");
+        }
+    };
 
     // parse constants
-    auto constantsCount = read2bytes();
+    auto constantsCount = reader.readCount();
     std::vector<vm::Constant> constants;
-    for (int j = 0; j < constantsCount; ++j) {
+    // a constant takes at least 3 bytes
+    constants.reserve(std::min<std::size_t>(constantsCount, bufferSize / 3));
+    for (vm::u4 j = 0; j < constantsCount; ++j) {
         vm::Constant constant;
-        constant.type = static_cast<vm::Constant::Type>(readByte());
+        constant.type = static_cast<vm::Constant::Type>(reader.readByte());
         switch (constant.type)
         {
         case vm::Constant::Type::STRING: {
-            auto length = read2bytes();
-            constant.value = std::move(readString(length));
+            auto length = reader.readCount();
+            constant.value = reader.readString(length);
         } break;
         case vm::Constant::Type::INT: {
-            constant.value = static_cast<vm::int_t>(read4bytes());
+            constant.value = static_cast<vm::int_t>(reader.read4bytes());
         } break;
         case vm::Constant::Type::DOUBLE: {
-            constant.value = readDouble();
+            constant.value = reader.readDouble();
         } break;
         default:
             throw InvalidFile("invalid binary file: invalid constant type");
@@ -258,19 +548,25 @@ File File::parse_file_binary(std::ifstream& in) {
     }
 
     // parse start
-    auto instructionsCount = read2bytes();
-    std::vector<vm::Instruction> start;
-    for (int j = 0; j < instructionsCount; ++j) {
-        start.push_back(std::move(readInstruction()));
-    }
+    expectSection(1);
+    std::vector<vm::Instruction> start = reader.readInstructions(reader.readCount());
 
-    // parse functions
-    auto functionsCount = read2bytes();
+    // parse functions, the instructions are only located here
+    expectSection(2);
+    auto functionsCount = reader.readCount();
     std::vector<vm::Function> functions;
+    functions.reserve(functionsCount);
+    // a function takes at least 8 bytes, do not trust the count further than that
+    if (static_cast<std::size_t>(functionsCount) * 8 > bufferSize - reader.pos) {
+        throw InvalidFile("incomplete binary file");
+    }
+    auto code = std::make_shared<BinaryCode>(image, version, functionsCount);
+    // the code of version 2: offset, size and instructions_count
+    std::vector<std::array<vm::u4, 3>> table;
     bool mainFound = false;
-    for (int j = 0; j < functionsCount; ++j) {
+    for (vm::u4 j = 0; j < functionsCount; ++j) {
         vm::Function fun;
-        fun.nameIndex = read2bytes();
+        fun.nameIndex = reader.readCount();
         if (fun.nameIndex >= constants.size()) {
             throw InvalidFile("invalid binary file: function name not found");
         }
@@ -280,12 +576,21 @@ File File::parse_file_binary(std::ifstream& in) {
         if (std::get<vm::str_t>(constants[fun.nameIndex].value) == "main") {
             mainFound = true;
         }
-        fun.paramSize = read2bytes();
-        fun.level = read2bytes();
-        auto instructionsCount = read2bytes();
-        for (int k = 0; k < instructionsCount; ++k) {
-            fun.instructions.push_back(std::move(readInstruction()));
+        fun.paramSize = reader.read2bytes();
+        fun.level = reader.read2bytes();
+        if (version == 1) {
+            // the code follows, it has to be walked to find the next function
+            auto count = reader.readCount();
+            auto offset = reader.pos;
+            reader.skipInstructions(count);
+            code->add(offset, static_cast<vm::u4>(reader.pos - offset), count);
+        }
+        else {
+            auto offset = reader.read4bytes();
+            auto size = reader.read4bytes();
+            table.push_back({offset, size, reader.read4bytes()});
         }
+        fun.setSource(code, j);
         functions.push_back(std::move(fun));
     }
 
@@ -293,14 +598,27 @@ File File::parse_file_binary(std::ifstream& in) {
         throw InvalidFile("invalid binary file: main() not found");
     }
 
-    if (pos != buffer.size()) {
+    if (version == 2) {
+        expectSection(3);
+        // the functions are stored in order, one right after another
+        for (vm::u4 j = 0; j < functionsCount; ++j) {
+            auto [offset, size, count] = table[j];
+            if (reader.pos != offsets[3] + static_cast<std::size_t>(offset) || reader.pos + size > bufferSize) {
+                throw InvalidFile("invalid binary file: invalid function offset");
+            }
+            code->add(reader.pos, size, count);
+            reader.pos += size;
+        }
+    }
+
+    if (reader.pos != bufferSize) {
         throw InvalidFile("invalid binary file: unused content");
     }
 
     return File{version, std::move(constants), std::move(start), std::move(functions)};
 }
 
-File File::parse_file_text(std::ifstream& in) {
+File File::parse_file_text(std::istream& in) {
     int line_count = 0;
     std::string line = "";
     std::string str = "";
@@ -414,7 +732,6 @@ File File::parse_file_text(std::ifstream& in) {
                         value += ch;
                     }
                 }
-                errorIf(value.length() > UINT16_MAX, "too long the string constant");
                 constant.value = std::move(value);
             }
             else if (type == "I") {
@@ -437,7 +754,6 @@ File File::parse_file_text(std::ifstream& in) {
     else {
         errorIf(true, ".constants expected");
     }
-    errorIf(constants.size() > U2_MAX, "too many constants");
 
     // parse instructions
     auto parseInstructions = [&]() {
@@ -487,7 +803,6 @@ File File::parse_file_text(std::ifstream& in) {
             ensureNoMoreInput();
             rtv.push_back(ins);
         }
-        errorIf(rtv.size() > U2_MAX, "too many instructions");
         return rtv;
     };
 
@@ -549,7 +864,6 @@ File File::parse_file_text(std::ifstream& in) {
     errorIfNot(mainFound, "main() not found");
 
     int functions_count = functions.size();
-    errorIf(functions_count > U2_MAX, "too many functions");
     for (int i = 0; i < functions_count; ++i) {
         errorIfNot(ss >> str, strfmt("\".F{}:\" expected", i));
         errorIf((str.length() < 2 || str.back() != ':'), strfmt("\".F{}:\" expected", i));
@@ -582,10 +896,12 @@ File File::parse_file_text(std::ifstream& in) {
         }
         ensureNoMoreInput();
         errorIf(index < 0, "no such function");
-        functions.at(index).instructions = std::move(parseInstructions());
+        functions.at(index).instructions() = parseInstructions();
     }
 
     errorIf(in >> str, "unused content");
 
-    return File{0x00000001, std::move(constants), std::move(start), std::move(functions)};
+    File file{0x00000001, std::move(constants), std::move(start), std::move(functions)};
+    file.version = file.minimumVersion();
+    return file;
 }
@@ -10,6 +10,21 @@
 #include <fstream>
 #include <vector>
 
+// The binary file, all the numbers are big-endian.
+// Version 1:
+//   magic(4) version(4)
+//   constants_count(2) {type(1) value}, a string is length(2) bytes
+//   start: instructions_count(2) instructions
+//   functions_count(2) {name_index(2) param_size(2) level(2) instructions_count(2) instructions}
+// Version 2 has 4-byte counts and operands, and a table of the functions
+// so that a function can be found without decoding the ones before it:
+//   magic(4) version(4)
+//   constants_offset(4) start_offset(4) functions_offset(4) code_offset(4)
+//   constants: constants_count(4) {type(1) value}, a string is length(4) bytes
+//   start: instructions_count(4) instructions
+//   functions: functions_count(4) {name_index(4) param_size(2) level(2) offset(4) size(4) instructions_count(4)}
+//   code: the instructions of every function, offset and size in bytes are relative to code_offset
+// An operand of 2 bytes in version 1 takes 4 bytes in version 2.
 struct File
 {
     static const vm::u4 magic_v = 0x43303A29;
@@ -20,10 +35,17 @@ struct File
 
     File(vm::u4, std::vector<vm::Constant>, std::vector<vm::Instruction>, std::vector<vm::Function>);
 
-    static File parse_file_text(std::ifstream& in);
+    // a text file has no version, it is the oldest one that can hold the file
+    static File parse_file_text(std::istream& in);
     static File parse_file_binary(std::ifstream& in);
     void output_text(std::ostream& out);
-    void output_binary(std::ofstream& out);
+    // in the format of `version`
+    void output_binary(std::ostream& out);
+    // 1 if every count, index and offset fits in 2 bytes, 2 otherwise
+    vm::u4 minimumVersion() const;
+    // drop the functions that .start and main can never call and the constants
+    // nothing refers to, the remaining ones are renumbered
+    void strip();
 };
 
 #endif
\ No newline at end of file
@@ -6,15 +6,46 @@
 #include "./instruction.h"
 
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace vm {
 
+// instructions that are decoded when they are first needed,
+// shared by all the copies of the functions of a File
+class CodeSource {
+public:
+    virtual ~CodeSource() = default;
+    // safe to call from any thread
+    virtual const std::vector<Instruction>& instructions(u4 index) const = 0;
+};
+
 struct Function {
-    u2 nameIndex;
+    u4 nameIndex;
     u2 paramSize;
     u2 level;
-    std::vector<vm::Instruction> instructions;
+
+    // the instructions of a function loaded from a binary file come from
+    // its source, the function is decoded the first time they are asked for
+    const std::vector<Instruction>& instructions() const {
+        return _source ? _source->instructions(_sourceIndex) : _instructions;
+    }
+    std::vector<Instruction>& instructions() {
+        if (_source) {
+            _instructions = _source->instructions(_sourceIndex);
+            _source.reset();
+        }
+        return _instructions;
+    }
+    void setSource(std::shared_ptr<const CodeSource> source, u4 index) {
+        _source = std::move(source);
+        _sourceIndex = index;
+    }
+
+private:
+    std::vector<Instruction> _instructions;
+    std::shared_ptr<const CodeSource> _source;
+    u4 _sourceIndex = 0;
 };
 
 }
@@ -22,4 +53,3 @@ struct Function {
 
 
 #endif
-
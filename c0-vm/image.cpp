@@ -0,0 +1,350 @@
+#include "./image.h"
+#include "./exception.h"
+
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vm {
+
+struct Image::Mapping {
+    const unsigned char* base = nullptr;
+    std::size_t size = 0;
+
+    ~Mapping() {
+        if (base) {
+            munmap(const_cast<unsigned char*>(base), size);
+        }
+    }
+};
+
+namespace {
+
+const char imageMagic[4] = {'C', '0', 'I', 'M'};
+const u4 imageFormat = 2;
+// the function of .start in the far section
+const u4 startFunction = 0xffffffff;
+
+struct Header {
+    char magic[4];
+    u4 format;
+    char key[64];
+    u4 version;
+    u4 mainIndex;
+    u4 maxLevel;
+    u4 constantsCount;
+    u4 functionsCount;
+    u4 startCount;
+    u4 literalsCount;
+    u4 farCount;
+    u4 constantsSize;
+};
+
+struct FunctionEntry {
+    u4 nameIndex;
+    u2 paramSize;
+    u2 level;
+    u4 codeIndex;
+    u4 codeCount;
+};
+
+struct FarEntry {
+    u4 function;
+    u4 pc;
+    u4 offset;
+};
+
+// the offsets of the far loada by function and pc
+using FarTable = std::unordered_map<u8, u4>;
+
+u8 farKey(u4 function, u4 pc) {
+    return (static_cast<u8>(function) << 32) | pc;
+}
+
+Instruction toInstruction(const Code& code, u4 function, u4 pc, const FarTable& far) {
+    Instruction ins{static_cast<OpCode>(code.op), code.x, code.y};
+    if (code.y == Code::FAR_OFFSET) {
+        if (auto it = far.find(farKey(function, pc)); it != far.end()) {
+            ins.y = it->second;
+        }
+    }
+    return ins;
+}
+
+template <typename T>
+void append(std::string& buffer, const T& value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void align(std::string& buffer) {
+    buffer.resize((buffer.size() + 7) / 8 * 8, '\0');
+}
+
+class ImageReader {
+public:
+    ImageReader(const unsigned char* base, std::size_t size) : base(base), size(size), pos(0) {}
+
+    template <typename T>
+    T read() {
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    const unsigned char* take(std::size_t bytes) {
+        if (pos > size || bytes > size - pos) {
+            throw InvalidFile("invalid image: truncated");
+        }
+        auto p = base + pos;
+        pos += bytes;
+        return p;
+    }
+
+    void align() {
+        pos = (pos + 7) / 8 * 8;
+    }
+
+public:
+    const unsigned char* base;
+    std::size_t size;
+    std::size_t pos;
+};
+
+// the Instructions of the functions of an image for the stack traces, decoded from the Code
+class ImageCode final : public CodeSource {
+public:
+    ImageCode(std::shared_ptr<const Image::Mapping> mapping, const Code* code,
+              std::vector<std::pair<u4, u4>> ranges, std::shared_ptr<const FarTable> far)
+        : _mapping(std::move(mapping)), _code(code), _ranges(std::move(ranges)), _far(std::move(far)),
+          _once(new std::once_flag[_ranges.size()]), _decoded(_ranges.size()) {}
+
+    const std::vector<Instruction>& instructions(u4 index) const override {
+        std::call_once(_once[index], [this, index] {
+            auto [first, count] = _ranges[index];
+            auto& instructions = _decoded[index];
+            instructions.reserve(count);
+            for (u4 pc = 0; pc < count; ++pc) {
+                instructions.push_back(toInstruction(_code[first + pc], index, pc, *_far));
+            }
+        });
+        return _decoded[index];
+    }
+
+private:
+    std::shared_ptr<const Image::Mapping> _mapping;
+    const Code* _code;
+    std::vector<std::pair<u4, u4>> _ranges;
+    std::shared_ptr<const FarTable> _far;
+    std::unique_ptr<std::once_flag[]> _once;
+    mutable std::vector<std::vector<Instruction>> _decoded;
+};
+
+}
+
+void Image::save(std::ostream& out, const std::string& key, const File& file,
+                 u4 mainIndex, u2 maxLevel, const std::vector<Instruction>& start,
+                 const std::vector<std::vector<Code>>& code, const std::vector<Literal>& literals) {
+    std::string constants;
+    for (auto& constant : file.constants) {
+        append(constants, static_cast<u1>(constant.type));
+        switch (constant.type) {
+        case Constant::Type::STRING: {
+            auto& str = std::get<str_t>(constant.value);
+            append(constants, static_cast<u4>(str.size()));
+            constants += str;
+            break;
+        }
+        case Constant::Type::INT:    append(constants, std::get<int_t>(constant.value));    break;
+        case Constant::Type::DOUBLE: append(constants, std::get<double_t>(constant.value)); break;
+        }
+    }
+    align(constants);
+
+    std::vector<FarEntry> far;
+    auto findFar = [&far](u4 function, const std::vector<Instruction>& instructions) {
+        for (u4 pc = 0; pc < instructions.size(); ++pc) {
+            if (instructions[pc].y >= Code::FAR_OFFSET) {
+                far.push_back(FarEntry{function, pc, instructions[pc].y});
+            }
+        }
+    };
+    findFar(startFunction, start);
+    for (u4 i = 0; i < file.functions.size(); ++i) {
+        findFar(i, file.functions[i].instructions());
+    }
+
+    Header header{};
+    std::memcpy(header.magic, imageMagic, sizeof(header.magic));
+    header.format = imageFormat;
+    key.copy(header.key, sizeof(header.key));
+    header.version = file.version;
+    header.mainIndex = mainIndex;
+    header.maxLevel = maxLevel;
+    header.constantsCount = static_cast<u4>(file.constants.size());
+    header.functionsCount = static_cast<u4>(file.functions.size());
+    header.startCount = static_cast<u4>(start.size());
+    header.literalsCount = static_cast<u4>(literals.size());
+    header.farCount = static_cast<u4>(far.size());
+    header.constantsSize = static_cast<u4>(constants.size());
+
+    std::string buffer;
+    append(buffer, header);
+    align(buffer);
+    buffer += constants;
+    u4 codeIndex = 0;
+    for (u4 i = 0; i < file.functions.size(); ++i) {
+        auto& fun = file.functions[i];
+        auto count = static_cast<u4>(code[i].size());
+        append(buffer, FunctionEntry{fun.nameIndex, fun.paramSize, fun.level, codeIndex, count});
+        codeIndex += count;
+    }
+    for (auto& ins : start) {
+        append(buffer, toCode(ins));
+    }
+    for (auto& literal : literals) {
+        append(buffer, literal);
+    }
+    align(buffer);
+    for (auto& entry : far) {
+        append(buffer, entry);
+    }
+    align(buffer);
+    for (auto& fun : code) {
+        buffer.append(reinterpret_cast<const char*>(fun.data()), fun.size() * sizeof(Code));
+    }
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
+
+std::shared_ptr<const Image> Image::map(const std::string& path, const std::string& key) {
+    auto mapping = std::make_shared<Mapping>();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(Header)) {
+        void* p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            mapping->base = static_cast<const unsigned char*>(p);
+            mapping->size = static_cast<std::size_t>(st.st_size);
+        }
+    }
+    close(fd);
+    if (!mapping->base) {
+        return nullptr;
+    }
+
+    try {
+        ImageReader reader(mapping->base, mapping->size);
+        auto header = reader.read<Header>();
+        if (std::memcmp(header.magic, imageMagic, sizeof(header.magic)) != 0 || header.format != imageFormat
+            || key.size() != sizeof(header.key) || key.compare(0, key.size(), header.key, sizeof(header.key)) != 0) {
+            return nullptr;
+        }
+        reader.align();
+
+        std::vector<Constant> constants;
+        constants.reserve(header.constantsCount);
+        ImageReader constantReader(reader.take(header.constantsSize), header.constantsSize);
+        for (u4 i = 0; i < header.constantsCount; ++i) {
+            switch (static_cast<Constant::Type>(constantReader.read<u1>())) {
+            case Constant::Type::STRING: {
+                auto length = constantReader.read<u4>();
+                auto chars = reinterpret_cast<const char*>(constantReader.take(length));
+                constants.push_back(Constant{Constant::Type::STRING, str_t(chars, length)});
+                break;
+            }
+            case Constant::Type::INT:
+                constants.push_back(Constant{Constant::Type::INT, constantReader.read<int_t>()});
+                break;
+            case Constant::Type::DOUBLE:
+                constants.push_back(Constant{Constant::Type::DOUBLE, constantReader.read<double_t>()});
+                break;
+            default:
+                throw InvalidFile("invalid image: invalid constant type");
+            }
+        }
+
+        std::vector<Function> functions(header.functionsCount);
+        std::vector<std::pair<u4, u4>> ranges;
+        ranges.reserve(header.functionsCount);
+        for (auto& fun : functions) {
+            auto entry = reader.read<FunctionEntry>();
+            fun.nameIndex = entry.nameIndex;
+            fun.paramSize = entry.paramSize;
+            fun.level = entry.level;
+            ranges.emplace_back(entry.codeIndex, entry.codeCount);
+        }
+        for (auto& fun : functions) {
+            if (fun.nameIndex >= constants.size() || constants[fun.nameIndex].type != Constant::Type::STRING) {
+                throw InvalidFile("invalid image: invalid function name");
+            }
+        }
+        if (header.mainIndex >= header.functionsCount || header.startCount < 2) {
+            throw InvalidFile("invalid image: invalid function table");
+        }
+
+        std::vector<Code> startCode(header.startCount);
+        std::memcpy(startCode.data(), reader.take(header.startCount * sizeof(Code)), header.startCount * sizeof(Code));
+        std::vector<Literal> literals(header.literalsCount);
+        for (auto& literal : literals) {
+            literal = reader.read<Literal>();
+            if (literal.index >= constants.size() || constants[literal.index].type != Constant::Type::STRING
+                || literal.size != static_cast<addr_t>(std::get<str_t>(constants[literal.index].value).size() + 1)) {
+                throw InvalidFile("invalid image: invalid string literal");
+            }
+        }
+        reader.align();
+        auto far = std::make_shared<FarTable>();
+        for (u4 i = 0; i < header.farCount; ++i) {
+            auto entry = reader.read<FarEntry>();
+            (*far)[farKey(entry.function, entry.pc)] = entry.offset;
+        }
+        reader.align();
+
+        // the code is executed in place, the mapping is page aligned and so is every Code
+        auto codeBytes = reader.take(0);
+        auto codeCount = (mapping->size - reader.pos) / sizeof(Code);
+        for (auto [first, count] : ranges) {
+            if (static_cast<u8>(first) + count > codeCount) {
+                throw InvalidFile("invalid image: invalid function table");
+            }
+        }
+        auto code = reinterpret_cast<const Code*>(codeBytes);
+
+        std::vector<Instruction> start;
+        start.reserve(startCode.size());
+        for (u4 pc = 0; pc < startCode.size(); ++pc) {
+            start.push_back(toInstruction(startCode[pc], startFunction, pc, *far));
+        }
+        auto source = std::make_shared<const ImageCode>(mapping, code, ranges, far);
+        for (u4 i = 0; i < functions.size(); ++i) {
+            functions[i].setSource(source, i);
+        }
+
+        std::shared_ptr<Image> image(new Image());
+        // the file keeps .start as it was, the VM runs the extended one
+        image->_file = std::make_shared<const File>(header.version, std::move(constants),
+                                                    std::vector<Instruction>(start.begin(), start.end() - 2),
+                                                    std::move(functions));
+        image->_mainIndex = header.mainIndex;
+        image->_maxLevel = static_cast<u2>(header.maxLevel);
+        image->_start = std::move(start);
+        image->_startCode = std::move(startCode);
+        image->_code = code;
+        image->_functions = std::move(ranges);
+        image->_literals = std::move(literals);
+        image->_mapping = std::move(mapping);
+        return image;
+    }
+    catch (const InvalidFile&) {
+        return nullptr;
+    }
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef IMAGE_H_INCLUDED
+#define IMAGE_H_INCLUDED
+
+#include "./type.h"
+#include "./instruction.h"
+#include "./file.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vm {
+
+// A program saved by VM::saveImage, so that the next run of the same binary file
+// starts executing without decoding, translating or laying out anything.
+// It is in the byte order and the Code layout of the VM that saved it, so it is
+// only kept in a cache whose key covers the VM and the content of the binary file:
+//   magic(4) format(4) key(64) version(4), padded to 8 bytes
+//   main_index(4) max_level(4) constants_count(4) functions_count(4)
+//   start_count(4) literals_count(4) far_count(4) constants_size(4)
+//   constants: {type(1) value}, a string is length(4) bytes, constants_size bytes
+//   functions: {name_index(4) param_size(2) level(2) code_index(4) code_count(4)}
+//   start: start_count Code, .start followed by the call of main
+//   literals: {constant_index(4) address(4) size(4)}, the string literals in the order they are allocated
+//   far: {function(4) pc(4) offset(4)}, the loada offsets Code can not hold, the function of .start is -1
+//   code: the Code of every function, code_index counts Code from here
+// Every section starts at a multiple of 8 bytes.
+class Image {
+public:
+    struct Literal {
+        u4 index;
+        addr_t address;
+        addr_t size;
+    };
+
+    static void save(std::ostream& out, const std::string& key, const File& file,
+                     u4 mainIndex, u2 maxLevel, const std::vector<Instruction>& start,
+                     const std::vector<std::vector<Code>>& code, const std::vector<Literal>& literals);
+    // nullptr if the file is not an image, is truncated or was saved with another key
+    static std::shared_ptr<const Image> map(const std::string& path, const std::string& key);
+
+    // the code of the functions of the file is decoded from the image for the stack traces
+    const std::shared_ptr<const File>& file() const { return _file; }
+    u4 mainIndex() const { return _mainIndex; }
+    u2 maxLevel() const { return _maxLevel; }
+    const std::vector<Instruction>& start() const { return _start; }
+    const std::vector<Code>& startCode() const { return _startCode; }
+    const Code* code(u4 index) const { return _code + _functions[index].first; }
+    u4 codeSize(u4 index) const { return _functions[index].second; }
+    const std::vector<Literal>& literals() const { return _literals; }
+
+    struct Mapping;
+
+private:
+    Image() = default;
+
+    std::shared_ptr<const Mapping> _mapping;
+    std::shared_ptr<const File> _file;
+    u4 _mainIndex = 0;
+    u2 _maxLevel = 0;
+    std::vector<Instruction> _start;
+    std::vector<Code> _startCode;
+    const Code* _code = nullptr;
+    // the first Code and the count of every function
+    std::vector<std::pair<u4, u4>> _functions;
+    std::vector<Literal> _literals;
+};
+
+}
+
+#endif
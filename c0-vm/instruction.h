@@ -14,6 +14,25 @@ struct Instruction {
     u4 y;
 };
 
+// the form the VM executes, 8 bytes instead of the 12 of an Instruction:
+// loada keeps its level difference in x and its offset in y,
+// an offset too large for y is FAR_OFFSET and read again from the Instruction
+struct Code {
+    static constexpr u4 FAR_OFFSET = 0x00ffffff;
+    u4 op : 8;
+    u4 y  : 24;
+    u4 x;
+};
+static_assert(sizeof(Code) == 8, "Code should be packed in 8 bytes");
+
+inline Code toCode(const Instruction& ins) {
+    Code code;
+    code.op = static_cast<u1>(ins.op);
+    code.y = ins.y < Code::FAR_OFFSET ? ins.y : Code::FAR_OFFSET;
+    code.x = ins.x;
+    return code;
+}
+
 }
 
 template <>
@@ -0,0 +1,83 @@
+#include "./multiplexer.h"
+
+#include <cerrno>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace vm {
+
+Multiplexer::Multiplexer() : _epoll(epoll_create1(EPOLL_CLOEXEC)) {
+    if (_epoll < 0) {
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    }
+}
+
+Multiplexer::~Multiplexer() {
+    close(_epoll);
+}
+
+void Multiplexer::add(VM& vm, int fd, Done done) {
+    vm.setResumable(true);
+    if (auto status = vm.start(); status != VM::Status::NEEDS_INPUT) {
+        if (done) {
+            done(vm, status);
+        }
+        return;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+        throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+    }
+    _waiting[fd] = Waiting{&vm, std::move(done)};
+}
+
+void Multiplexer::finish(int fd, VM::Status status) {
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    auto node = _waiting.extract(fd);
+    if (node.mapped().done) {
+        node.mapped().done(*node.mapped().vm, status);
+    }
+}
+
+void Multiplexer::run() {
+    epoll_event events[64];
+    char buffer[65536];
+    while (!_waiting.empty()) {
+        int count = epoll_wait(_epoll, events, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "epoll_wait");
+        }
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            auto it = _waiting.find(fd);
+            if (it == _waiting.end()) {
+                continue;
+            }
+            VM& vm = *it->second.vm;
+            // level triggered, whatever is left is read on the next round
+            auto n = read(fd, buffer, sizeof(buffer));
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            if (n > 0) {
+                vm.feed(buffer, static_cast<std::size_t>(n));
+            }
+            else {
+                // the end of file, or an error the program can only see as the end of its input
+                vm.closeInput();
+            }
+            if (auto status = vm.resume(); status != VM::Status::NEEDS_INPUT) {
+                finish(fd, status);
+            }
+        }
+    }
+}
+
+}
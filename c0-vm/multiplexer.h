@@ -0,0 +1,44 @@
+#ifndef MULTIPLEXER_H_INCLUDED
+#define MULTIPLEXER_H_INCLUDED
+
+#include "./vm.h"
+
+#include <functional>
+#include <unordered_map>
+
+namespace vm {
+
+// runs many resumable VMs on one thread, every VM reads its input from a file descriptor,
+// a pipe or a socket, and only runs when something arrives on it
+class Multiplexer {
+public:
+    using Done = std::function<void(VM&, VM::Status)>;
+
+    // std::system_error if epoll is not available
+    Multiplexer();
+    ~Multiplexer();
+    Multiplexer(const Multiplexer&) = delete;
+    Multiplexer& operator=(const Multiplexer&) = delete;
+
+    // the VM is made resumable and started, it is fed from fd until the end of file,
+    // done is called once the program finishes or fails; fd is not closed
+    void add(VM& vm, int fd, Done done = {});
+    // the VMs still waiting for input
+    std::size_t size() const { return _waiting.size(); }
+    // wait for input and run the VMs until every one of them is done
+    void run();
+
+private:
+    struct Waiting {
+        VM* vm;
+        Done done;
+    };
+    void finish(int fd, VM::Status status);
+
+    int _epoll;
+    std::unordered_map<int, Waiting> _waiting;
+};
+
+}
+
+#endif
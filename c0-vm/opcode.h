@@ -109,6 +109,13 @@ enum class OpCode : u1 {
     // ..., params
     // ...
     call = 0x80,
+
+    // tailcall index(2)
+    // ..., params
+    // ...
+    // the same as call followed by the return of its result,
+    // the callee takes over the frame of the current function
+    tailcall = 0x81,
     
     // ret
     ret = 0x88,
@@ -157,7 +164,7 @@ const std::unordered_map<OpCode, const char*> nameOfOpCode = {
     NAME(jmp),
     NAME(je), NAME(jne), NAME(jl), NAME(jge), NAME(jg), NAME(jle),
 
-    NAME(call),
+    NAME(call),   NAME(tailcall),
     NAME(ret),
     NAME(iret), NAME(dret), NAME(aret),
 
@@ -176,9 +183,15 @@ const std::unordered_map<OpCode, std::vector<int>> paramSizeOfOpCode = {
     { OpCode::jmp, {2} },
     { OpCode::je, {2} }, { OpCode::jne, {2} }, { OpCode::jl, {2} }, { OpCode::jge, {2} }, { OpCode::jg, {2} }, { OpCode::jle, {2} },
 
-    { OpCode::call, {2} },
+    { OpCode::call, {2} }, { OpCode::tailcall, {2} },
 };
 
+// the size of an operand in a binary file of the version,
+// since version 2 the operands of 2 bytes take 4 bytes
+inline int paramSizeInVersion(int size, u4 version) {
+    return size == 2 && version >= 2 ? 4 : size;
+}
+
 #define NAME(op) { #op, OpCode::op }
 const std::unordered_map<std::string, OpCode> opCodeOfName = {
     NAME(nop),
@@ -207,7 +220,7 @@ const std::unordered_map<std::string, OpCode> opCodeOfName = {
     NAME(jmp),
     NAME(je), NAME(jne), NAME(jl), NAME(jge), NAME(jg), NAME(jle),
 
-    NAME(call),
+    NAME(call),   NAME(tailcall),
     NAME(ret),
     NAME(iret), NAME(dret), NAME(aret),
 
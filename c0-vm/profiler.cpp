@@ -0,0 +1,114 @@
+#include "./profiler.h"
+#include "./vm.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <csignal>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// the name of the man page, glibc before 2.41 only has the member behind it
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace vm {
+
+namespace {
+
+const int truncatedFrame = -2;
+
+std::string frameName(const File& file, int index) {
+    if (index == truncatedFrame) {
+        return "[truncated]";
+    }
+    if (index < 0) {
+        return ".start";
+    }
+    auto& fun = file.functions.at(static_cast<std::size_t>(index));
+    return std::get<str_t>(file.constants.at(fun.nameIndex).value);
+}
+
+}
+
+Profiler::Timer::Timer(int hz) {
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        struct sigaction action = {};
+        action.sa_handler = VM::onProfilingTimer;
+        // a scan blocked in read goes on reading
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, nullptr);
+    });
+    sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = static_cast<pid_t>(syscall(SYS_gettid));
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &_id) != 0) {
+        throw std::system_error(errno, std::generic_category(), "timer_create");
+    }
+    // tv_nsec has to stay below a second, 1 hz is a period of exactly one
+    const long long second = 1000000000;
+    auto period = std::max(1000LL, second / std::max(hz, 1));
+    itimerspec interval = {};
+    interval.it_interval.tv_sec = static_cast<time_t>(period / second);
+    interval.it_interval.tv_nsec = static_cast<long>(period % second);
+    interval.it_value = interval.it_interval;
+    if (timer_settime(_id, 0, &interval, nullptr) != 0) {
+        auto error = errno;
+        timer_delete(_id);
+        throw std::system_error(error, std::generic_category(), "timer_settime");
+    }
+}
+
+Profiler::Timer::~Timer() {
+    timer_delete(_id);
+}
+
+void Profiler::record(const std::vector<int>& frames, addr_t ip, bool truncated) {
+    std::vector<int> key;
+    key.reserve(frames.size() + 2);
+    if (truncated) {
+        key.push_back(truncatedFrame);
+    }
+    key.insert(key.end(), frames.rbegin(), frames.rend());
+    key.push_back(ip);
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_stacks[key];
+    ++_samples;
+}
+
+std::size_t Profiler::samples() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _samples;
+}
+
+void Profiler::write(std::ostream& out, const File& file) const {
+    std::vector<std::string> lines;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& [key, count] : _stacks) {
+            std::string line;
+            for (std::size_t i = 0; i + 2 < key.size(); ++i) {
+                line += frameName(file, key[i]);
+                line += ';';
+            }
+            line += frameName(file, key[key.size() - 2]);
+            line += '@';
+            line += std::to_string(key.back());
+            line += ' ';
+            line += std::to_string(count);
+            lines.push_back(std::move(line));
+        }
+    }
+    std::sort(lines.begin(), lines.end());
+    for (auto& line : lines) {
+        out << line << '\n';
+    }
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include "./type.h"
+#include "./file.h"
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <ctime>
+
+namespace vm {
+
+// Samples what the VMs given to it with VM::setProfiler are executing. While a VM runs, a timer
+// sends SIGPROF to its thread; the signal handler only notes the instruction being executed, the
+// VM adds the functions on its contexts at its next backward jump, call or return, where they are
+// consistent, and records the sample here. The timer counts the CPU time of the thread, so a scan
+// waiting for the input stream is not sampled; that clock only advances at the scheduler tick,
+// a rate above the tick gives fewer samples than asked for.
+class Profiler {
+public:
+    // the innermost frames kept of a deeper stack
+    static const std::size_t MAX_DEPTH = 128;
+
+    // sends SIGPROF to the calling thread every 1/hz second of its CPU time while it lives,
+    // std::system_error if the timer can not be created
+    class Timer {
+    public:
+        explicit Timer(int hz);
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+        ~Timer();
+
+    private:
+        timer_t _id;
+    };
+
+    explicit Profiler(int hz = 1000) : _hz(hz) {}
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    int hz() const { return _hz; }
+    // the frames are innermost first, -1 for .start, truncated if the stack was deeper
+    void record(const std::vector<int>& frames, addr_t ip, bool truncated);
+    std::size_t samples() const;
+    // the samples as folded stacks, one line per stack, outermost function first and
+    // ended by the sampled instruction of the innermost one, sorted:
+    //   .start;main;fib;fib@12 42
+    void write(std::ostream& out, const File& file) const;
+
+private:
+    mutable std::mutex _mutex;
+    // the frames outermost first, -2 first if truncated, followed by the ip
+    std::map<std::vector<int>, u8> _stacks;
+    std::size_t _samples = 0;
+    int _hz;
+};
+
+}
+
+#endif
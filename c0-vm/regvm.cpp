@@ -0,0 +1,636 @@
+#include "./regvm.h"
+#include "./exception.h"
+#include "./opcode.h"
+#include "./util/print.hpp"
+
+#include <algorithm>
+
+namespace vm {
+
+const addr_t RegVM::MAX_STACK_SIZE = 0x01000000;
+
+namespace {
+
+bool isJump(OpCode op) {
+    switch (op) {
+    case OpCode::jmp: case OpCode::je: case OpCode::jne:
+    case OpCode::jl: case OpCode::jge: case OpCode::jg: case OpCode::jle:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// the instruction never continues with the next one
+bool isTerminal(OpCode op) {
+    switch (op) {
+    case OpCode::jmp: case OpCode::tailcall:
+    case OpCode::ret: case OpCode::iret: case OpCode::dret: case OpCode::aret:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// je tests the value against 0, jeq compares two operands
+RegOp compareJump(OpCode op) {
+    switch (op) {
+    case OpCode::je:  return RegOp::jeq;
+    case OpCode::jne: return RegOp::jne;
+    case OpCode::jl:  return RegOp::jlt;
+    case OpCode::jge: return RegOp::jge;
+    case OpCode::jg:  return RegOp::jgt;
+    default:          return RegOp::jle;
+    }
+}
+
+[[noreturn]] void unsupported(OpCode op) {
+    auto it = nameOfOpCode.find(op);
+    throw InvalidFile(std::string("the register vm does not support ") + (it == nameOfOpCode.end() ? "unknown instructions" : it->second));
+}
+
+const str_t& nameOf(const File& file, const Function& fun) {
+    if (fun.nameIndex >= file.constants.size() || file.constants[fun.nameIndex].type != Constant::Type::STRING) {
+        throw InvalidFile("function name not found");
+    }
+    return std::get<str_t>(file.constants[fun.nameIndex].value);
+}
+
+// what a slot of the stack bytecode holds at translation time,
+// a value is only copied into the register of its slot when it has to be
+struct Value {
+    enum class Kind { reg, global, imm, localAddr, globalAddr };
+    Kind kind;
+    i4 x;
+
+    bool operator==(const Value& other) const { return kind == other.kind && x == other.x; }
+};
+
+class Translator {
+public:
+    Translator(const File& file, std::vector<bool> returnsValue)
+        : _file(file), _returnsValue(std::move(returnsValue)) {}
+
+    RegFunction translate(std::string name, u2 level, u2 paramSize, const std::vector<Instruction>& code);
+
+private:
+    // the stack depth before every instruction, -1 if it is unreachable.
+    // A call statement leaves the unused return value on the stack, so the
+    // depth of a loop head can grow every iteration; the slots above the
+    // smallest depth of a join are never read again, so that one is taken
+    std::vector<int> depths(u2 paramSize, const std::vector<Instruction>& code, u4& frameSize) const;
+    int stackEffect(const Instruction& ins) const;
+
+    static Operand operand(const Value& value);
+    void emit(RegOp op, Operand a = {}, Operand b = {}, Operand c = {});
+    void push(Value value) { _stack.push_back(value); }
+    Value pop();
+    // copy the value of a slot into its own register
+    void materialize(std::size_t slot);
+    // before a jump every slot has to be in its register, addresses can not be;
+    // a call leaves the frame of the caller alone so addresses may stay
+    void materializeAll(bool keepAddresses);
+    // before `dest` is written, the slots that still read it take a copy
+    void release(const Operand& dest);
+    Operand destination(const Value& address) const;
+    void binary(RegOp op);
+
+    const File& _file;
+    std::vector<bool> _returnsValue;
+    u2 _level = 0;
+    std::vector<Value> _stack;
+    std::vector<RegInstruction> _out;
+    // the instruction that computed the top of the stack into its register
+    std::ptrdiff_t _producer = -1;
+};
+
+int Translator::stackEffect(const Instruction& ins) const {
+    switch (ins.op) {
+    case OpCode::nop: case OpCode::iload: case OpCode::ineg: case OpCode::jmp: case OpCode::printl:
+        return 0;
+    case OpCode::bipush: case OpCode::ipush: case OpCode::loadc: case OpCode::loada:
+    case OpCode::dup: case OpCode::iscan:
+        return 1;
+    case OpCode::snew:
+        return static_cast<int>(ins.x);
+    case OpCode::pop: case OpCode::iadd: case OpCode::isub: case OpCode::imul: case OpCode::idiv:
+    case OpCode::icmp: case OpCode::je: case OpCode::jne: case OpCode::jl: case OpCode::jge:
+    case OpCode::jg: case OpCode::jle: case OpCode::iprint: case OpCode::cprint: case OpCode::iret:
+        return -1;
+    case OpCode::pop2: case OpCode::istore:
+        return -2;
+    case OpCode::popn:
+        return -static_cast<int>(ins.x);
+    case OpCode::ret:
+        return 0;
+    case OpCode::call: case OpCode::tailcall:
+        if (ins.x >= _file.functions.size()) {
+            throw InvalidFile("call of an undefined function");
+        }
+        return (_returnsValue[ins.x] ? 1 : 0) - _file.functions[ins.x].paramSize;
+    default:
+        unsupported(ins.op);
+    }
+}
+
+std::vector<int> Translator::depths(u2 paramSize, const std::vector<Instruction>& code, u4& frameSize) const {
+    std::vector<int> depth(code.size(), -1);
+    frameSize = paramSize;
+    std::vector<std::pair<std::size_t, int>> work{{0, paramSize}};
+    while (!work.empty()) {
+        auto [i, d] = work.back();
+        work.pop_back();
+        if (i >= code.size()) {
+            continue;
+        }
+        if (depth[i] != -1 && depth[i] <= d) {
+            continue;
+        }
+        depth[i] = d;
+        auto& ins = code[i];
+        int next = d + stackEffect(ins);
+        if (next < 0) {
+            throw InvalidFile("stack underflow");
+        }
+        frameSize = std::max(frameSize, static_cast<u4>(std::max(d, next)));
+        if (isJump(ins.op)) {
+            if (ins.x >= code.size()) {
+                throw InvalidFile("jump out of range");
+            }
+            work.emplace_back(ins.x, next);
+        }
+        if (!isTerminal(ins.op)) {
+            work.emplace_back(i + 1, next);
+        }
+    }
+    return depth;
+}
+
+Operand Translator::operand(const Value& value) {
+    switch (value.kind) {
+    case Value::Kind::reg:    return {Operand::Mode::reg, value.x};
+    case Value::Kind::global: return {Operand::Mode::global, value.x};
+    case Value::Kind::imm:    return {Operand::Mode::imm, value.x};
+    default:
+        throw InvalidFile("the register vm does not support addresses as values");
+    }
+}
+
+void Translator::emit(RegOp op, Operand a, Operand b, Operand c) {
+    _out.push_back({op, a, b, c});
+    _producer = -1;
+}
+
+Value Translator::pop() {
+    auto value = _stack.back();
+    _stack.pop_back();
+    return value;
+}
+
+void Translator::materialize(std::size_t slot) {
+    Value self{Value::Kind::reg, static_cast<i4>(slot)};
+    if (_stack[slot] == self) {
+        return;
+    }
+    emit(RegOp::mov, operand(self), operand(_stack[slot]));
+    _stack[slot] = self;
+}
+
+void Translator::materializeAll(bool keepAddresses) {
+    for (std::size_t slot = 0; slot < _stack.size(); ++slot) {
+        auto kind = _stack[slot].kind;
+        if (keepAddresses && (kind == Value::Kind::localAddr || kind == Value::Kind::globalAddr)) {
+            continue;
+        }
+        materialize(slot);
+    }
+}
+
+void Translator::release(const Operand& dest) {
+    Value written{dest.mode == Operand::Mode::global ? Value::Kind::global : Value::Kind::reg, dest.value};
+    for (std::size_t slot = 0; slot < _stack.size(); ++slot) {
+        // a register written is the value of its own slot, a global of the same index is not
+        bool own = dest.mode == Operand::Mode::reg && static_cast<i4>(slot) == dest.value;
+        if (_stack[slot] == written && !own) {
+            materialize(slot);
+        }
+    }
+}
+
+Operand Translator::destination(const Value& address) const {
+    if (address.kind == Value::Kind::localAddr) {
+        if (address.x < 0 || static_cast<std::size_t>(address.x) >= _stack.size()) {
+            throw InvalidFile("the register vm does not support addresses outside the frame");
+        }
+        return {Operand::Mode::reg, address.x};
+    }
+    if (address.kind == Value::Kind::globalAddr) {
+        return {Operand::Mode::global, address.x};
+    }
+    throw InvalidFile("the register vm does not support computed addresses");
+}
+
+void Translator::binary(RegOp op) {
+    auto rhs = pop();
+    auto lhs = pop();
+    if (lhs.kind == Value::Kind::imm && rhs.kind == Value::Kind::imm && op != RegOp::div) {
+        // wraps around like the stack vm does
+        auto l = static_cast<u4>(lhs.x), r = static_cast<u4>(rhs.x);
+        auto value = op == RegOp::add ? l + r : op == RegOp::sub ? l - r : l * r;
+        push({Value::Kind::imm, static_cast<i4>(value)});
+        return;
+    }
+    Value result{Value::Kind::reg, static_cast<i4>(_stack.size())};
+    emit(op, operand(result), operand(lhs), operand(rhs));
+    _producer = static_cast<std::ptrdiff_t>(_out.size()) - 1;
+    push(result);
+}
+
+RegFunction Translator::translate(std::string name, u2 level, u2 paramSize, const std::vector<Instruction>& code) {
+    RegFunction result;
+    result.name = std::move(name);
+    result.paramSize = paramSize;
+    auto depth = depths(paramSize, code, result.frameSize);
+    std::vector<bool> target(code.size(), false);
+    for (auto& ins : code) {
+        if (isJump(ins.op)) {
+            target[ins.x] = true;
+        }
+    }
+
+    _level = level;
+    _out.clear();
+    _producer = -1;
+    // where every instruction starts in the output, jumps are patched at the end
+    std::vector<u4> where(code.size(), 0);
+    std::vector<std::size_t> jumps;
+    const auto jump = [&](RegOp op, Operand a, Operand b, u4 to) {
+        emit(op, a, b, {Operand::Mode::imm, static_cast<i4>(to)});
+        jumps.push_back(_out.size() - 1);
+    };
+
+    bool fallthrough = false;
+    for (std::size_t i = 0; i < code.size(); ++i) {
+        if (depth[i] == -1) {
+            fallthrough = false;
+            continue;
+        }
+        if (i == 0 || target[i] || !fallthrough) {
+            // every path arrives with the values in their registers
+            if (fallthrough) {
+                _stack.resize(depth[i]);
+                materializeAll(false);
+            }
+            _stack.clear();
+            for (int slot = 0; slot < depth[i]; ++slot) {
+                push({Value::Kind::reg, slot});
+            }
+            _producer = -1;
+        }
+        where[i] = static_cast<u4>(_out.size());
+        fallthrough = !isTerminal(code[i].op);
+        auto& ins = code[i];
+        switch (ins.op) {
+        case OpCode::nop:
+            break;
+        case OpCode::bipush:
+        case OpCode::ipush:
+            push({Value::Kind::imm, static_cast<i4>(ins.x)});
+            break;
+        case OpCode::loadc: {
+            if (ins.x >= _file.constants.size() || _file.constants[ins.x].type != Constant::Type::INT) {
+                throw InvalidFile("the register vm only supports integer constants");
+            }
+            push({Value::Kind::imm, std::get<int_t>(_file.constants[ins.x].value)});
+            break;
+        }
+        case OpCode::snew:
+            for (u4 n = 0; n < ins.x; ++n) {
+                push({Value::Kind::imm, 0});
+            }
+            break;
+        case OpCode::pop:
+        case OpCode::pop2:
+        case OpCode::popn:
+            _stack.resize(_stack.size() - (ins.op == OpCode::pop ? 1 : ins.op == OpCode::pop2 ? 2 : ins.x));
+            break;
+        case OpCode::dup:
+            push(_stack.back());
+            break;
+        case OpCode::loada:
+            if (ins.x == 0) {
+                push({Value::Kind::localAddr, static_cast<i4>(ins.y)});
+            }
+            // the static chain ends at the globals
+            else if (ins.x >= _level) {
+                push({Value::Kind::globalAddr, static_cast<i4>(ins.y)});
+            }
+            else {
+                throw InvalidFile("the register vm does not support nested functions");
+            }
+            break;
+        case OpCode::iload: {
+            auto address = pop();
+            auto source = destination(address);
+            push(source.mode == Operand::Mode::reg ? _stack[source.value] : Value{Value::Kind::global, source.value});
+            break;
+        }
+        case OpCode::istore: {
+            auto value = pop();
+            auto dest = destination(pop());
+            auto producer = _producer;
+            auto emitted = _out.size();
+            release(dest);
+            Value temporary{Value::Kind::reg, static_cast<i4>(_stack.size()) + 1};
+            if (value == temporary && producer + 1 == static_cast<std::ptrdiff_t>(_out.size()) && emitted == _out.size()) {
+                // compute into the variable instead of the temporary
+                _out.back().a = dest;
+            }
+            else if (operand(value).mode != dest.mode || value.x != dest.value) {
+                emit(RegOp::mov, dest, operand(value));
+            }
+            if (dest.mode == Operand::Mode::reg) {
+                _stack[dest.value] = {Value::Kind::reg, dest.value};
+            }
+            _producer = -1;
+            break;
+        }
+        case OpCode::iadd: binary(RegOp::add); break;
+        case OpCode::isub: binary(RegOp::sub); break;
+        case OpCode::imul: binary(RegOp::mul); break;
+        case OpCode::idiv: binary(RegOp::div); break;
+        case OpCode::ineg: {
+            auto value = pop();
+            if (value.kind == Value::Kind::imm) {
+                push({Value::Kind::imm, static_cast<i4>(0u - static_cast<u4>(value.x))});
+                break;
+            }
+            Value result{Value::Kind::reg, static_cast<i4>(_stack.size())};
+            emit(RegOp::neg, operand(result), operand(value));
+            _producer = static_cast<std::ptrdiff_t>(_out.size()) - 1;
+            push(result);
+            break;
+        }
+        case OpCode::icmp: {
+            auto rhs = pop();
+            auto lhs = pop();
+            // icmp; jcc => a single compare and jump
+            if (i + 1 < code.size() && !target[i + 1] && isJump(code[i + 1].op) && code[i + 1].op != OpCode::jmp) {
+                materializeAll(false);
+                jump(compareJump(code[i + 1].op), operand(lhs), operand(rhs), code[i + 1].x);
+                ++i;
+                break;
+            }
+            Value result{Value::Kind::reg, static_cast<i4>(_stack.size())};
+            emit(RegOp::cmp, operand(result), operand(lhs), operand(rhs));
+            push(result);
+            break;
+        }
+        case OpCode::je:
+        case OpCode::jne:
+        case OpCode::jl:
+        case OpCode::jge:
+        case OpCode::jg:
+        case OpCode::jle: {
+            auto value = pop();
+            materializeAll(false);
+            jump(compareJump(ins.op), operand(value), {Operand::Mode::imm, 0}, ins.x);
+            break;
+        }
+        case OpCode::jmp:
+            materializeAll(false);
+            jump(RegOp::jmp, {}, {}, ins.x);
+            break;
+        case OpCode::call:
+        case OpCode::tailcall: {
+            if (ins.op == OpCode::tailcall && level == 0) {
+                throw InvalidFile("tailcall in .start");
+            }
+            auto& callee = _file.functions[ins.x];
+            auto base = static_cast<i4>(_stack.size() - callee.paramSize);
+            materializeAll(true);
+            emit(ins.op == OpCode::call ? RegOp::call : RegOp::tailcall, {},
+                 {Operand::Mode::imm, static_cast<i4>(ins.x)}, {Operand::Mode::imm, base});
+            _stack.resize(base);
+            if (_returnsValue[ins.x]) {
+                push({Value::Kind::reg, base});
+            }
+            break;
+        }
+        case OpCode::ret:
+            emit(RegOp::ret);
+            break;
+        case OpCode::iret:
+            emit(RegOp::iret, operand(pop()));
+            break;
+        case OpCode::iprint:
+            emit(RegOp::iprint, operand(pop()));
+            break;
+        case OpCode::cprint:
+            emit(RegOp::cprint, operand(pop()));
+            break;
+        case OpCode::printl:
+            emit(RegOp::printl);
+            break;
+        case OpCode::iscan: {
+            Value result{Value::Kind::reg, static_cast<i4>(_stack.size())};
+            emit(RegOp::iscan, operand(result));
+            push(result);
+            break;
+        }
+        default:
+            unsupported(ins.op);
+        }
+    }
+    for (auto index : jumps) {
+        auto& c = _out[index].c;
+        c.value = static_cast<i4>(where[c.value]);
+    }
+    result.instructions = std::move(_out);
+    _out.clear();
+    return result;
+}
+
+}
+
+RegProgram RegProgram::translate(const File& file) {
+    u4 mainIndex = 0;
+    for (; mainIndex < file.functions.size(); ++mainIndex) {
+        if (nameOf(file, file.functions[mainIndex]) == "main") {
+            break;
+        }
+    }
+    if (mainIndex == file.functions.size()) {
+        throw InvalidFile("main not found");
+    }
+    std::vector<bool> returnsValue;
+    for (auto& fun : file.functions) {
+        returnsValue.push_back(std::any_of(fun.instructions().begin(), fun.instructions().end(), [](const Instruction& ins) {
+            return ins.op == OpCode::iret || ins.op == OpCode::dret || ins.op == OpCode::aret;
+        }));
+    }
+
+    Translator translator(file, std::move(returnsValue));
+    RegProgram program;
+    auto start = file.start;
+    start.push_back(Instruction{OpCode::snew, file.functions[mainIndex].paramSize, 0});
+    start.push_back(Instruction{OpCode::call, mainIndex, 0});
+    program.start = translator.translate(".start", 0, 0, start);
+    for (auto& fun : file.functions) {
+        program.functions.push_back(translator.translate(nameOf(file, fun), fun.level, fun.paramSize, fun.instructions()));
+    }
+    return program;
+}
+
+RegVM::RegVM(RegProgram program)
+    : _program(std::move(program)), _stack(new slot_t[MAX_STACK_SIZE]),
+      _in(&std::cin), _out(&std::cout), _err(&std::cerr), _executed(0) {}
+
+std::unique_ptr<RegVM> RegVM::make_vm(const File& file) {
+    return std::make_unique<RegVM>(RegProgram::translate(file));
+}
+
+void RegVM::setIO(std::istream& in, std::ostream& out, std::ostream& err) {
+    _in = &in;
+    _out = &out;
+    _err = &err;
+}
+
+void RegVM::start() {
+    _executed = 0;
+    run();
+}
+
+void RegVM::run() {
+    struct Frame {
+        const RegFunction* function;
+        u4 pc;
+        addr_t base;
+    };
+    std::vector<Frame> frames;
+    const RegFunction* function = &_program.start;
+    const RegInstruction* code = function->instructions.data();
+    u4 size = static_cast<u4>(function->instructions.size());
+    u4 pc = 0;
+    addr_t base = 0;
+    slot_t* stack = _stack.get();
+
+    const auto read = [&](const Operand& o) -> slot_t {
+        switch (o.mode) {
+        case Operand::Mode::reg:    return stack[base + o.value];
+        case Operand::Mode::global: return stack[o.value];
+        default:                    return o.value;
+        }
+    };
+    const auto write = [&](const Operand& o, slot_t value) {
+        (o.mode == Operand::Mode::global ? stack[o.value] : stack[base + o.value]) = value;
+    };
+    const auto enter = [&](i4 index, addr_t newBase) {
+        auto& callee = _program.functions[index];
+        if (newBase + static_cast<addr_t>(callee.frameSize) > MAX_STACK_SIZE) {
+            throw StackOverflow();
+        }
+        function = &callee;
+        code = callee.instructions.data();
+        size = static_cast<u4>(callee.instructions.size());
+        pc = 0;
+        base = newBase;
+    };
+    const auto leave = [&]() {
+        if (frames.empty()) {
+            throw InvalidControlTransfer();
+        }
+        auto& frame = frames.back();
+        function = frame.function;
+        code = function->instructions.data();
+        size = static_cast<u4>(function->instructions.size());
+        pc = frame.pc;
+        base = frame.base;
+        frames.pop_back();
+    };
+
+    try {
+        if (function->frameSize > static_cast<u4>(MAX_STACK_SIZE)) {
+            throw StackOverflow();
+        }
+        while (true) {
+            if (pc >= size) {
+                if (frames.empty()) {
+                    break;
+                }
+                // no ret at the end of funtion
+                throw InvalidControlTransfer();
+            }
+            auto& ins = code[pc++];
+            ++_executed;
+            switch (ins.op) {
+            case RegOp::mov: write(ins.a, read(ins.b)); break;
+            case RegOp::add: write(ins.a, read(ins.b) + read(ins.c)); break;
+            case RegOp::sub: write(ins.a, read(ins.b) - read(ins.c)); break;
+            case RegOp::mul: write(ins.a, read(ins.b) * read(ins.c)); break;
+            case RegOp::div: {
+                auto rhs = read(ins.c);
+                if (rhs == 0) {
+                    throw DivideByZero();
+                }
+                write(ins.a, read(ins.b) / rhs);
+                break;
+            }
+            case RegOp::neg: write(ins.a, -read(ins.b)); break;
+            case RegOp::cmp: {
+                auto lhs = read(ins.b), rhs = read(ins.c);
+                write(ins.a, lhs > rhs ? 1 : lhs < rhs ? -1 : 0);
+                break;
+            }
+            case RegOp::jmp: pc = ins.c.value; break;
+            case RegOp::jeq: if (read(ins.a) == read(ins.b)) pc = ins.c.value; break;
+            case RegOp::jne: if (read(ins.a) != read(ins.b)) pc = ins.c.value; break;
+            case RegOp::jlt: if (read(ins.a) <  read(ins.b)) pc = ins.c.value; break;
+            case RegOp::jge: if (read(ins.a) >= read(ins.b)) pc = ins.c.value; break;
+            case RegOp::jgt: if (read(ins.a) >  read(ins.b)) pc = ins.c.value; break;
+            case RegOp::jle: if (read(ins.a) <= read(ins.b)) pc = ins.c.value; break;
+            case RegOp::call:
+                frames.push_back({function, pc, base});
+                enter(ins.b.value, base + ins.c.value);
+                break;
+            case RegOp::tailcall: {
+                if (frames.empty()) {
+                    throw InvalidControlTransfer();
+                }
+                auto& callee = _program.functions[ins.b.value];
+                std::copy_n(stack + base + ins.c.value, callee.paramSize, stack + base);
+                enter(ins.b.value, base);
+                break;
+            }
+            case RegOp::ret:
+                leave();
+                break;
+            case RegOp::iret: {
+                // the return value takes the place of the arguments
+                auto value = read(ins.a);
+                stack[base] = value;
+                leave();
+                break;
+            }
+            case RegOp::iprint: *_out << read(ins.a); break;
+            case RegOp::cprint: *_out << static_cast<char_t>(read(ins.a)); break;
+            case RegOp::printl: *_out << std::endl; break;
+            case RegOp::iscan:
+                if (int_t value; *_in >> value) {
+                    write(ins.a, value);
+                }
+                else {
+                    throw IOError();
+                }
+                break;
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        println(*_err, "runtime error:", e.what(), "!");
+        println(*_err, "occurred at:");
+        println(*_err, "          function", function->name, "at instruction", pc - 1);
+    }
+}
+
+}
@@ -0,0 +1,96 @@
+#ifndef REGVM_H_INCLUDED
+#define REGVM_H_INCLUDED
+
+#include "./type.h"
+#include "./file.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vm {
+
+// An experimental three-address register bytecode.
+// The registers of a function are the slots of its frame: the parameters,
+// the local variables and the temporaries of the stack bytecode, so that
+// `a = b + c` is a single `add a, b, c` instead of seven stack instructions.
+enum class RegOp : u1 {
+    mov,                  // a = b
+    add, sub, mul, div,   // a = b op c
+    neg,                  // a = -b
+    cmp,                  // a = b > c ? 1 : b < c ? -1 : 0
+    jmp,                  // goto c
+    jeq, jne, jlt,        // if (a op b) goto c
+    jge, jgt, jle,
+    call,                 // call function b, the arguments start at register c
+    tailcall,             // the same, reusing the current frame
+    ret, iret,            // return, return a
+    iprint, cprint,       // print a
+    printl,
+    iscan,                // read a
+};
+
+struct Operand {
+    enum class Mode : u1 {
+        reg,    // a register of the current frame
+        global, // a slot of the frame of .start
+        imm,    // the value itself
+    };
+    Mode mode;
+    i4 value;
+};
+
+struct RegInstruction {
+    RegOp op;
+    Operand a, b, c;
+};
+
+struct RegFunction {
+    std::string name;
+    u2 paramSize;
+    // the most registers the function uses at once
+    u4 frameSize;
+    std::vector<RegInstruction> instructions;
+};
+
+// .start followed by the call of main and the functions of a File,
+// the function indices are the same as in the File
+struct RegProgram {
+    RegFunction start;
+    std::vector<RegFunction> functions;
+
+    // only the integer subset of the stack bytecode is supported, InvalidFile otherwise
+    static RegProgram translate(const File& file);
+};
+
+class RegVM {
+private:
+    static const addr_t MAX_STACK_SIZE;
+
+    RegProgram _program;
+    std::unique_ptr<slot_t[]> _stack;
+    std::istream* _in;
+    std::ostream* _out;
+    std::ostream* _err;
+    u8 _executed;
+
+public:
+    explicit RegVM(RegProgram program);
+    RegVM(const RegVM&) = delete;
+    RegVM& operator=(const RegVM&) = delete;
+
+    static std::unique_ptr<RegVM> make_vm(const File& file);
+    const RegProgram& program() const { return _program; }
+    void setIO(std::istream& in, std::ostream& out, std::ostream& err);
+    void start();
+    // the number of instructions the last run executed
+    u8 executed() const { return _executed; }
+
+private:
+    void run();
+};
+
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include "./snapshot.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vm {
+
+namespace {
+
+const char snapshotMagic[4] = {'C', '0', 'S', 'N'};
+const u4 snapshotFormat = 2;
+
+struct Header {
+    char magic[4];
+    u4 format;
+    char key[64];
+    Snapshot::State state;
+};
+
+struct Mapping {
+    void* base = nullptr;
+    std::size_t size = 0;
+
+    ~Mapping() {
+        if (base) {
+            munmap(base, size);
+        }
+    }
+};
+
+template <typename T>
+void append(std::string& buffer, const T* values, std::size_t count) {
+    if (count > 0) {
+        buffer.append(reinterpret_cast<const char*>(values), count * sizeof(T));
+    }
+    buffer.resize((buffer.size() + 7) / 8 * 8, '\0');
+}
+
+// the next section, nullptr if the bytes end before it does
+template <typename T>
+const T* take(const unsigned char* base, std::size_t size, std::size_t& pos, u8 count) {
+    if (pos > size || count > (size - pos) / sizeof(T)) {
+        return nullptr;
+    }
+    auto p = reinterpret_cast<const T*>(base + pos);
+    pos = (pos + count * sizeof(T) + 7) / 8 * 8;
+    return p;
+}
+
+}
+
+std::string Snapshot::save(const std::string& key, const State& state, const slot_t* stack,
+                           const std::vector<Object>& objects, const std::vector<FreeBlock>& free,
+                           const std::vector<slot_t>& contents) {
+    Header header{};
+    std::memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.format = snapshotFormat;
+    key.copy(header.key, sizeof(header.key));
+    header.state = state;
+    header.state.objectsCount = static_cast<u4>(objects.size());
+    header.state.freeCount = static_cast<u4>(free.size());
+
+    std::string buffer;
+    append(buffer, &header, 1);
+    append(buffer, stack, static_cast<std::size_t>(state.sp));
+    append(buffer, objects.data(), objects.size());
+    append(buffer, free.data(), free.size());
+    append(buffer, contents.data(), contents.size());
+    return buffer;
+}
+
+std::shared_ptr<const Snapshot> Snapshot::load(std::string bytes, const std::string& key) {
+    auto owner = std::make_shared<const std::string>(std::move(bytes));
+    auto base = reinterpret_cast<const unsigned char*>(owner->data());
+    return parse(owner, base, owner->size(), key);
+}
+
+std::shared_ptr<const Snapshot> Snapshot::map(const std::string& path, const std::string& key) {
+    auto mapping = std::make_shared<Mapping>();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(Header)) {
+        void* p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            mapping->base = p;
+            mapping->size = static_cast<std::size_t>(st.st_size);
+        }
+    }
+    close(fd);
+    if (!mapping->base) {
+        return nullptr;
+    }
+    auto base = static_cast<const unsigned char*>(mapping->base);
+    auto size = mapping->size;
+    return parse(std::move(mapping), base, size, key);
+}
+
+std::shared_ptr<const Snapshot> Snapshot::parse(std::shared_ptr<const void> owner, const unsigned char* base,
+                                                std::size_t size, const std::string& key) {
+    std::size_t pos = 0;
+    auto header = take<Header>(base, size, pos, 1);
+    if (!header || std::memcmp(header->magic, snapshotMagic, sizeof(header->magic)) != 0
+        || header->format != snapshotFormat || key.size() != sizeof(header->key)
+        || key.compare(0, key.size(), header->key, sizeof(header->key)) != 0 || header->state.sp < 0) {
+        return nullptr;
+    }
+    std::shared_ptr<Snapshot> snapshot(new Snapshot());
+    snapshot->_state = header->state;
+    auto& state = snapshot->_state;
+    snapshot->_stack = take<slot_t>(base, size, pos, static_cast<u8>(state.sp));
+    snapshot->_objects = take<Object>(base, size, pos, state.objectsCount);
+    snapshot->_free = take<FreeBlock>(base, size, pos, state.freeCount);
+    if (!snapshot->_stack || !snapshot->_objects || !snapshot->_free) {
+        return nullptr;
+    }
+    u8 contentsCount = 0;
+    for (u4 i = 0; i < state.objectsCount; ++i) {
+        if (snapshot->_objects[i].size < 0) {
+            return nullptr;
+        }
+        contentsCount += static_cast<u8>(snapshot->_objects[i].size);
+    }
+    snapshot->_contents = take<slot_t>(base, size, pos, contentsCount);
+    if (!snapshot->_contents) {
+        return nullptr;
+    }
+    snapshot->_owner = std::move(owner);
+    return snapshot;
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+#include "./type.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vm {
+
+// The state of a VM right after .start, saved by VM::saveSnapshot, so that the runs of a program
+// with an expensive .start can begin at the call of main. Like an Image, it is in the byte order
+// of the VM that saved it and only valid for the program and the VM its key was made for:
+//   magic(4) format(4) key(64) State, padded to 8 bytes
+//   stack: the slots [0, sp)
+//   objects: {address(4) size(4)} the heap objects by address, the string literals included
+//   free: {size(4) address(4)} the free blocks between them
+//   contents: the slots of the objects one after another
+// Every section starts at a multiple of 8 bytes.
+class Snapshot {
+public:
+    struct State {
+        u8 instructions;
+        addr_t ip;
+        addr_t sp;
+        addr_t heapTop;
+        addr_t literalsEnd;
+        addr_t gcBudget;
+        addr_t allocatedSinceGC;
+        u4 objectsCount;
+        u4 freeCount;
+    };
+    struct Object {
+        addr_t address;
+        addr_t size;
+    };
+    struct FreeBlock {
+        addr_t size;
+        addr_t address;
+    };
+
+    static std::string save(const std::string& key, const State& state, const slot_t* stack,
+                            const std::vector<Object>& objects, const std::vector<FreeBlock>& free,
+                            const std::vector<slot_t>& contents);
+    // nullptr if it is not a snapshot, is truncated or was saved with another key
+    static std::shared_ptr<const Snapshot> load(std::string bytes, const std::string& key);
+    static std::shared_ptr<const Snapshot> map(const std::string& path, const std::string& key);
+
+    const State& state() const { return _state; }
+    const slot_t* stack() const { return _stack; }
+    const Object* objects() const { return _objects; }
+    const FreeBlock* free() const { return _free; }
+    const slot_t* contents() const { return _contents; }
+
+private:
+    Snapshot() = default;
+    static std::shared_ptr<const Snapshot> parse(std::shared_ptr<const void> owner, const unsigned char* base,
+                                                 std::size_t size, const std::string& key);
+
+    // the bytes the pointers point into
+    std::shared_ptr<const void> _owner;
+    State _state;
+    const slot_t* _stack = nullptr;
+    const Object* _objects = nullptr;
+    const FreeBlock* _free = nullptr;
+    const slot_t* _contents = nullptr;
+};
+
+}
+
+#endif
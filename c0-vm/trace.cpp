@@ -0,0 +1,111 @@
+#include "./trace.h"
+#include "./exception.h"
+#include "./util/print.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+namespace vm {
+
+Tracer::Tracer(size_t capacity, std::ostream* out) : _next(0), _written(0), _out(out) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    _buffer.resize(size);
+    _mask = size - 1;
+    if (_out) {
+        char header[8];
+        for (int i = 0; i < 4; ++i) {
+            header[i]   = static_cast<char>(magic_v >> (8*(3-i)));
+            header[i+4] = static_cast<char>(version_v >> (8*(3-i)));
+        }
+        _out->write(header, sizeof header);
+    }
+}
+
+Tracer::~Tracer() {
+    flush();
+}
+
+void Tracer::writeRecords(u8 from, u8 to) {
+    std::vector<char> bytes;
+    bytes.reserve((to - from) * recordSize);
+    const auto writeNBytes = [&](u4 v, int count) {
+        for (int i = count-1; i >= 0; --i) {
+            bytes.push_back(static_cast<char>(v >> (8*i)));
+        }
+    };
+    for (auto i = from; i < to; ++i) {
+        auto& r = _buffer[i & _mask];
+        writeNBytes(static_cast<u4>(r.functionIndex), 4);
+        writeNBytes(r.ip, 4);
+        writeNBytes(static_cast<u1>(r.op), 1);
+        writeNBytes(static_cast<u4>(r.sp), 4);
+        writeNBytes(static_cast<u4>(r.top), 4);
+    }
+    _out->write(bytes.data(), bytes.size());
+    _written = to;
+}
+
+void Tracer::flush() {
+    if (!_out) {
+        return;
+    }
+    if (_written < _next) {
+        u8 oldest = _next > _buffer.size() ? _next - _buffer.size() : 0;
+        writeRecords(std::max(_written, oldest), _next);
+    }
+    _out->flush();
+}
+
+void Tracer::dump(std::ostream& out, size_t count) const {
+    u8 from = _next - std::min<u8>({_next, _buffer.size(), count});
+    for (auto i = from; i < _next; ++i) {
+        println(out, "   ", _buffer[i & _mask]);
+    }
+}
+
+void Tracer::clear() {
+    flush();
+    _next = 0;
+    _written = 0;
+}
+
+void Tracer::decode(std::istream& in, std::ostream& out) {
+    unsigned char bytes[recordSize];
+    const auto readNBytes = [&](int pos, int count) {
+        u4 v = 0;
+        for (int i = 0; i < count; ++i) {
+            v = (v << 8) | bytes[pos+i];
+        }
+        return v;
+    };
+    if (!in.read(reinterpret_cast<char*>(bytes), 8)) {
+        throw InvalidFile("invalid trace file: incomplete header");
+    }
+    if (readNBytes(0, 4) != magic_v) {
+        throw InvalidFile("invalid trace file: invalid magic");
+    }
+    if (readNBytes(4, 4) != version_v) {
+        throw InvalidFile("invalid trace file: unsupported version");
+    }
+    while (in.read(reinterpret_cast<char*>(bytes), recordSize)) {
+        TraceRecord r;
+        r.functionIndex = static_cast<i4>(readNBytes(0, 4));
+        r.ip = readNBytes(4, 4);
+        r.op = static_cast<OpCode>(readNBytes(8, 1));
+        r.sp = static_cast<addr_t>(readNBytes(9, 4));
+        r.top = static_cast<slot_t>(readNBytes(13, 4));
+        if (nameOfOpCode.count(r.op) == 0) {
+            throw InvalidFile("invalid trace file: invalid opcode");
+        }
+        println(out, r);
+    }
+    if (in.gcount() != 0) {
+        throw InvalidFile("invalid trace file: incomplete record");
+    }
+}
+
+}
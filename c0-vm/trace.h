@@ -0,0 +1,90 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include "./type.h"
+#include "./opcode.h"
+#include "./util/print.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace vm {
+
+// what the vm is about to execute
+struct TraceRecord {
+    i4 functionIndex; // -1 for .start
+    u4 ip;
+    OpCode op;
+    addr_t sp;
+    slot_t top;       // value at sp-1, 0 if the stack is empty
+};
+
+// Fixed-size in-memory ring buffer of TraceRecord.
+// When a stream is given, every time the buffer is full its content
+// is written to the stream in binary form:
+//   magic(4) version(4) {functionIndex(4) ip(4) op(1) sp(4) top(4)}
+// all in big-endian, just like the .o0 file.
+class Tracer {
+public:
+    static constexpr u4 magic_v = 0x43305452;
+    static constexpr u4 version_v = 0x00000001;
+    static constexpr size_t recordSize = 17;
+    static constexpr size_t defaultCapacity = 4096;
+    // what a runtime error prints of the ring buffer
+    static constexpr size_t dumpCount = 32;
+
+public:
+    // capacity is rounded up to a power of 2
+    explicit Tracer(size_t capacity = defaultCapacity, std::ostream* out = nullptr);
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    ~Tracer();
+
+    void record(i4 functionIndex, u4 ip, OpCode op, addr_t sp, slot_t top) {
+        auto& r = _buffer[_next & _mask];
+        r.functionIndex = functionIndex;
+        r.ip = ip;
+        r.op = op;
+        r.sp = sp;
+        r.top = top;
+        // what flush() has written since the buffer last wrapped is not written again
+        if ((++_next & _mask) == 0 && _out) {
+            writeRecords(std::max(_written, _next - _buffer.size()), _next);
+        }
+    }
+    // write the records not yet streamed
+    void flush();
+    // print the last (at most count and capacity) records, the oldest first
+    void dump(std::ostream& out, size_t count = dumpCount) const;
+    void clear();
+
+    // decode a binary trace written by a Tracer
+    static void decode(std::istream& in, std::ostream& out);
+
+private:
+    void writeRecords(u8 from, u8 to);
+
+private:
+    std::vector<TraceRecord> _buffer;
+    u8 _mask;
+    u8 _next;
+    u8 _written;
+    std::ostream* _out;
+};
+
+}
+
+template <>
+inline void print(std::ostream& out, const vm::TraceRecord& t) {
+    if (t.functionIndex < 0) {
+        printfmt(out, ".start {}: {}", t.ip, vm::nameOfOpCode.at(t.op));
+    }
+    else {
+        printfmt(out, ".F{} {}: {}", t.functionIndex, t.ip, vm::nameOfOpCode.at(t.op));
+    }
+    printfmt(out, " sp={} top={}", t.sp, t.top);
+}
+
+#endif
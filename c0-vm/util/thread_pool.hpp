@@ -0,0 +1,148 @@
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work-stealing thread pool.
+// Every worker owns a deque: it pops its own tasks from the back
+// and steals from the front of the others' when it runs out of work.
+class thread_pool {
+public:
+    // 0 for std::thread::hardware_concurrency()
+    explicit thread_pool(std::size_t threads = 0) : _queued(0), _pending(0), _next(0), _stop(false) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (std::size_t i = 0; i < threads; ++i) {
+            _queues.push_back(std::make_unique<queue>());
+        }
+        for (std::size_t i = 0; i < threads; ++i) {
+            _workers.emplace_back([this, i] { work(i); });
+        }
+    }
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (auto& t : _workers) {
+            t.join();
+        }
+    }
+
+    std::size_t size() const {
+        return _workers.size();
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            // counted before being visible, so that _queued never underflows
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_queued;
+            ++_pending;
+        }
+        auto& q = *_queues[_next++ % _queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        _wake.notify_one();
+    }
+
+    // block until every submitted task has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _pending == 0; });
+    }
+
+    // index of the calling worker in [0, size()), -1 outside the pool
+    static int worker_index() {
+        return current_index();
+    }
+
+private:
+    struct queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    static int& current_index() {
+        thread_local int index = -1;
+        return index;
+    }
+
+    bool pop(std::size_t self, std::function<void()>& task) {
+        {
+            auto& q = *_queues[self];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        for (std::size_t i = 1; i < _queues.size(); ++i) {
+            auto& q = *_queues[(self + i) % _queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(std::size_t self) {
+        current_index() = static_cast<int>(self);
+        std::function<void()> task;
+        while (true) {
+            if (pop(self, task)) {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    --_queued;
+                }
+                task();
+                task = nullptr;
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (--_pending == 0) {
+                    _done.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this] { return _stop || _queued > 0; });
+            if (_stop && _queued == 0) {
+                return;
+            }
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<queue>> _queues;
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    // submitted but not yet picked up
+    std::size_t _queued;
+    // submitted but not yet finished
+    std::size_t _pending;
+    std::atomic<std::size_t> _next;
+    bool _stop;
+};
+
+#endif
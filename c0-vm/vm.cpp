@@ -5,10 +5,59 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <cmath>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <new>
+
+#include <csetjmp>
+#include <csignal>
+#include <sys/mman.h>
+#include <unistd.h>
 
 namespace vm {
 
+namespace {
+
+// the guard page of the VM running on this thread and where run() continues after it is hit
+struct StackGuard {
+    const char* begin;
+    const char* end;
+    sigjmp_buf* overflow;
+};
+thread_local StackGuard* currentGuard = nullptr;
+// the VM running on this thread if it has a profiler
+thread_local VM* currentProfiled = nullptr;
+struct sigaction previousAction;
+
+// thrown by a resumable scan that has to wait for input, nothing has been popped or pushed
+struct NeedsInput {};
+
+const char* const whitespace = " \t\n\v\f\r";
+
+void onSegmentationFault(int, siginfo_t* info, void*) {
+    auto guard = currentGuard;
+    auto addr = static_cast<const char*>(info->si_addr);
+    if (guard && guard->begin <= addr && addr < guard->end) {
+        siglongjmp(*guard->overflow, 1);
+    }
+    // not a VM stack overflow, the fault happens again with the previous handler
+    sigaction(SIGSEGV, &previousAction, nullptr);
+}
+
+std::size_t pageSize() {
+    static const std::size_t size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+}
+
+void VM::StackUnmapper::operator()(slot_t*) const {
+    munmap(base, size);
+}
+
 const addr_t VM::MIN_STACK_ADDR = 0;
 const addr_t VM::MAX_STACK_ADDR = 0x00ffffff;
 const addr_t VM::MAX_STACK_SIZE = 0x01000000;
@@ -16,23 +65,29 @@ const addr_t VM::MAX_STACK_SIZE = 0x01000000;
 const addr_t VM::MIN_HEAP_ADDR  = 0x01000000;
 const addr_t VM::MAX_HEAP_ADDR  = 0x01ffffff;
 const addr_t VM::MAX_HEAP_SIZE  = 0x01000000;
+// at least 4 MiB is allocated between two collections
+const addr_t VM::MIN_GC_GROWTH  = 0x00100000;
+// a few milliseconds at most between two reads of the clock for the time limit
+const u8 VM::TIME_CHECK_INTERVAL = 0x00040000;
 
-VM::VM(File file) noexcept : _file(std::move(file)){
+VM::VM(std::shared_ptr<const File> file) noexcept 
+    : _file(std::move(file)), _in(&std::cin), _out(&std::cout), _err(&std::cerr) {
     init();
 }
 
 std::unique_ptr<VM> VM::make_vm(File file) {
+    return make_vm(std::make_shared<const File>(std::move(file)));
+}
+
+std::unique_ptr<VM> VM::make_vm(std::shared_ptr<const File> file) {
     // found main function
     vm::u4 mainIndex = 0;
-    bool mainFound = false;
-    for (auto& fun : file.functions) {
-        if (0 > fun.nameIndex || fun.nameIndex >= file.constants.size()) {
+    for (auto& fun : file->functions) {
+        if (0 > fun.nameIndex || fun.nameIndex >= file->constants.size()) {
             throw InvalidFile("function name index out of range");
         }
-        if (auto& constant = file.constants.at(fun.nameIndex); constant.type == vm::Constant::Type::STRING) {
+        if (auto& constant = file->constants.at(fun.nameIndex); constant.type == vm::Constant::Type::STRING) {
             if (std::get<vm::str_t>(constant.value) == "main") {
-                file.start.push_back(Instruction{OpCode::snew, fun.paramSize});
-                file.start.push_back(Instruction{OpCode::call, mainIndex});
                 break;
             }
         }
@@ -41,79 +96,513 @@ std::unique_ptr<VM> VM::make_vm(File file) {
         }
         ++mainIndex;
     }
-    if (mainIndex == file.functions.size()) {
+    if (mainIndex == file->functions.size()) {
         throw InvalidFile("main not found");
     }
+    u2 maxLevel = 0;
+    for (auto& fun : file->functions) {
+        maxLevel = std::max(maxLevel, fun.level);
+    }
     auto vm = std::make_unique<VM>(std::move(file));
-    vm->_stack = std::make_unique<slot_t[]>(MAX_STACK_ADDR-MIN_STACK_ADDR);
-    vm->_heap  = std::make_unique<slot_t[]>(MAX_HEAP_ADDR-MIN_HEAP_ADDR);
+    vm->_display.resize(maxLevel + 1);
+    // the file may be shared with other instances, .start is extended in a copy
+    vm->_start = vm->_file->start;
+    vm->_start.push_back(Instruction{OpCode::snew, vm->_file->functions.at(mainIndex).paramSize});
+    vm->_start.push_back(Instruction{OpCode::call, mainIndex});
+    vm->_startCode = compact(vm->_start);
+    vm->link();
+    vm->allocate();
+    vm->buildStringLiteralPool();
     return std::move(vm);
 }
 
+std::unique_ptr<VM> VM::make_vm(std::shared_ptr<const Image> image) {
+    auto vm = std::make_unique<VM>(image->file());
+    vm->_display.resize(image->maxLevel() + 1);
+    vm->_start = image->start();
+    vm->_startCode = image->startCode();
+    vm->link();
+    for (u4 i = 0; i < vm->_callees.size(); ++i) {
+        vm->_callees[i].code = CodeRange{image->code(i), image->codeSize(i)};
+    }
+    vm->allocate();
+    // the string literals are written at reset
+    for (auto& literal : image->literals()) {
+        if (literal.address < MIN_HEAP_ADDR || literal.address + literal.size >= MAX_HEAP_ADDR) {
+            throw InvalidFile("invalid image: string literal out of the heap");
+        }
+        vm->_stringLiteralPool[literal.index] = literal.address;
+        vm->_heapObjects.emplace(literal.address, HeapObject{literal.size, false});
+        vm->_literalsEnd = std::max(vm->_literalsEnd, literal.address + literal.size);
+    }
+    vm->_heapTop = vm->_literalsEnd;
+    vm->_image = std::move(image);
+    return vm;
+}
+
+void VM::saveImage(std::ostream& out, const std::string& key) {
+    std::vector<std::vector<Code>> code;
+    code.reserve(_callees.size());
+    for (u4 i = 0; i < _callees.size(); ++i) {
+        auto range = codeOf(i);
+        code.emplace_back(range.code, range.code + range.size);
+    }
+    // in the order buildStringLiteralPool allocates them
+    std::vector<Image::Literal> literals;
+    for (u4 i = 0; i < _file->constants.size(); ++i) {
+        if (auto it = _stringLiteralPool.find(i); it != _stringLiteralPool.end()) {
+            auto size = static_cast<addr_t>(std::get<str_t>(_file->constants[i].value).length() + 1);
+            literals.push_back(Image::Literal{i, it->second, size});
+        }
+    }
+    Image::save(out, key, *_file, _start.back().x, static_cast<u2>(_display.size() - 1), _start, code, literals);
+}
+
+void VM::allocate() {
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        struct sigaction action = {};
+        action.sa_sigaction = onSegmentationFault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previousAction);
+    });
+    // the stack ends right where the guard page starts
+    std::size_t stackBytes = (MAX_STACK_ADDR-MIN_STACK_ADDR) * sizeof(slot_t);
+    std::size_t mappedBytes = (stackBytes + pageSize() - 1) / pageSize() * pageSize() + pageSize();
+    void* base = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    char* guard = static_cast<char*>(base) + mappedBytes - pageSize();
+    if (mprotect(guard, pageSize(), PROT_NONE) != 0) {
+        munmap(base, mappedBytes);
+        throw std::bad_alloc();
+    }
+    _stack = std::unique_ptr<slot_t[], StackUnmapper>(reinterpret_cast<slot_t*>(guard - stackBytes), StackUnmapper{base, mappedBytes});
+    // left uninitialized, pages are only committed when touched
+    _heap  = std::unique_ptr<slot_t[]>(new slot_t[MAX_HEAP_ADDR-MIN_HEAP_ADDR]);
+}
+
 void VM::init() noexcept {
     prepared = false;
+    _status = Status::FINISHED;
     _sp = 0;
     _bp = 0;
     _ip = 0;
     _counterInstruction = 0;
     _contexts.clear();
-    _heapRecord.clear();
+    _heapObjects.clear();
+    _literalsEnd = MIN_HEAP_ADDR;
+    _heapTop = MIN_HEAP_ADDR;
+    _freeBlocks.clear();
+    _gc = false;
+    _gcBudget = MIN_GC_GROWTH;
+    _allocatedSinceGC = 0;
     _stringLiteralPool.clear();
+    _resumable = false;
+    _inputPos = 0;
+    _inputClosed = false;
+    _nextCheck = std::numeric_limits<u8>::max();
+    _samplePending = false;
+    _sampleCode = nullptr;
+    _sampleIp = 0;
+    _timeLeft = std::chrono::steady_clock::duration::zero();
+    _heapEnd = MAX_HEAP_ADDR;
+}
+
+void VM::reset() {
+    prepared = false;
+    _sp = 0;
+    _bp = 0;
+    _ip = 0;
+    _counterInstruction = 0;
+    _contexts.clear();
+    std::fill(_display.begin(), _display.end(), 0);
+    // the string literal pool is always allocated first
+    _heapObjects.erase(_heapObjects.lower_bound(_literalsEnd), _heapObjects.end());
+    _heapTop = _literalsEnd;
+    _freeBlocks.clear();
+    _gcBudget = MIN_GC_GROWTH;
+    _allocatedSinceGC = 0;
+    _timeLeft = _limits.time;
+    _heapEnd = MAX_HEAP_ADDR;
+    if (_limits.heapBytes > 0) {
+        // NEW keeps the heap below _heapEnd
+        auto end = static_cast<u8>(_literalsEnd) + (_limits.heapBytes + sizeof(slot_t) - 1) / sizeof(slot_t) + 1;
+        _heapEnd = static_cast<addr_t>(std::min<u8>(end, MAX_HEAP_ADDR));
+    }
+    fillStringLiteralPool();
+    if (_tracer) {
+        _tracer->clear();
+    }
 }
 
 void VM::buildStringLiteralPool() {
-    u2 i = 0;
-    for (auto it = _file.constants.begin(), ed = _file.constants.end(); it != ed; ++it) {
+    u4 i = 0;
+    for (auto it = _file->constants.begin(), ed = _file->constants.end(); it != ed; ++it) {
         auto& c = *it;
         if (c.type == vm::Constant::Type::STRING) {
-            str_t str = std::get<str_t>(c.value);
-            addr_t addr = NEW(str.length()+1);
-            _stringLiteralPool[i] = addr;
-            slot_t* dst =  toHeapPtr(addr);
-            for (auto ch : str) {
-                *dst++ = ch & 0xff;
-            }
-            *dst = '\0';
+            _stringLiteralPool[i] = NEW(std::get<str_t>(c.value).length()+1);
         }
         ++i;
     }
+    _literalsEnd = _heapTop;
+    fillStringLiteralPool();
 }
 
-void VM::start() {
-    init();
-    buildStringLiteralPool();
+void VM::fillStringLiteralPool() {
+    for (auto& [index, addr] : _stringLiteralPool) {
+        auto& str = std::get<str_t>(_file->constants.at(index).value);
+        slot_t* dst =  toHeapPtr(addr);
+        for (auto ch : str) {
+            *dst++ = ch & 0xff;
+        }
+        *dst = '\0';
+    }
+}
+
+VM::Status VM::start() {
+    reset();
+    enterStart();
+    if (_snapshot) {
+        restore();
+    }
+    prepared = true;
+    return run();
+}
+
+void VM::enterStart() {
     Context globalContext;
     globalContext.prevPC = 0;
     globalContext.prevSP = 0;
     globalContext.prevBP = 0;
     globalContext.BP = 0;
-    globalContext.staticLink = 0;
-    globalContext.functionIndex = -1;
-    globalContext.functionName = "__START__";
-    globalContext.functionLevel = 0;
-    _currentInstructions = _file.start;
+    globalContext.prevDisplay = 0;
+    globalContext.function = &_startCallee;
+    _currentCode = _startCallee.code;
     _contexts.push_back(globalContext);
+}
+
+void VM::saveSnapshot(std::ostream& out, const std::string& key) {
+    // .start is followed by the snew and the call of main
+    auto startLength = static_cast<addr_t>(_start.size() - 2);
+    // the functions .start calls may do the I/O as well
+    std::vector<bool> reached(_file->functions.size());
+    std::vector<std::pair<const Instruction*, const Instruction*>> pending{{_start.data(), _start.data() + startLength}};
+    while (!pending.empty()) {
+        auto [begin, end] = pending.back();
+        pending.pop_back();
+        for (auto it = begin; it != end; ++it) {
+            auto& ins = *it;
+            switch (ins.op) {
+            case OpCode::iprint: case OpCode::dprint: case OpCode::cprint: case OpCode::sprint:
+            case OpCode::printl: case OpCode::iscan: case OpCode::dscan: case OpCode::cscan:
+                throw InvalidFile(".start reads or writes, it can not be snapshotted");
+            case OpCode::call: case OpCode::tailcall:
+                if (ins.x < reached.size() && !reached[ins.x]) {
+                    reached[ins.x] = true;
+                    auto& code = _file->functions[ins.x].instructions();
+                    pending.emplace_back(code.data(), code.data() + code.size());
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    _snapshot.reset();
+    reset();
+    enterStart();
+    // a ret back into .start takes its code from _startCallee, which has to end there too
+    struct RestoreStart {
+        Callee& callee;
+        CodeRange code;
+        ~RestoreStart() { callee.code = code; }
+    } restoreStart{_startCallee, _startCallee.code};
+    _startCallee.code.size = static_cast<u4>(startLength);
+    _currentCode = _startCallee.code;
     prepared = true;
-    run();
+    if (run() != Status::FINISHED || _ip != startLength) {
+        throw InvalidFile(".start failed, it can not be snapshotted");
+    }
+
+    Snapshot::State state{};
+    state.instructions = _counterInstruction;
+    state.ip = _ip;
+    state.sp = _sp;
+    state.heapTop = _heapTop;
+    state.literalsEnd = _literalsEnd;
+    state.gcBudget = _gcBudget;
+    state.allocatedSinceGC = _allocatedSinceGC;
+    std::vector<Snapshot::Object> objects;
+    std::vector<slot_t> contents;
+    for (auto& [addr, object] : _heapObjects) {
+        objects.push_back(Snapshot::Object{addr, object.size});
+        contents.insert(contents.end(), toHeapPtr(addr), toHeapPtr(addr) + object.size);
+    }
+    std::vector<Snapshot::FreeBlock> free;
+    for (auto& [size, addr] : _freeBlocks) {
+        free.push_back(Snapshot::FreeBlock{size, addr});
+    }
+    auto bytes = Snapshot::save(key, state, _stack.get(), objects, free, contents);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    _snapshot = Snapshot::load(std::move(bytes), key);
 }
 
-void VM::run() {
-    try {
-        while (_ip < _currentInstructions.size()) {
-            executeInstruction(_currentInstructions.at(_ip));
-            ++_ip;
-            ++_counterInstruction;
+bool VM::restoreSnapshot(const std::string& path, const std::string& key) {
+    auto snapshot = Snapshot::map(path, key);
+    if (!snapshot || !accepts(*snapshot)) {
+        return false;
+    }
+    _snapshot = std::move(snapshot);
+    return true;
+}
+
+// the key should rule out any other program, this only keeps a bad file from writing out of bounds
+bool VM::accepts(const Snapshot& snapshot) const {
+    auto& state = snapshot.state();
+    if (state.ip != static_cast<addr_t>(_start.size() - 2) || state.literalsEnd != _literalsEnd
+        || state.sp > MAX_STACK_ADDR || state.heapTop < _literalsEnd || state.heapTop >= MAX_HEAP_ADDR) {
+        return false;
+    }
+    addr_t end = MIN_HEAP_ADDR;
+    for (u4 i = 0; i < state.objectsCount; ++i) {
+        auto& object = snapshot.objects()[i];
+        if (object.address < end || object.size > state.heapTop - object.address) {
+            return false;
+        }
+        // the string literals are where make_vm put them
+        if (object.address < _literalsEnd) {
+            auto it = _heapObjects.find(object.address);
+            if (it == _heapObjects.end() || it->second.size != object.size) {
+                return false;
+            }
         }
-        if (_contexts.size() != 1) {
-            // no ret at the end of funtion
-            throw InvalidControlTransfer();
+        end = object.address + object.size;
+    }
+    for (u4 i = 0; i < state.freeCount; ++i) {
+        auto& block = snapshot.free()[i];
+        if (block.address < _literalsEnd || block.size <= 0 || block.size > state.heapTop - block.address) {
+            return false;
         }
     }
+    return true;
+}
+
+// start() from the state of the snapshot instead of running .start
+void VM::restore() {
+    auto& state = _snapshot->state();
+    std::copy_n(_snapshot->stack(), state.sp, _stack.get());
+    _sp = state.sp;
+    _ip = state.ip;
+    auto contents = _snapshot->contents();
+    for (u4 i = 0; i < state.objectsCount; ++i) {
+        auto& object = _snapshot->objects()[i];
+        if (object.address >= _literalsEnd) {
+            _heapObjects.emplace(object.address, HeapObject{object.size, false});
+        }
+        std::copy_n(contents, object.size, toHeapPtr(object.address));
+        contents += object.size;
+    }
+    for (u4 i = 0; i < state.freeCount; ++i) {
+        _freeBlocks.emplace(_snapshot->free()[i].size, _snapshot->free()[i].address);
+    }
+    _heapTop = state.heapTop;
+    _gcBudget = state.gcBudget;
+    _allocatedSinceGC = state.allocatedSinceGC;
+    _counterInstruction = state.instructions;
+}
+
+VM::Status VM::resume() {
+    if (_status != Status::NEEDS_INPUT) {
+        return _status;
+    }
+    return run();
+}
+
+void VM::setIO(std::istream& in, std::ostream& out, std::ostream& err) {
+    _in = &in;
+    _out = &out;
+    _err = &err;
+}
+
+void VM::setTracer(std::unique_ptr<Tracer> tracer) {
+    _tracer = std::move(tracer);
+}
+
+void VM::setGC(bool enabled) {
+    _gc = enabled;
+}
+
+void VM::setLimits(const Limits& limits) {
+    _limits = limits;
+}
+
+void VM::setResumable(bool enabled) {
+    _resumable = enabled;
+    _input.clear();
+    _inputPos = 0;
+    _inputClosed = false;
+}
+
+void VM::feed(const char* data, std::size_t size) {
+    // drop what has been scanned once it is most of the buffer
+    if (_inputPos > _input.size() / 2) {
+        _input.erase(0, _inputPos);
+        _inputPos = 0;
+    }
+    _input.append(data, size);
+}
+
+void VM::closeInput() {
+    _inputClosed = true;
+}
+
+void VM::setProfiler(std::shared_ptr<Profiler> profiler) {
+    _profiler = std::move(profiler);
+}
+
+// a pending sample is taken first, a run ended by a limit still records where it was
+void VM::checkLimits() {
+    if (_samplePending.load(std::memory_order_acquire)) {
+        takeSample();
+    }
+    if (_limits.instructions > 0 && _counterInstruction >= _limits.instructions) {
+        throw ResourceExhausted("instruction limit exceeded");
+    }
+    if (_limits.time.count() > 0 && std::chrono::steady_clock::now() >= _deadline) {
+        throw ResourceExhausted("time limit exceeded");
+    }
+    scheduleCheck();
+}
+
+// without limits the check never comes, unless a sample is pending
+void VM::scheduleCheck() {
+    u8 next = std::numeric_limits<u8>::max();
+    if (_limits.instructions > 0) {
+        next = _limits.instructions;
+    }
+    if (_limits.time.count() > 0) {
+        next = std::min(next, _counterInstruction + TIME_CHECK_INTERVAL);
+    }
+    _nextCheck.store(next, std::memory_order_relaxed);
+    // the handler may have run since the sample was taken, its 0 has just been overwritten
+    if (_samplePending.load(std::memory_order_relaxed)) {
+        _nextCheck.store(0, std::memory_order_relaxed);
+    }
+}
+
+// the functions on the contexts are those of the noted instruction, unless the signal came in
+// the middle of a call or a return and the instruction is not in the function on top
+void VM::takeSample() {
+    auto code = _sampleCode;
+    auto ip = _sampleIp;
+    _samplePending.store(false, std::memory_order_relaxed);
+    auto& top = _contexts.back().function->code;
+    if (!_profiler || code != top.code || ip < 0 || static_cast<u4>(ip) >= top.size) {
+        return;
+    }
+    _sampleFrames.clear();
+    for (auto it = _contexts.rbegin(); it != _contexts.rend() && _sampleFrames.size() < Profiler::MAX_DEPTH; ++it) {
+        _sampleFrames.push_back(it->function->index);
+    }
+    _profiler->record(_sampleFrames, ip, _sampleFrames.size() < _contexts.size());
+}
+
+// async-signal-safe: it only reads and writes the members of the VM of the interrupted thread,
+// the _ip it reads may lag behind by the few instructions the compiler keeps it in a register,
+// and is the one before the target while a jump is taken
+void VM::onProfilingTimer(int) {
+    auto vm = currentProfiled;
+    if (!vm || vm->_samplePending.load(std::memory_order_relaxed)) {
+        return;
+    }
+    vm->_sampleCode = vm->_currentCode.code;
+    vm->_sampleIp = vm->_ip;
+    vm->_samplePending.store(true, std::memory_order_release);
+    vm->_nextCheck.store(0, std::memory_order_relaxed);
+}
+
+// where the input that the next scan reads ends, npos if it may go on in what is fed next:
+// a number has to be followed by a whitespace, a char only has to be there
+std::size_t VM::inputReady(bool wholeToken) const {
+    auto begin = _input.find_first_not_of(whitespace, _inputPos);
+    auto end = begin == std::string::npos || !wholeToken ? begin : _input.find_first_of(whitespace, begin);
+    if (end == std::string::npos) {
+        return _inputClosed ? _input.size() : std::string::npos;
+    }
+    return wholeToken ? end : end + 1;
+}
+
+// kept out of run(), sigsetjmp would keep the compiler from optimizing the loop
+void VM::execute() {
+    while (_ip < _currentCode.size) {
+        auto& ins = _currentCode.code[_ip];
+        if (_tracer) {
+            _tracer->record(_contexts.back().function->index, _ip, static_cast<OpCode>(ins.op), _sp, _sp > 0 ? _stack[_sp-1] : 0);
+        }
+        executeInstruction(ins);
+        ++_ip;
+        ++_counterInstruction;
+    }
+    if (_contexts.size() != 1) {
+        // no ret at the end of funtion
+        throw InvalidControlTransfer();
+    }
+}
+
+VM::Status VM::run() {
+    if (_limits.time.count() > 0) {
+        _deadline = std::chrono::steady_clock::now() + _timeLeft;
+    }
+    scheduleCheck();
+    // created before the guard is in place, it may throw
+    std::unique_ptr<Profiler::Timer> timer;
+    if (_profiler) {
+        timer = std::make_unique<Profiler::Timer>(_profiler->hz());
+    }
+    sigjmp_buf overflow;
+    auto guardBegin = reinterpret_cast<const char*>(_stack.get() + (MAX_STACK_ADDR-MIN_STACK_ADDR));
+    StackGuard guard{guardBegin, guardBegin + pageSize(), &overflow};
+    auto previousGuard = currentGuard;
+    currentGuard = &guard;
+    auto previousProfiled = currentProfiled;
+    if (_profiler) {
+        currentProfiled = this;
+    }
+    try {
+        // nothing between here and a push has a destructor to skip
+        if (sigsetjmp(overflow, 1)) {
+            throw StackOverflow();
+        }
+        execute();
+        _status = Status::FINISHED;
+    }
+    catch (const NeedsInput&) {
+        _status = Status::NEEDS_INPUT;
+    }
     catch (const std::exception& e) {
-        println(std::cerr, "runtime error:", e.what(), "!");
-        println(std::cerr, "occurred at:");
-        printStackTrace(std::cerr);
+        _status = Status::FAILED;
+        println(*_err, "runtime error:", e.what(), "!");
+        println(*_err, "occurred at:");
+        printStackTrace(*_err);
+        if (_tracer) {
+            println(*_err, "last executed instructions:");
+            _tracer->dump(*_err);
+        }
+    }
+    currentGuard = previousGuard;
+    currentProfiled = previousProfiled;
+    // taken at a check of the next run it would not match the state
+    _samplePending = false;
+    if (_limits.time.count() > 0) {
+        _timeLeft = _deadline - std::chrono::steady_clock::now();
+    }
+    if (_tracer) {
+        _tracer->flush();
     }
+    return _status;
 }
 
 void VM::printStackTrace(std::ostream& out) {
@@ -123,11 +612,11 @@ void VM::printStackTrace(std::ostream& out) {
         return;
     }
     auto pc = this->_ip;
-    if (pc >= _currentInstructions.size()) {
-        println(out, "          control reaches the end of function", rit->functionName, "without return");
+    if (pc >= _currentCode.size) {
+        println(out, "          control reaches the end of function", *rit->function->name, "without return");
     }
     else {
-        println(out, "          function", rit->functionName, "at instruction", pc, ":", _currentInstructions.at(pc));
+        println(out, "          function", *rit->function->name, "at instruction", pc, ":", instructionAt(rit->function->index, pc));
     }
     while (true) {
         pc = rit->prevPC;
@@ -135,14 +624,59 @@ void VM::printStackTrace(std::ostream& out) {
         if (rit == red) {
             return;
         }
-        if (rit->functionIndex == -1) {
-            println(out, "called by .start at instruction", pc, ":", _file.start.at(pc));
+        if (rit->function->index == -1) {
+            println(out, "called by .start at instruction", pc, ":", instructionAt(-1, pc));
             return;
         }
-        println(out, "called by function", rit->functionName, "at instruction", pc, ":", _file.functions.at(rit->functionIndex).instructions.at(pc));
+        println(out, "called by function", *rit->function->name, "at instruction", pc, ":", instructionAt(rit->function->index, pc));
     }
 }
 
+// a call only needs the Callee of the function, .start has one as well
+void VM::link() {
+    static const str_t startName = "__START__";
+    _startCallee = Callee{CodeRange{_startCode.data(), static_cast<u4>(_startCode.size())}, -1, 0, 0, &startName};
+    auto count = static_cast<u4>(_file->functions.size());
+    _translated.resize(count);
+    _callees.clear();
+    _callees.reserve(count);
+    for (u4 i = 0; i < count; ++i) {
+        auto& fun = _file->functions[i];
+        if (fun.nameIndex >= _file->constants.size() || _file->constants[fun.nameIndex].type != Constant::Type::STRING) {
+            throw InvalidFile("function name not found");
+        }
+        auto& name = std::get<str_t>(_file->constants[fun.nameIndex].value);
+        _callees.push_back(Callee{CodeRange{nullptr, 0}, static_cast<int>(i), fun.paramSize, fun.level, &name});
+    }
+}
+
+std::vector<Code> VM::compact(const std::vector<Instruction>& instructions) {
+    std::vector<Code> code;
+    code.reserve(instructions.size());
+    for (auto& ins : instructions) {
+        code.push_back(toCode(ins));
+    }
+    return code;
+}
+
+VM::CodeRange VM::codeOf(u4 index) {
+    auto& range = _callees[index].code;
+    // an empty function is translated again every time, which costs nothing
+    if (!range.code) {
+        auto& code = _translated[index];
+        code = compact(_file->functions[index].instructions());
+        range = CodeRange{code.data(), static_cast<u4>(code.size())};
+    }
+    return range;
+}
+
+const Instruction& VM::instructionAt(int functionIndex, addr_t pc) const {
+    if (functionIndex == -1) {
+        return _start.at(pc);
+    }
+    return _file->functions.at(functionIndex).instructions().at(pc);
+}
+
 void VM::ensureStackRest(addr_t count) {
     if (_sp + count > MAX_STACK_ADDR) {
         throw StackOverflow();
@@ -171,8 +705,10 @@ slot_t* VM::checkAddr(addr_t addr, addr_t count) {
         return toStackPtr(addr);
     }
     if (MIN_HEAP_ADDR <= addr && addr < MAX_HEAP_ADDR) {
-        for (auto& p : _heapRecord) {
-            if (p.first <= addr && end <= p.first+p.second) {
+        // the last object that starts at or before addr
+        if (auto it = _heapObjects.upper_bound(addr); it != _heapObjects.begin()) {
+            --it;
+            if (end <= it->first + it->second.size) {
                 return toHeapPtr(addr);
             }
         }
@@ -193,28 +729,120 @@ void VM::INC_SP(addr_t count) {
 }
 
 addr_t VM::NEW(addr_t count) {
-    addr_t st = MIN_HEAP_ADDR;
-    if (!_heapRecord.empty()) {
-        auto& last = _heapRecord.back();
-        st = last.first + last.second;
+    if (count < 0) {
+        throw InvalidMemoryAccess("tried to allocate a negative size");
+    }
+    if (_gc && _allocatedSinceGC + count > _gcBudget) {
+        collect();
+    }
+    addr_t st = takeFreeBlock(count);
+    // the heap may be full of garbage before the budget is used up
+    if (!st && _gc && _heapTop + count >= _heapEnd && _allocatedSinceGC > 0) {
+        collect();
+        st = takeFreeBlock(count);
+    }
+    if (!st) {
+        if (_heapTop + count >= _heapEnd) {
+            if (_heapEnd < MAX_HEAP_ADDR) {
+                throw ResourceExhausted("heap limit exceeded");
+            }
+            throw HeapOverflow();
+        }
+        st = _heapTop;
+        _heapTop += count;
+    }
+    _allocatedSinceGC += count;
+    // an empty object can not be accessed, it is not recorded so that it does not hide the next one
+    if (count > 0) {
+        _heapObjects.emplace(st, HeapObject{count, false});
+        std::fill_n(toHeapPtr(st), count, 0);
+    }
+    return st;
+}
+
+// the smallest free block that fits, 0 if there is none
+addr_t VM::takeFreeBlock(addr_t count) {
+    if (count == 0 || _freeBlocks.empty()) {
+        return 0;
     }
-    if (st + count >= MAX_HEAP_ADDR) {
-        throw HeapOverflow();
+    auto it = _freeBlocks.lower_bound(count);
+    if (it == _freeBlocks.end()) {
+        return 0;
+    }
+    auto [size, st] = *it;
+    _freeBlocks.erase(it);
+    if (size > count) {
+        _freeBlocks.emplace(size - count, st + count);
     }
-    _heapRecord.emplace_back(st, count);
     return st;
 }
 
+// mark what the stack and the string literals point to, then what the marked objects point to,
+// the rest is swept and the gaps between the survivors become the free blocks
+void VM::collect() {
+    std::vector<std::map<addr_t, HeapObject>::iterator> pending;
+    auto mark = [this, &pending](slot_t value) {
+        // the string literals are never collected
+        if (value < _literalsEnd || value >= _heapTop) {
+            return;
+        }
+        auto it = _heapObjects.upper_bound(value);
+        if (it == _heapObjects.begin()) {
+            return;
+        }
+        --it;
+        if (value < it->first + it->second.size && !it->second.marked) {
+            it->second.marked = true;
+            pending.push_back(it);
+        }
+    };
+    auto scan = [this, &mark](addr_t addr, addr_t size) {
+        for (auto p = toHeapPtr(addr), ed = p + size; p != ed; ++p) {
+            mark(*p);
+        }
+    };
+    for (addr_t i = 0; i < _sp; ++i) {
+        mark(_stack[i]);
+    }
+    for (auto it = _heapObjects.begin(); it != _heapObjects.end() && it->first < _literalsEnd; ++it) {
+        scan(it->first, it->second.size);
+    }
+    while (!pending.empty()) {
+        auto it = pending.back();
+        pending.pop_back();
+        scan(it->first, it->second.size);
+    }
+
+    _freeBlocks.clear();
+    addr_t end = _literalsEnd;
+    addr_t live = 0;
+    for (auto it = _heapObjects.lower_bound(_literalsEnd); it != _heapObjects.end(); ) {
+        if (!it->second.marked) {
+            it = _heapObjects.erase(it);
+            continue;
+        }
+        it->second.marked = false;
+        if (it->first > end) {
+            _freeBlocks.emplace(it->first - end, end);
+        }
+        end = it->first + it->second.size;
+        live += it->second.size;
+        ++it;
+    }
+    _heapTop = end;
+    // collect again once as much as survived has been allocated
+    _gcBudget = std::max(live, MIN_GC_GROWTH);
+    _allocatedSinceGC = 0;
+}
+
 void VM::DUP() {
     ensureStackUsed(1);
-    ensureStackRest(1);
     _stack[_sp] = _stack[_sp-1];
     ++_sp;
 }
 
 void VM::DUP2() {
     ensureStackUsed(2);
-    ensureStackRest(2);
     _stack[_sp] = _stack[_sp-2];
     _stack[_sp+1] = _stack[_sp-1];
     _sp += 2;
@@ -242,19 +870,16 @@ double_t VM::POP<double_t>() {
 
 template<>
 void VM::PUSH<char_t>(char_t value) {
-    ensureStackRest(1);
     _stack[_sp++] = 0x000000ff & value;
 }
 
 template<>
 void VM::PUSH<int_t>(int_t value) {
-    ensureStackRest(1);
     _stack[_sp++] = value;
 }
 
 template<>
 void VM::PUSH<double_t>(double_t val) {
-    ensureStackRest(2);
     double_t* p = reinterpret_cast<double_t*>(_stack.get() + _sp);
     *p = val;
     _sp += 2;
@@ -291,64 +916,96 @@ void VM::WRITE<double_t>(addr_t addr, double_t value) {
     *reinterpret_cast<double_t*>(checkAddr(addr, 2)) = value;
 }
 
-void VM::JUMP(u2 offset) {
-    if (0 > offset || offset >= _currentInstructions.size()) {
+void VM::JUMP(u4 offset) {
+    if (0 > offset || offset >= _currentCode.size) {
         throw InvalidControlTransfer();
     }
+    // every loop goes through a backward jump
+    if (static_cast<addr_t>(offset) <= _ip && _counterInstruction >= _nextCheck.load(std::memory_order_relaxed)) {
+        checkLimits();
+    }
     this->_ip = offset - 1;
 }
 
-void VM::CALL(u2 index) {
-    if (0 > index || index >= this->_file.functions.size()) {
-        throw InvalidControlTransfer();
-    }
-    Function& calledFunction = this->_file.functions.at(index);
-    Context newContext;
-    newContext.functionIndex = index;
-    newContext.functionName = std::get<str_t>(this->_file.constants.at(calledFunction.nameIndex).value);
-
-    newContext.functionLevel = calledFunction.level;
-    int newLv = newContext.functionLevel;
-    int curLv = _contexts.back().functionLevel;
-    if (newLv == curLv + 1) {
-        newContext.staticLink = _contexts.size()-1;
+void VM::CALL(u4 index) {
+    if (_counterInstruction >= _nextCheck.load(std::memory_order_relaxed)) {
+        checkLimits();
     }
-    else if (newLv <= curLv) {
-        int staticLink = _contexts.back().staticLink;
-        for (; curLv > newLv; --curLv) {
-            staticLink = _contexts.at(staticLink).staticLink;
-        }
-        newContext.staticLink = staticLink;
+    if (index >= _callees.size()) {
+        throw InvalidControlTransfer();
     }
-    else {
+    Callee& callee = _callees[index];
+    int newLv = callee.level;
+    int curLv = _contexts.back().function->level;
+    // the levels below newLv in the display are already the static chain of the callee
+    if (newLv > curLv + 1) {
         throw InvalidControlTransfer();
     }
+    ensureStackUsed(callee.paramSize);
+    if (!callee.code.code) {
+        codeOf(index);
+    }
+    Context newContext;
     newContext.prevBP = this->_bp;
     newContext.prevPC = this->_ip;
-    ensureStackUsed(calledFunction.paramSize);
-    this->_bp = this->_sp - calledFunction.paramSize;
+    this->_bp = this->_sp - callee.paramSize;
     newContext.prevSP = this->_bp;
     newContext.BP = this->_bp;
+    newContext.prevDisplay = _display[newLv];
+    newContext.function = &callee;
+    _display[newLv] = this->_bp;
     _contexts.push_back(newContext);
     this->_ip = -1;
-    this->_currentInstructions = calledFunction.instructions;
+    this->_currentCode = callee.code;
+}
+
+// the arguments replace the frame of the current function,
+// the callee returns to where the current function would have returned,
+// so the stack and the contexts do not grow however deep the tail calls go
+void VM::TAILCALL(u4 index) {
+    if (_counterInstruction >= _nextCheck.load(std::memory_order_relaxed)) {
+        checkLimits();
+    }
+    if (index >= _callees.size() || _contexts.size() <= 1) {
+        throw InvalidControlTransfer();
+    }
+    Callee& callee = _callees[index];
+    Context& context = _contexts.back();
+    int newLv = callee.level;
+    int curLv = context.function->level;
+    // a callee nested in the current function needs the frame as its static link
+    if (newLv > curLv) {
+        throw InvalidControlTransfer();
+    }
+    ensureStackUsed(callee.paramSize);
+    if (!callee.code.code) {
+        codeOf(index);
+    }
+    std::copy(_stack.get() + (_sp - callee.paramSize), _stack.get() + _sp, _stack.get() + context.BP);
+    this->_sp = context.BP + callee.paramSize;
+    // leave the level of the current function as it was before the call, then enter the callee's
+    _display[curLv] = context.prevDisplay;
+    context.prevDisplay = _display[newLv];
+    _display[newLv] = context.BP;
+    context.function = &callee;
+    this->_ip = -1;
+    this->_currentCode = callee.code;
 }
 
 void VM::RET() {
+    if (_counterInstruction >= _nextCheck.load(std::memory_order_relaxed)) {
+        checkLimits();
+    }
     if (_contexts.size() <= 1) {
         throw InvalidControlTransfer();
     }
-    Context curContext = _contexts.back();
+    Context& curContext = _contexts.back();
+    _display[curContext.function->level] = curContext.prevDisplay;
     this->_sp = curContext.prevSP;
     this->_bp = curContext.prevBP;
     this->_ip = curContext.prevPC;
     _contexts.pop_back();
-    if (_contexts.size() != 1) {
-        this->_currentInstructions = _file.functions.at(_contexts.back().functionIndex).instructions;
-    }
-    else {
-        this->_currentInstructions = _file.start;
-    }
+    this->_currentCode = _contexts.back().function->code;
 }
 
 void VM::ipush(int_t value) {
@@ -367,11 +1024,11 @@ void VM::dup2() {
     DUP2();
 }
 
-void VM::loadc(u2 index) {
-    if (index < 0 || index >= _file.constants.size()) {
+void VM::loadc(u4 index) {
+    if (index < 0 || index >= _file->constants.size()) {
         throw;
     }
-    auto& constant = _file.constants.at(index);
+    auto& constant = _file->constants.at(index);
     switch (constant.type)
     {
     case Constant::Type::STRING: PUSH(_stringLiteralPool.at(index)); break;
@@ -381,12 +1038,10 @@ void VM::loadc(u2 index) {
     }
 }
 
-void VM::loada(u2 level_diff, addr_t offset) {
-    int staticLink = _contexts.size()-1;
-    for (int ld = level_diff; ld > 0; --ld) {
-        staticLink = _contexts.at(staticLink).staticLink;
-    }
-    addr_t bp = _contexts.at(staticLink).BP;
+void VM::loada(u4 level_diff, addr_t offset) {
+    // the static link of .start is itself, a longer chain ends at the globals
+    int level = _contexts.back().function->level;
+    addr_t bp = level_diff > level ? 0 : _display[level - level_diff];
     PUSH<addr_t>(bp+offset);
 }
 
@@ -396,6 +1051,8 @@ void VM::_new() {
 
 void VM::snew(addr_t count) {
     INC_SP(count);
+    // the stack is reused between runs, do not leak the previous values
+    std::fill_n(toStackPtr(_sp-count), count, 0);
 }
 
 template <typename T>
@@ -501,56 +1158,60 @@ void VM::T2T() {
     PUSH(static_cast<T2>(POP<T1>()));
 }
 
-void VM::jmp(u2 offset) {
+void VM::jmp(u4 offset) {
     JUMP(offset);
 }
 
-void VM::je(u2 offset) {
+void VM::je(u4 offset) {
     auto cond = POP<int_t>();
     if (cond == 0) {
         JUMP(offset);
     }
 }
 
-void VM::jne(u2 offset) {
+void VM::jne(u4 offset) {
     auto cond = POP<int_t>();
     if (cond != 0) {
         JUMP(offset);
     }
 }
 
-void VM::jl(u2 offset) {
+void VM::jl(u4 offset) {
     auto cond = POP<int_t>();
     if (cond < 0) {
         JUMP(offset);
     }
 }
 
-void VM::jge(u2 offset) {
+void VM::jge(u4 offset) {
     auto cond = POP<int_t>();
     if (cond >= 0) {
         JUMP(offset);
     }
 }
 
-void VM::jg(u2 offset) {
+void VM::jg(u4 offset) {
     auto cond = POP<int_t>();
     if (cond > 0) {
         JUMP(offset);
     }
 }
 
-void VM::jle(u2 offset) {
+void VM::jle(u4 offset) {
     auto cond = POP<int_t>();
     if (cond <= 0) {
         JUMP(offset);
     }
 }
 
-void VM::call(u2 index) {
+void VM::call(u4 index) {
     CALL(index);
 }
 
+void VM::tailcall(u4 index) {
+    TAILCALL(index);
+}
+
 template <typename T>
 void VM::Tret() {
     auto rtv = POP<T>();
@@ -567,29 +1228,46 @@ template <typename T>
 void VM::Tprint() {
     auto value = POP<T>();
     if constexpr (std::is_floating_point_v<T>) {
-        std::cout << std::fixed << std::setprecision(6) << value;
+        *_out << std::fixed << std::setprecision(6) << value;
     }
     else if constexpr (std::is_integral_v<T>) {
-        std::cout << value;
+        *_out << value;
     }
 }
 
 void VM::sprint() {
     auto str = POP<addr_t>();
-    // std::cout << reinterpret_cast<const char*>(str);
+    // *_out << reinterpret_cast<const char*>(str);
     char_t ch;
     while ((ch = READ<char_t>(str++)) != '\0') {
-        std::cout << ch;
+        *_out << ch;
     }
 }
 
 void VM::printl() {
-    std::cout << std::endl;
+    *_out << std::endl;
 }
 
 template <typename T>
 void VM::Tscan() {
-    if (T value; std::cin >> value) {
+    if (_resumable) {
+        auto end = inputReady(!std::is_same_v<T, char_t>);
+        if (end == std::string::npos) {
+            throw NeedsInput();
+        }
+        T value;
+        {
+            // the token can not go on past end, the stream stops where reading from _in would
+            std::istringstream in(_input.substr(_inputPos, end - _inputPos));
+            if (!(in >> value)) {
+                throw IOError();
+            }
+            _inputPos = in.eof() ? end : _inputPos + static_cast<std::size_t>(in.tellg());
+        }
+        // a push onto the guard page leaves with siglongjmp, which would skip the destructor of the stream
+        PUSH(value);
+    }
+    else if (T value; *_in >> value) {
         PUSH(value);
     }
     else {
@@ -597,9 +1275,8 @@ void VM::Tscan() {
     }
 }
 
-void VM::executeInstruction(const Instruction& ins) {
-    //println(std::cout, "execute", ins);
-    switch (ins.op)
+void VM::executeInstruction(const Code& ins) {
+    switch (static_cast<OpCode>(ins.op))
     {
     case OpCode::nop: break;
     case OpCode::bipush:
@@ -610,7 +1287,9 @@ void VM::executeInstruction(const Instruction& ins) {
     case OpCode::dup:     dup();        break;
     case OpCode::dup2:    dup2();       break;
     case OpCode::loadc:   loadc(ins.x); break;
-    case OpCode::loada:   loada(ins.x, ins.y);break;
+    case OpCode::loada:
+        loada(ins.x, ins.y != Code::FAR_OFFSET ? ins.y : instructionAt(_contexts.back().function->index, _ip).y);
+        break;
     case OpCode::_new:    _new();       break;
     case OpCode::snew:    snew(ins.x);  break;
     
@@ -655,6 +1334,7 @@ void VM::executeInstruction(const Instruction& ins) {
     case OpCode::jle:     jle(ins.x);   break;
 
     case OpCode::call:    call(ins.x);      break;
+    case OpCode::tailcall: tailcall(ins.x); break;
     case OpCode::ret:     Tret<void>();     break;
     case OpCode::iret:    Tret<int_t>();    break;
     case OpCode::dret:    Tret<double_t>(); break;
@@ -6,7 +6,15 @@
 #include "./constant.h"
 #include "./function.h"
 #include "./file.h"
+#include "./trace.h"
+#include "./image.h"
+#include "./snapshot.h"
+#include "./profiler.h"
 
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
 #include <memory>
 #include <cstdint>
 #include <string>
@@ -16,6 +24,25 @@
 namespace vm {
 
 class VM {
+public:
+    enum class Status {
+        FINISHED,
+        // a scan found no complete token in the input fed so far, resume() retries it
+        NEEDS_INPUT,
+        // a runtime error was reported to the error stream
+        FAILED,
+    };
+
+    // the limits of a run, 0 for none, going over one is a ResourceExhausted runtime error
+    struct Limits {
+        // checked at backward jumps, calls and returns only, a run goes over by less than a function
+        u8 instructions = 0;
+        // from the end of the string literals to the end of the highest object
+        u8 heapBytes = 0;
+        // the time spent running since start(), checked along with the instructions
+        std::chrono::milliseconds time{0};
+    };
+
 private:
     static const addr_t MIN_STACK_ADDR;
     static const addr_t MAX_STACK_ADDR;
@@ -23,58 +50,195 @@ private:
     static const addr_t MIN_HEAP_ADDR;
     static const addr_t MAX_HEAP_ADDR;
     static const addr_t MAX_HEAP_SIZE;
+    static const addr_t MIN_GC_GROWTH;
+    static const u8 TIME_CHECK_INTERVAL;
 
 private:
     bool prepared;
-    File _file;
+    Status _status;
+    std::shared_ptr<const File> _file;
+    // .start followed by the call of main
+    std::vector<Instruction> _start;
+    std::istream* _in;
+    std::ostream* _out;
+    std::ostream* _err;
     //std::vector<std::shared_ptr<Stack>> stacks;
-    std::unique_ptr<slot_t[]> _stack;
+    struct StackUnmapper {
+        StackUnmapper() : base(nullptr), size(0) {}
+        StackUnmapper(void* base, std::size_t size) : base(base), size(size) {}
+        void operator()(slot_t*) const;
+        void* base;
+        std::size_t size;
+    };
+    // followed by a guard page, a push past MAX_STACK_ADDR faults and becomes a StackOverflow
+    std::unique_ptr<slot_t[], StackUnmapper> _stack;
     std::unique_ptr<slot_t[]> _heap;
-    std::vector<std::pair<addr_t, addr_t>> _heapRecord;
+    struct HeapObject {
+        addr_t size;
+        bool marked;
+    };
+    // the objects on the heap by address, the string literals come first and end at _literalsEnd
+    std::map<addr_t, HeapObject> _heapObjects;
+    addr_t _literalsEnd;
+    // objects are bumped from here when no free block fits
+    addr_t _heapTop;
+    // with the collector, the gaps between the objects that survived the last collection, by size
+    std::multimap<addr_t, addr_t> _freeBlocks;
+    bool _gc;
+    // the collector runs once this much has been allocated since the last collection
+    addr_t _gcBudget;
+    addr_t _allocatedSinceGC;
     addr_t _sp;
     addr_t _bp;
     addr_t _ip;
-    int _counterInstruction;
+    u8 _counterInstruction;
     // int _counterMicroIns;
     
+    struct CodeRange {
+        const Code* code;
+        u4 size;
+    };
+    // what a call needs to know about a function, linked once by make_vm so that
+    // a call neither looks the function up in the file nor copies its name
+    struct Callee {
+        // translated on the first call unless it is mapped from an Image
+        CodeRange code;
+        int index; // -1 for .start
+        addr_t paramSize;
+        u2 level;
+        const str_t* name;
+    };
     struct Context {
         addr_t prevPC;
         addr_t prevSP;
         addr_t prevBP;
         addr_t BP;
-        int staticLink; // index in contexts
-        int functionIndex;
-        std::string functionName;
-        vm::u2 functionLevel;
+        addr_t prevDisplay; // the display entry of the level of function before the call
+        const Callee* function;
     };
     std::vector<Context> _contexts;
-    std::vector<Instruction> _currentInstructions;
-    std::unordered_map<vm::u2, addr_t> _stringLiteralPool;
+    // the BP of the innermost active frame of every level, the static chain of
+    // the running function is _display[0.._contexts.back().function->level]
+    std::vector<addr_t> _display;
+    std::unordered_map<vm::u4, addr_t> _stringLiteralPool;
+    std::unique_ptr<Tracer> _tracer;
+
+    // the code of .start and of every function, the translated code lives in _translated
+    std::vector<Code> _startCode;
+    std::vector<std::vector<Code>> _translated;
+    Callee _startCallee;
+    std::vector<Callee> _callees;
+    CodeRange _currentCode;
+    std::shared_ptr<const Image> _image;
+    // where every start() begins if .start has been snapshotted
+    std::shared_ptr<const Snapshot> _snapshot;
+    // with resumable input, scan reads the bytes given to feed() from _input[_inputPos..]
+    bool _resumable;
+    std::string _input;
+    std::size_t _inputPos;
+    bool _inputClosed;
+    Limits _limits;
+    // checkLimits() runs at the first backward jump, call or return once _counterInstruction
+    // gets here, the SIGPROF handler sets it to 0 to have a sample taken there
+    std::atomic<u8> _nextCheck;
+    std::chrono::steady_clock::time_point _deadline;
+    std::chrono::steady_clock::duration _timeLeft;
+    // where the heap limit ends the heap
+    addr_t _heapEnd;
+    std::shared_ptr<Profiler> _profiler;
+    // the instruction noted by the SIGPROF handler, the rest of the sample is taken at the next check
+    std::atomic<bool> _samplePending;
+    const Code* _sampleCode;
+    addr_t _sampleIp;
+    std::vector<int> _sampleFrames;
     
 public:
-    VM(File) noexcept;
+    VM(std::shared_ptr<const File>) noexcept;
     VM(const VM&) = delete;
     VM(VM&&) = delete;
     VM& operator=(VM) = delete;
 
 public:
     static std::unique_ptr<VM> make_vm(File file);
-    void start();
+    // the file is never modified, it can be shared between instances and threads
+    static std::unique_ptr<VM> make_vm(std::shared_ptr<const File> file);
+    // nothing is decoded, translated or laid out again, the code is executed where it is mapped
+    static std::unique_ptr<VM> make_vm(std::shared_ptr<const Image> image);
+    // translate every function and write them with what make_vm found out about the file,
+    // InvalidFile if a function is malformed, see Image for the layout
+    void saveImage(std::ostream& out, const std::string& key);
+    Status start();
+    // run .start alone, which must neither read nor write nor call a function that does, and save
+    // what it leaves on the stack and the heap, every start() from then on begins at the call of main
+    // with that state;
+    // InvalidFile if .start does I/O or fails, see Snapshot for the layout
+    void saveSnapshot(std::ostream& out, const std::string& key);
+    // every start() begins from the snapshot in the file, false if it is not one
+    // that saveSnapshot wrote for this program with the key
+    bool restoreSnapshot(const std::string& path, const std::string& key);
+    // continue a run that stopped with NEEDS_INPUT, the status of the last run otherwise
+    Status resume();
+    // get ready for another run of the same program,
+    // the stack, the heap and the string literal pool are kept allocated
+    void reset();
+    // the number of instructions the last run executed, .start included
+    u8 executed() const { return _counterInstruction; }
+    // std::cin, std::cout and std::cerr by default
+    void setIO(std::istream& in, std::ostream& out, std::ostream& err);
+    // record every executed instruction, nullptr to disable
+    void setTracer(std::unique_ptr<Tracer> tracer);
+    // reclaim the heap objects nothing points to when the heap grows, disabled by default
+    // the stack and the live objects are scanned conservatively: any slot that holds the
+    // address of an object or of a slot inside it keeps it alive, the string literals always are
+    void setGC(bool enabled);
+    // applied from the next start()
+    void setLimits(const Limits& limits);
+    // scan reads what is given to feed() instead of the input stream, and a scan that would
+    // have to wait for more input stops the run with NEEDS_INPUT instead of blocking,
+    // so that one thread can drive many VMs. Enabling it discards the input fed so far,
+    // reset() does not, input can be fed before start()
+    void setResumable(bool enabled);
+    void feed(const char* data, std::size_t size);
+    // no more input will be fed, scan reads up to the end and then fails
+    void closeInput();
+    // record samples of the runs in the profiler from the next start() or resume(), nullptr to
+    // disable; the profiler can be shared between instances and threads. start() and resume()
+    // throw std::system_error if the timer of the samples can not be created
+    void setProfiler(std::shared_ptr<Profiler> profiler);
+    // the SIGPROF handler, installed by Profiler::Timer
+    static void onProfilingTimer(int);
 
 private: 
     void init() noexcept;
+    void allocate();
+    void enterStart();
+    bool accepts(const Snapshot& snapshot) const;
+    void restore();
     void buildStringLiteralPool();
-    void run();
+    void fillStringLiteralPool();
+    Status run();
+    void execute();
+    std::size_t inputReady(bool wholeToken) const;
+    void checkLimits();
+    void scheduleCheck();
+    void takeSample();
     void ensureStackRest(addr_t count);
     void ensureStackUsed(addr_t count);
     slot_t* checkAddr(addr_t addr, addr_t count);
     slot_t* toHeapPtr(addr_t);
     slot_t* toStackPtr(addr_t);
     void printStackTrace(std::ostream&);
+    void link();
+    static std::vector<Code> compact(const std::vector<Instruction>&);
+    CodeRange codeOf(u4 index);
+    // the Instruction at pc of a function, -1 for .start
+    const Instruction& instructionAt(int functionIndex, addr_t pc) const;
 
     void    DEC_SP(addr_t count);
     void    INC_SP(addr_t count);
     addr_t  NEW(addr_t count);
+    addr_t  takeFreeBlock(addr_t count);
+    void    collect();
     void    DUP();
     void    DUP2();
     template<typename T>
@@ -86,18 +250,19 @@ private:
     template<typename T>
     void    WRITE(addr_t addr, T value);
 
-    void    JUMP(u2 offset);
-    void    CALL(u2 index);
+    void    JUMP(u4 offset);
+    void    CALL(u4 index);
+    void    TAILCALL(u4 index);
     void    RET();
 
 private:
-    void executeInstruction(const Instruction&);
+    void executeInstruction(const Code&);
 
     void ipush(int_t value);
     void popn(addr_t count);
     void dup(); void dup2();
-    void loadc(u2 index);
-    void loada(u2 level_diff, addr_t offset);
+    void loadc(u4 index);
+    void loada(u4 level_diff, addr_t offset);
     
     void _new();
     void snew(addr_t count);
@@ -127,12 +292,13 @@ private:
     template <typename T1, typename T2>
     void T2T();
 
-    void jmp(u2 offset);
-    void je(u2 offset); void jne(u2 offset); 
-    void jl(u2 offset); void jge(u2 offset); 
-    void jg(u2 offset); void jle(u2 offset);
+    void jmp(u4 offset);
+    void je(u4 offset); void jne(u4 offset); 
+    void jl(u4 offset); void jge(u4 offset); 
+    void jg(u4 offset); void jle(u4 offset);
 
-    void call(u2 index);
+    void call(u4 index);
+    void tailcall(u4 index);
     template <typename T>
     void Tret();
     
@@ -0,0 +1,200 @@
+#include "compileCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "fmt/core.h"
+#include "sha256.h"
+
+namespace miniplc0 {
+
+    namespace fs = std::filesystem;
+
+    namespace {
+
+        bool isMemo(const fs::directory_entry& entry) {
+            return entry.path().filename().string().front() == '.';
+        }
+
+        // 缓存项的第一行：key 和后面输出的字节数
+        std::string entryHeader(const std::string& key, std::size_t size) {
+            return fmt::format("{} {}\n", key, size);
+        }
+
+    }
+
+    CompileCache::CompileCache(fs::path directory, std::uintmax_t maxBytes, std::string compilerId)
+            : directory(std::move(directory)), maxBytes(maxBytes), compilerId(std::move(compilerId)),
+              totalBytes(0), hits(0), misses(0), evictions(0) {
+        fs::create_directories(this->directory);
+        for (auto& entry : fs::directory_iterator(this->directory)) {
+            if (entry.is_regular_file() && !isMemo(entry)) {
+                totalBytes += entry.file_size();
+            }
+        }
+    }
+
+    std::string CompileCache::fingerprint(const fs::path& executable, const fs::path& memo) {
+        // 路径、大小和修改时间都没变就认为还是同一个可执行文件，不用每次都把它整个 hash 一遍
+        std::error_code ec;
+        auto path = fs::canonical(executable, ec);
+        if (ec) {
+            return {};
+        }
+        auto size = fs::file_size(path, ec);
+        auto mtime = ec ? fs::file_time_type{} : fs::last_write_time(path, ec);
+        if (ec) {
+            return {};
+        }
+        auto stamp = fmt::format("{}\n{}\n{}\n", path.string(), size, mtime.time_since_epoch().count());
+        if (!memo.empty()) {
+            std::ifstream in(memo, std::ios::binary);
+            std::string saved((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (saved.size() == stamp.size() + 64 && saved.compare(0, stamp.size(), stamp) == 0) {
+                return saved.substr(stamp.size());
+            }
+        }
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return {};
+        }
+        Sha256 sha;
+        std::vector<char> chunk(1 << 16);
+        while (in.read(chunk.data(), static_cast<std::streamsize>(chunk.size())) || in.gcount() > 0) {
+            sha.update(std::string_view(chunk.data(), static_cast<std::size_t>(in.gcount())));
+        }
+        auto digest = sha.hex();
+        if (!memo.empty()) {
+            // 写坏了或者没写成也只是下次再算一遍
+            std::ostringstream tid;
+            tid << std::this_thread::get_id();
+            auto tmp = memo;
+            tmp += ".tmp" + tid.str();
+            fs::create_directories(memo.parent_path(), ec);
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (out << stamp << digest && (out.close(), out)) {
+                fs::rename(tmp, memo, ec);
+            }
+            if (ec || !out) {
+                fs::remove(tmp, ec);
+            }
+        }
+        return digest;
+    }
+
+    std::string CompileCache::key(const std::string& source, const std::string& flags) const {
+        // 用 '\0' 分隔，避免 flags 和源代码拼接出相同的串
+        return Sha256().update(compilerId).update(std::string(1, '\0') + flags + '\0').update(source).hex();
+    }
+
+    std::optional<std::string> CompileCache::lookup(const std::string& key) {
+        auto path = directory / key;
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            ++misses;
+            return {};
+        }
+        std::string output((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        // 别的 key 的输出、写了一半或者被改过的文件都不能当作这份源代码的输出
+        auto end = output.find('\n');
+        if (end == std::string::npos || output.compare(0, end + 1, entryHeader(key, output.size() - end - 1)) != 0) {
+            ++misses;
+            return {};
+        }
+        output.erase(0, end + 1);
+        // 更新最近使用时间，别的进程恰好把它淘汰了也无所谓
+        std::error_code ec;
+        fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+        ++hits;
+        return output;
+    }
+
+    std::optional<fs::path> CompileCache::locate(const std::string& key) {
+        auto path = this->path(key);
+        std::error_code ec;
+        if (!fs::is_regular_file(path, ec)) {
+            ++misses;
+            return {};
+        }
+        fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+        ++hits;
+        return path;
+    }
+
+    void CompileCache::store(const std::string& key, const std::string& output) {
+        storeFile(key, entryHeader(key, output.size()) + output);
+    }
+
+    void CompileCache::storeFile(const std::string& key, const std::string& output) {
+        // 先写临时文件再 rename，其他进程不会读到写了一半的缓存
+        std::ostringstream tid;
+        tid << std::this_thread::get_id();
+        auto path = directory / key;
+        auto tmp = directory / (key + ".tmp" + tid.str());
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out || !out.write(output.data(), output.size())) {
+                std::error_code ec;
+                fs::remove(tmp, ec);
+                return;
+            }
+        }
+        // 覆盖已有的 key 时旧文件不再占空间，不减掉的话总大小会越算越大，提前淘汰
+        std::error_code ec;
+        auto replaced = fs::file_size(path, ec);
+        if (ec) {
+            replaced = 0;
+        }
+        fs::rename(tmp, path, ec);
+        if (ec) {
+            fs::remove(tmp, ec);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        totalBytes -= std::min(totalBytes, replaced);
+        totalBytes += output.size();
+        if (totalBytes > maxBytes) {
+            evict();
+        }
+    }
+
+    // 淘汰最久没有使用的，直到缓存目录只占上限的 3/4，免得每次 store 都要扫描目录
+    void CompileCache::evict() {
+        std::vector<std::pair<fs::file_time_type, fs::directory_entry>> entries;
+        std::uintmax_t total = 0;
+        std::error_code ec;
+        for (auto& entry : fs::directory_iterator(directory, ec)) {
+            if (entry.is_regular_file(ec) && !isMemo(entry)) {
+                entries.emplace_back(entry.last_write_time(ec), entry);
+                total += entry.file_size(ec);
+            }
+        }
+        std::sort(entries.begin(), entries.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+        auto target = maxBytes / 4 * 3;
+        for (auto& [time, entry] : entries) {
+            if (total <= target) {
+                break;
+            }
+            auto size = entry.file_size(ec);
+            if (fs::remove(entry.path(), ec)) {
+                total -= size;
+                ++evictions;
+            }
+        }
+        totalBytes = total;
+    }
+
+    void CompileCache::printStatistics(std::ostream& out) const {
+        out << fmt::format("cache: {} hits, {} misses, {} evicted\n", hits.load(), misses.load(), evictions.load());
+    }
+
+}
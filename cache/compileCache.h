@@ -0,0 +1,60 @@
+#ifndef CC0_COMPILECACHE_H
+#define CC0_COMPILECACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+
+// 编译缓存
+// 以 源代码 + 编译器 + 编译选项 的 hash 为 key，缓存 .s0 / .o0 的输出
+// 每个 key 对应缓存目录下的一个文件，文件的修改时间就是最近一次使用的时间
+namespace miniplc0 {
+
+    class CompileCache {
+
+    public:
+        // 超过 maxBytes 之后按最近最少使用淘汰
+        CompileCache(std::filesystem::path directory, std::uintmax_t maxBytes, std::string compilerId);
+
+        // 编译器可执行文件的 SHA-256，编译器重新编译之后旧的缓存自然失效
+        // memo 不为空的话把结果连同路径、大小和修改时间记在里面，文件没变就直接用
+        static std::string fingerprint(const std::filesystem::path& executable, const std::filesystem::path& memo = {});
+        // 缓存目录下的 memo，以 '.' 开头的文件不是缓存项
+        static constexpr const char* memoName = ".fingerprint";
+        const std::string& id() const { return compilerId; }
+        std::string key(const std::string& source, const std::string& flags) const;
+
+        // 命中的话返回之前的输出，缓存项开头记着 key 和输出的长度，对不上的算没命中
+        std::optional<std::string> lookup(const std::string& key);
+        void store(const std::string& key, const std::string& output);
+        // 原样保存，给自己带着 key 的文件用（VM 的映像），由 locate 找到后调用者自己校验
+        void storeFile(const std::string& key, const std::string& bytes);
+        // key 对应的缓存文件，不管存不存在
+        std::filesystem::path path(const std::string& key) const { return directory / key; }
+        // 命中的话返回缓存文件的路径，不读出内容，由调用者直接映射
+        std::optional<std::filesystem::path> locate(const std::string& key);
+
+        void printStatistics(std::ostream& out) const;
+
+    private:
+        void evict();
+
+    private:
+        std::filesystem::path directory;
+        std::uintmax_t maxBytes;
+        std::string compilerId;
+        // 缓存目录的总大小
+        std::uintmax_t totalBytes;
+        std::mutex mutex;
+        std::atomic<std::uint64_t> hits;
+        std::atomic<std::uint64_t> misses;
+        std::atomic<std::uint64_t> evictions;
+    };
+
+}
+
+#endif //CC0_COMPILECACHE_H
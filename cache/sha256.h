@@ -0,0 +1,35 @@
+#ifndef CC0_SHA256_H
+#define CC0_SHA256_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// SHA-256，缓存和快照的 key 用它，64 位的 hash 碰撞了就会拿到别的程序的输出
+namespace miniplc0 {
+
+    class Sha256 {
+
+    public:
+        Sha256();
+
+        // 可以分多次喂进去，结果和拼起来一次算一样
+        Sha256& update(std::string_view data);
+        // 64 个十六进制字符，之后不能再 update
+        std::string hex();
+
+    private:
+        void compress(const unsigned char* block);
+
+    private:
+        std::array<std::uint32_t, 8> state;
+        unsigned char buffer[64];
+        std::size_t buffered;
+        std::uint64_t length;
+    };
+
+}
+
+#endif //CC0_SHA256_H
@@ -0,0 +1,320 @@
+#include "codeGenerator.h"
+
+#include <utility>
+
+namespace miniplc0 {
+
+    namespace {
+        // 每个操作数在二进制文件中的字节数
+        std::vector<int> operandWidths(Operation opr) {
+            switch (opr) {
+                case Operation::BIPUSH:
+                    return {1};
+                case Operation::IPUSH:
+                case Operation::POPN:
+                case Operation::SNEW:
+                case Operation::CALL:
+                case Operation::TAILCALL:
+                    return {4};
+                case Operation::LOADA:
+                    return {2, 4};
+                case Operation::JMP:
+                case Operation::JE:
+                case Operation::JNE:
+                case Operation::JL:
+                case Operation::JGE:
+                case Operation::JG:
+                case Operation::JLE:
+                    return {2};
+                default:
+                    return {};
+            }
+        }
+
+        // 条件不成立时的跳转
+        Operation negatedJump(TokenType op) {
+            switch (op) {
+                case TokenType::IS_EQUAL_SIGN:
+                    return Operation::JNE;
+                case TokenType::NOT_EQUAL_SIGN:
+                    return Operation::JE;
+                case TokenType::LESS_THAN_SIGN:
+                    return Operation::JGE;
+                case TokenType::LESS_OR_EQUAL_SIGN:
+                    return Operation::JG;
+                case TokenType::MORE_THAN_SIGN:
+                    return Operation::JLE;
+                case TokenType::MORE_OR_EQUAL_SIGN:
+                    return Operation::JL;
+                default:
+                    return Operation::JMP;
+            }
+        }
+
+        // 条件成立时的跳转
+        Operation jump(TokenType op) {
+            switch (op) {
+                case TokenType::IS_EQUAL_SIGN:
+                    return Operation::JE;
+                case TokenType::NOT_EQUAL_SIGN:
+                    return Operation::JNE;
+                case TokenType::LESS_THAN_SIGN:
+                    return Operation::JL;
+                case TokenType::LESS_OR_EQUAL_SIGN:
+                    return Operation::JLE;
+                case TokenType::MORE_THAN_SIGN:
+                    return Operation::JG;
+                case TokenType::MORE_OR_EQUAL_SIGN:
+                    return Operation::JGE;
+                default:
+                    return Operation::JMP;
+            }
+        }
+    }
+
+    std::vector<Instruction> CodeGenerator::generate(const Program& program) {
+        _instructions.clear();
+        _offset = 0;
+        for (auto global : program.globals)
+            generateStatement(global);
+        // 分界
+        Instruction divide;
+        divide.setOffsetNum(0);
+        _instructions.push_back(divide);
+        for (auto function : program.functions) {
+            _offset = 0;
+            if (_passes && _passes->level() > 0) {
+                auto graph = ControlFlowGraph::build(*function, *_arena);
+                _passes->run(graph);
+                auto begin = _instructions.size();
+                generateGraph(graph);
+                // 窥孔优化只看这个函数的指令
+                std::vector<Instruction> code(_instructions.begin() + static_cast<std::ptrdiff_t>(begin), _instructions.end());
+                _passes->run(code);
+                _instructions.resize(begin);
+                _instructions.insert(_instructions.end(), code.begin(), code.end());
+                continue;
+            }
+            generateStatement(function->body);
+            // 如果没有return 也要ret
+            emit(function->isVoid ? Operation::RET : Operation::IRET);
+        }
+        return std::move(_instructions);
+    }
+
+    void CodeGenerator::generateGraph(const ControlFlowGraph& graph) {
+        auto count = static_cast<int>(graph.blocks.size());
+        std::vector<int> starts(count);
+        // 跳转指令和它要去的基本块
+        std::vector<std::pair<std::size_t, int>> fixups;
+        for (int b = 0; b < count; b++) {
+            auto& block = graph.blocks[b];
+            starts[b] = _offset;
+            std::size_t i = 0;
+            if (b == 0) {
+                // 临时变量的空间在所有局部变量之后
+                for (; i < block.statements.size() && block.statements[i]->kind == Statement::Kind::Declaration; i++)
+                    generateStatement(block.statements[i]);
+                if (graph.temporaries > 0)
+                    emit(Operation::SNEW, {graph.temporaries});
+            }
+            for (; i < block.statements.size(); i++)
+                generateStatement(block.statements[i]);
+            switch (block.exit) {
+                case BasicBlock::Exit::Jump:
+                    // 目标紧跟在后面的话不用跳
+                    if (block.target != b + 1)
+                        fixups.emplace_back(emit(Operation::JMP), block.target);
+                    break;
+                case BasicBlock::Exit::Branch:
+                    if (block.target == b + 1)
+                        fixups.emplace_back(generateCondition(block.condition), block.otherwise);
+                    else {
+                        fixups.emplace_back(generateCondition(block.condition, true), block.target);
+                        if (block.otherwise != b + 1)
+                            fixups.emplace_back(emit(Operation::JMP), block.otherwise);
+                    }
+                    break;
+                case BasicBlock::Exit::Return:
+                    if (block.value)
+                        generateReturnValue(block.value);
+                    else
+                        emit(graph.isVoid ? Operation::RET : Operation::IRET);
+                    break;
+            }
+        }
+        for (auto& [index, target] : fixups)
+            patch(index, starts[target]);
+    }
+
+    void CodeGenerator::generateStatement(const Statement* statement) {
+        switch (statement->kind) {
+            case Statement::Kind::Block:
+                for (auto s : statement->body)
+                    generateStatement(s);
+                break;
+            case Statement::Kind::Declaration:
+                // 初始值就留在栈上作为这个变量的空间
+                if (statement->expression)
+                    generateExpression(statement->expression);
+                else
+                    emit(Operation::SNEW, {1});
+                break;
+            case Statement::Kind::If: {
+                auto jump = generateCondition(statement->condition);
+                generateStatement(statement->then);
+                if (statement->otherwise) {
+                    // 跳过 else 的部分
+                    patch(jump, _offset + 1);
+                    auto skip = emit(Operation::JMP);
+                    generateStatement(statement->otherwise);
+                    patch(skip, _offset);
+                }
+                else
+                    patch(jump, _offset);
+                break;
+            }
+            case Statement::Kind::While: {
+                int start = _offset;
+                auto jump = generateCondition(statement->condition);
+                generateStatement(statement->then);
+                patch(jump, _offset + 1);
+                emit(Operation::JMP, {start});
+                break;
+            }
+            case Statement::Kind::Return:
+                if (statement->expression)
+                    generateReturnValue(statement->expression);
+                else
+                    emit(Operation::RET);
+                break;
+            case Statement::Kind::Print: {
+                // 用空格分隔，最后输出一个换行
+                bool first = true;
+                for (auto e : statement->printables) {
+                    if (!first) {
+                        emit(Operation::BIPUSH, {32});
+                        emit(Operation::CPRINT);
+                    }
+                    first = false;
+                    generateExpression(e);
+                    emit(Operation::IPRINT);
+                }
+                if (!statement->printables.empty())
+                    emit(Operation::PRINTL);
+                break;
+            }
+            case Statement::Kind::Scan:
+                emit(Operation::LOADA, {statement->level, statement->offset});
+                emit(Operation::ISCAN);
+                emit(Operation::ISTORE);
+                break;
+            case Statement::Kind::Assign:
+                emit(Operation::LOADA, {statement->level, statement->offset});
+                generateExpression(statement->expression);
+                emit(Operation::ISTORE);
+                break;
+            case Statement::Kind::Call:
+                generateExpression(statement->expression);
+                break;
+        }
+    }
+
+    void CodeGenerator::generateExpression(const Expression* expression) {
+        switch (expression->kind) {
+            case Expression::Kind::Literal:
+                emitPush(expression->value);
+                break;
+            case Expression::Kind::Variable:
+                emit(Operation::LOADA, {expression->level, expression->offset});
+                emit(Operation::ILOAD);
+                break;
+            case Expression::Kind::Negate:
+                generateExpression(expression->lhs);
+                emit(Operation::INEG);
+                break;
+            case Expression::Kind::Binary:
+                generateExpression(expression->lhs);
+                generateExpression(expression->rhs);
+                switch (expression->op) {
+                    case TokenType::PLUS_SIGN:
+                        emit(Operation::IADD);
+                        break;
+                    case TokenType::MINUS_SIGN:
+                        emit(Operation::ISUB);
+                        break;
+                    case TokenType::MULTIPLICATION_SIGN:
+                        emit(Operation::IMUL);
+                        break;
+                    default:
+                        emit(Operation::IDIV);
+                        break;
+                }
+                break;
+            case Expression::Kind::Call:
+                for (auto argument : expression->arguments)
+                    generateExpression(argument);
+                emit(Operation::CALL, {expression->function});
+                break;
+        }
+    }
+
+    // return f(...) 是尾调用，f 复用当前的栈帧并直接返回到当前函数的调用者
+    void CodeGenerator::generateReturnValue(const Expression* value) {
+        if (value->kind == Expression::Kind::Call) {
+            for (auto argument : value->arguments)
+                generateExpression(argument);
+            emit(Operation::TAILCALL, {value->function});
+            return;
+        }
+        generateExpression(value);
+        emit(Operation::IRET);
+    }
+
+    std::size_t CodeGenerator::generateCondition(const Condition& condition, bool jumpIfTrue) {
+        generateExpression(condition.lhs);
+        if (!condition.rhs)
+            // 没有关系运算符的话 值为0的时候不成立
+            return emit(jumpIfTrue ? Operation::JNE : Operation::JE);
+        generateExpression(condition.rhs);
+        emit(Operation::ICMP);
+        return emit(jumpIfTrue ? jump(condition.op) : negatedJump(condition.op));
+    }
+
+    Instruction CodeGenerator::makeInstruction(Operation opr, std::vector<int> operand, int offset) {
+        std::vector<byte> binary_opr;
+        binary_opr.push_back(static_cast<byte>(opr));
+        std::vector<std::vector<byte>> binary_operand;
+        auto widths = operandWidths(opr);
+        for (std::size_t i = 0; i < operand.size(); i++)
+            binary_operand.push_back(changeToBinary(operand[i], widths[i]));
+        return Instruction(opr, std::move(binary_opr), std::move(operand), std::move(binary_operand), offset);
+    }
+
+    // 跳转指令的操作数先不给，等回填
+    std::size_t CodeGenerator::emit(Operation opr, std::vector<int> operand) {
+        _instructions.push_back(makeInstruction(opr, std::move(operand), _offset++));
+        return _instructions.size() - 1;
+    }
+
+    // 0~127 用 bipush
+    void CodeGenerator::emitPush(int32_t value) {
+        if (value >= 0 && value <= 127)
+            emit(Operation::BIPUSH, {value});
+        else
+            emit(Operation::IPUSH, {value});
+    }
+
+    void CodeGenerator::patch(std::size_t index, int target) {
+        _instructions[index].addOperand(target);
+        _instructions[index].addBinaryOperand(changeToBinary(target, 2));
+    }
+
+    std::vector<CodeGenerator::byte> CodeGenerator::changeToBinary(int operand, int length) {
+        std::vector<byte> bytes(length);
+        for (int i = length - 1; i >= 0; i--)
+            bytes[i] = (byte)(operand >> 8 * (length - i - 1));
+        return bytes;
+    }
+
+}
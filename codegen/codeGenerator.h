@@ -0,0 +1,60 @@
+#ifndef CC0_CODEGENERATOR_H
+#define CC0_CODEGENERATOR_H
+
+#include "analyser/arena.h"
+#include "analyser/ast.h"
+#include "instruction/instruction.h"
+#include "optimizer/cfg.h"
+#include "optimizer/passManager.h"
+
+#include <cstddef>
+#include <vector>
+
+// 目标代码生成
+// 遍历 Analyser 建好的语法树生成指令
+// 跳转指令生成的时候记下位置，目标确定之后直接回填
+// 开了优化的话每个函数先建控制流图，优化之后按基本块的顺序生成
+namespace miniplc0 {
+
+    class CodeGenerator final {
+    private:
+        using byte = unsigned char;
+
+    public:
+        CodeGenerator() : _passes(nullptr), _arena(nullptr), _offset(0) {}
+        // 优化时新建的结点分配在 arena 里
+        CodeGenerator(PassManager* passes, Arena* arena) : _passes(passes), _arena(arena), _offset(0) {}
+
+        // .start 的指令，一个分界，然后依次是每个函数的指令
+        // 每一段的第一条指令 offset_num 为 0
+        std::vector<Instruction> generate(const Program& program);
+
+        // 操作数按指令的格式转成二进制
+        static Instruction makeInstruction(Operation opr, std::vector<int> operand, int offset);
+
+    private:
+        void generateGraph(const ControlFlowGraph& graph);
+        void generateStatement(const Statement* statement);
+        void generateExpression(const Expression* expression);
+        void generateReturnValue(const Expression* value);
+        // 条件不成立（jumpIfTrue 的话是成立）的时候跳转，返回这条跳转指令的位置
+        std::size_t generateCondition(const Condition& condition, bool jumpIfTrue = false);
+
+        std::size_t emit(Operation opr, std::vector<int> operand = {});
+        void emitPush(int32_t value);
+        // 回填跳转的目标
+        void patch(std::size_t index, int target);
+
+        static std::vector<byte> changeToBinary(int operand, int length);
+
+    private:
+        PassManager* _passes;
+        Arena* _arena;
+        std::vector<Instruction> _instructions;
+        // 当前函数的第几条指令
+        int _offset;
+    };
+
+}
+
+#endif //CC0_CODEGENERATOR_H
@@ -455,6 +455,9 @@ namespace fmt {
                 case miniplc0::CALL:
                     name = "call";
                     break;
+                case miniplc0::TAILCALL:
+                    name = "tailcall";
+                    break;
                 case miniplc0::RET:
                     name = "ret";
                     break;
@@ -568,6 +571,7 @@ namespace fmt {
                 case miniplc0::JG:
                 case miniplc0::JLE:
                 case miniplc0::CALL:
+                case miniplc0::TAILCALL:
                     return format_to(ctx.out(), "{} {}", p.getOpr(), p.getOperand()[0]);
 
                 // 两个操作数
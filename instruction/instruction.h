@@ -72,6 +72,8 @@ namespace miniplc0 {
         JG = 0X75,
         JLE = 0X76,
         CALL = 0X80,
+        // 调用之后直接返回它的结果，被调用的函数复用当前的栈帧
+        TAILCALL = 0X81,
         RET = 0X88,
         IRET = 0X89,
         DRET = 0X8A,
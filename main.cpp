@@ -7,23 +7,42 @@
 #include "fmts.hpp"
 #include "c0-vm/file.h"
 #include "c0-vm/vm.h"
+#include "c0-vm/image.h"
+#include "c0-vm/regvm.h"
+#include "c0-vm/trace.h"
+#include "c0-vm/profiler.h"
 #include "c0-vm/exception.h"
 #include "c0-vm/util/print.hpp"
+#include "c0-vm/util/thread_pool.hpp"
+#include "cache/compileCache.h"
+#include "cache/sha256.h"
+#include "optimizer/passManager.h"
 
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <memory>
 #include <string>
 #include <exception>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <filesystem>
+#include <iterator>
+#include <algorithm>
+
+// thrown instead of exiting, so that a failing source does not stop the others
+class CompileFailure : public std::runtime_error {
+public:
+    explicit CompileFailure(const std::string& msg) : std::runtime_error(msg) {}
+};
 
 std::vector<miniplc0::Token> _tokenize(std::istream& input) {
     miniplc0::Tokenizer tkz(input);
     auto p = tkz.AllTokens();
-    if (p.second.has_value()) {
-        fmt::print(stderr, "Tokenization error: {}\n", p.second.value());
-        exit(2);
-    }
+    if (p.second.has_value())
+        throw CompileFailure(fmt::format("Tokenization error: {}", p.second.value()));
     return p.first;
 }
 
@@ -37,10 +56,8 @@ void Analyse(std::istream& input, std::ostream& output) {
     auto tks = _tokenize(input);
     miniplc0::Analyser analyser(tks);
     auto p = analyser.Analyse();
-    if (p.first.second.has_value()) {
-        fmt::print(stderr, "Syntactic analysis error: {}\n", p.first.second.value());
-        exit(2);
-    }
+    if (p.first.second.has_value())
+        throw CompileFailure(fmt::format("Syntactic analysis error: {}", p.first.second.value()));
 }
 
 std::string oprToString(miniplc0::Operation opr) {
@@ -64,6 +81,9 @@ std::string oprToString(miniplc0::Operation opr) {
         case miniplc0::POPN:
             s = "popn";
             break;
+        case miniplc0::DUP:
+            s = "dup";
+            break;
         case miniplc0::LOADC:
             s = "loadc";
             break;
@@ -124,6 +144,9 @@ std::string oprToString(miniplc0::Operation opr) {
         case miniplc0::CALL:
             s = "call";
             break;
+        case miniplc0::TAILCALL:
+            s = "tailcall";
+            break;
         case miniplc0::RET:
             s = "ret";
             break;
@@ -158,14 +181,13 @@ std::vector<char> changeToBinary(int operand, int length) {
 }
 
 // 汇编
-void translateToAssemblingFile(std::istream& input, std::ostream& output) {
+// passes 为空的话不优化
+void translateToAssemblingFile(std::istream& input, std::ostream& output, miniplc0::PassManager* passes = nullptr) {
     auto tks = _tokenize(input);
-    miniplc0::Analyser analyser(tks);
+    miniplc0::Analyser analyser(tks, passes);
     auto p = analyser.Analyse();
-    if (p.first.second.has_value()) {
-        fmt::print(stderr, "Syntactic analysis error: {}\n", p.first.second.value());
-        exit(2);
-    }
+    if (p.first.second.has_value())
+        throw CompileFailure(fmt::format("Syntactic analysis error: {}", p.first.second.value()));
 
     auto v = p.first.first; //vector<instruction>
     auto s = p.second.first; //constant
@@ -217,10 +239,8 @@ void translateToBinaryFile(std::istream& input, std::ostream& output) {
     auto tks = _tokenize(input);
     miniplc0::Analyser analyser(tks);
     auto p = analyser.Analyse();
-    if (p.first.second.has_value()) {
-        fmt::print(stderr, "Syntactic analysis error: {}\n", p.first.second.value());
-        exit(2);
-    }
+    if (p.first.second.has_value())
+        throw CompileFailure(fmt::format("Syntactic analysis error: {}", p.first.second.value()));
     // 输出常量表和函数表
     auto v = p.first.first; //instruction
     auto s = p.second.first; //constant
@@ -319,25 +339,338 @@ void translateToBinaryFile(std::istream& input, std::ostream& output) {
     }
 }
 
-void assemble_text(std::ifstream* in, std::ofstream* out, bool run = false) {
+// .c0 -> .s0 -> .o0, the assembly is kept in memory
+void translateToObjectFile(std::istream& input, std::ostream& output, miniplc0::PassManager* passes = nullptr) {
+    std::stringstream assembly;
+    translateToAssemblingFile(input, assembly, passes);
+    File f = File::parse_file_text(assembly);
+    // 优化的时候删掉不会被调用的函数和没用的常量
+    if (passes)
+        f.strip();
+    f.output_binary(output);
+}
+
+// .c0 -> .s0 or .o0, a cache hit skips the compilation
+// `flags` is every option that affects the output
+void translate(std::istream& input, std::ostream& output, bool binary, miniplc0::PassManager* passes,
+               miniplc0::CompileCache* cache, const std::string& flags) {
+    if (!cache) {
+        if (binary)
+            translateToObjectFile(input, output, passes);
+        else
+            translateToAssemblingFile(input, output, passes);
+        return;
+    }
+    std::string source((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    auto key = cache->key(source, flags);
+    if (auto hit = cache->lookup(key)) {
+        output << *hit;
+        return;
+    }
+    std::istringstream in(source);
+    std::ostringstream out;
+    if (binary)
+        translateToObjectFile(in, out, passes);
+    else
+        translateToAssemblingFile(in, out, passes);
+    cache->store(key, out.str());
+    output << out.str();
+}
+
+// compile every source listed in `list` on `jobs` threads,
+// `x.c0` is compiled into `x.s0` or `x.o0`, returns the number of failures
+int compile_batch(std::istream* list, bool binary, int jobs, miniplc0::PassManager* passes,
+                  miniplc0::CompileCache* cache, const std::string& flags) {
+    thread_pool pool(jobs);
+    std::mutex errMutex;
+    int failed = 0;
+    for (std::string input_file; std::getline(*list, input_file); ) {
+        if (input_file.empty())
+            continue;
+        pool.submit([&errMutex, &failed, input_file, binary, passes, cache, &flags] {
+            std::string msg;
+            try {
+                std::ifstream inf(input_file, std::ios::in);
+                if (!inf)
+                    throw CompileFailure(fmt::format("Fail to open {} for reading.", input_file));
+                std::stringstream ss;
+                translate(inf, ss, binary, passes, cache, flags);
+                // only written once compiled, a failing source leaves no output behind
+                auto output_file = std::filesystem::path(input_file).replace_extension(binary ? ".o0" : ".s0").string();
+                std::ofstream outf(output_file, binary ? std::ios::out | std::ios::trunc | std::ios::binary : std::ios::out | std::ios::trunc);
+                if (!outf)
+                    throw CompileFailure(fmt::format("Fail to open {} for writing.", output_file));
+                outf << ss.rdbuf();
+            }
+            catch (const std::exception& e) {
+                msg = e.what();
+            }
+            if (!msg.empty()) {
+                std::lock_guard<std::mutex> lock(errMutex);
+                fmt::print(stderr, "{}: {}\n", input_file, msg);
+                ++failed;
+            }
+        });
+    }
+    pool.wait();
+    return failed;
+}
+
+// a binary file ready to be run, from its image in the cache if there is one
+struct Program {
+    std::shared_ptr<const File> file;
+    std::shared_ptr<const vm::Image> image;
+
+    std::unique_ptr<vm::VM> make_vm() const {
+        return image ? vm::VM::make_vm(image) : vm::VM::make_vm(file);
+    }
+    const File& source() const {
+        return image ? *image->file() : *file;
+    }
+};
+
+// the image is keyed by the content of the binary file,
+// a missing one is saved and used right away
+Program load_program(std::ifstream* in, miniplc0::CompileCache* cache) {
+    if (!cache)
+        return {std::make_shared<const File>(File::parse_file_binary(*in)), nullptr};
+    std::string bytes;
+    if (in->seekg(0, std::ios::end)) {
+        bytes.resize(static_cast<std::size_t>(in->tellg()));
+        in->seekg(0);
+        in->read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+    auto key = cache->key(bytes, "-r");
+    if (auto path = cache->locate(key))
+        if (auto image = vm::Image::map(path->string(), key))
+            return {nullptr, image};
+    in->clear();
+    in->seekg(0);
+    auto file = std::make_shared<const File>(File::parse_file_binary(*in));
     try {
-        File f = File::parse_file_text(*in);
-        // f.output_text(std::cout);
-        f.output_binary(*out);
-        if (run) {
-            auto avm = std::move(vm::VM::make_vm(f));
-            avm->start();
+        std::ostringstream image(std::ios::out | std::ios::binary);
+        vm::VM::make_vm(file)->saveImage(image, key);
+        cache->storeFile(key, image.str());
+    }
+    catch (const std::exception&) {
+        // not saved, a malformed function is reported when it is called as without the cache
+        return {file, nullptr};
+    }
+    if (auto image = vm::Image::map(cache->path(key).string(), key))
+        return {nullptr, image};
+    return {file, nullptr};
+}
+
+// how -r runs a program
+struct RunOptions {
+    std::ofstream* trace = nullptr;
+    miniplc0::CompileCache* cache = nullptr;
+    bool gc = false;
+    vm::VM::Limits limits;
+    // the snapshot of the state after .start, saved by the first run that finds none
+    std::string snapshot;
+    std::string snapshotKey;
+    // the folded stacks of the samples taken profileHz times a second of running
+    std::string profile;
+    int profileHz = 1000;
+    // print how many instructions the run executed to stderr
+    bool countInstructions = false;
+};
+
+// nullptr if there is no profile to write
+std::shared_ptr<vm::Profiler> make_profiler(const RunOptions& options) {
+    if (options.profile.empty())
+        return nullptr;
+    return std::make_shared<vm::Profiler>(options.profileHz);
+}
+
+void write_profile(vm::Profiler* profiler, const Program& program, const RunOptions& options) {
+    if (!profiler)
+        return;
+    std::ofstream out(options.profile, std::ios::out | std::ios::trunc);
+    if (!out) {
+        fmt::print(stderr, "Fail to open {} for writing.\n", options.profile);
+        return;
+    }
+    profiler->write(out, program.source());
+}
+
+// the content of the binary file and the VM that runs it, a snapshot is only valid for both
+std::string snapshot_key(std::ifstream* in, const std::string& vmId) {
+    std::string bytes;
+    if (in->seekg(0, std::ios::end)) {
+        bytes.resize(static_cast<std::size_t>(in->tellg()));
+        in->seekg(0);
+        in->read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+    in->clear();
+    in->seekg(0);
+    return miniplc0::Sha256().update(vmId).update(bytes).hex();
+}
+
+// begin at the call of main with the state in the snapshot, save it first if there is none
+void use_snapshot(vm::VM& avm, const RunOptions& options) {
+    if (options.snapshot.empty() || avm.restoreSnapshot(options.snapshot, options.snapshotKey))
+        return;
+    try {
+        std::ostringstream snapshot(std::ios::out | std::ios::binary);
+        avm.saveSnapshot(snapshot, options.snapshotKey);
+        // written aside and renamed, another run never maps half of it
+        auto tmp = options.snapshot + ".tmp";
+        std::ofstream out(tmp, std::ios::out | std::ios::trunc | std::ios::binary);
+        auto bytes = snapshot.str();
+        if (!out.write(bytes.data(), static_cast<std::streamsize>(bytes.size())) || (out.close(), !out)) {
+            fmt::print(stderr, "Fail to open {} for writing.\n", tmp);
+            return;
         }
+        std::error_code ec;
+        std::filesystem::rename(tmp, options.snapshot, ec);
+        if (ec)
+            fmt::print(stderr, "Fail to write {}: {}.\n", options.snapshot, ec.message());
     }
     catch (const std::exception& e) {
+        // runs from the beginning as without a snapshot
         println(std::cerr, e.what());
     }
 }
 
+void run_binary(std::ifstream* in, const RunOptions& options) {
+    try {
+        auto program = load_program(in, options.cache);
+        auto avm = program.make_vm();
+        // the ring buffer is cheap enough to always keep it for the stack trace
+        avm->setTracer(std::make_unique<vm::Tracer>(vm::Tracer::defaultCapacity, options.trace));
+        avm->setGC(options.gc);
+        avm->setLimits(options.limits);
+        use_snapshot(*avm, options);
+        auto profiler = make_profiler(options);
+        avm->setProfiler(profiler);
+        avm->start();
+        write_profile(profiler.get(), program, options);
+        if (options.countInstructions)
+            fmt::print(stderr, "executed {} instructions\n", avm->executed());
+    }
+    catch (const std::exception& e) {
+        println(std::cerr, e.what());
+    }
+}
+
+void run_register(std::ifstream* in, const RunOptions& options) {
+    try {
+        File f = File::parse_file_binary(*in);
+        auto avm = vm::RegVM::make_vm(f);
+        avm->start();
+        if (options.countInstructions)
+            fmt::print(stderr, "executed {} instructions\n", avm->executed());
+    }
+    catch (const std::exception& e) {
+        println(std::cerr, e.what());
+    }
+}
+
+// run one program against every input file listed in `list` on `jobs` threads,
+// the output of `x` is written to `x.out`, returns the number of input files that could not
+// be run, 1 if the program could not be loaded
+int run_batch(std::ifstream* in, std::istream* list, int jobs, const RunOptions& options) {
+    Program program;
+    try {
+        program = load_program(in, options.cache);
+    }
+    catch (const std::exception& e) {
+        println(std::cerr, e.what());
+        return 1;
+    }
+    thread_pool pool(jobs);
+    // one instance per worker, reused for all the inputs it runs
+    std::vector<std::unique_ptr<vm::VM>> vms;
+    std::shared_ptr<vm::Profiler> profiler;
+    try {
+        for (std::size_t i = 0; i < pool.size(); ++i) {
+            vms.push_back(program.make_vm());
+            // a streamed trace is only readable if a single instance writes it
+            vms.back()->setTracer(std::make_unique<vm::Tracer>(vm::Tracer::defaultCapacity, pool.size() == 1 ? options.trace : nullptr));
+            vms.back()->setGC(options.gc);
+            vms.back()->setLimits(options.limits);
+            use_snapshot(*vms.back(), options);
+        }
+        profiler = make_profiler(options);
+        for (auto& avm : vms)
+            avm->setProfiler(profiler);
+    }
+    catch (const std::exception& e) {
+        println(std::cerr, e.what());
+        return 1;
+    }
+    std::mutex errMutex;
+    std::atomic<int> failed{0};
+    for (std::string input_file; std::getline(*list, input_file); ) {
+        if (input_file.empty())
+            continue;
+        pool.submit([&vms, &errMutex, &failed, input_file] {
+            std::stringstream err;
+            // the output is only created once there is an input, a missing one leaves x.out as it was
+            std::ifstream inf(input_file, std::ios::in);
+            std::ofstream outf;
+            if (inf)
+                outf.open(input_file + ".out", std::ios::out | std::ios::trunc);
+            bool ran = false;
+            if (!inf)
+                err << fmt::format("Fail to open {} for reading.\n", input_file);
+            else if (!outf)
+                err << fmt::format("Fail to open {}.out for writing.\n", input_file);
+            else {
+                auto& avm = *vms.at(thread_pool::worker_index());
+                avm.setIO(inf, outf, err);
+                // the profiling timer may not be created, the other inputs still run
+                try {
+                    avm.start();
+                    ran = true;
+                }
+                catch (const std::exception& e) {
+                    err << e.what() << '\n';
+                }
+            }
+            if (!ran)
+                ++failed;
+            if (auto msg = err.str(); !msg.empty()) {
+                std::lock_guard<std::mutex> lock(errMutex);
+                fmt::print(stderr, "{}:\n{}", input_file, msg);
+            }
+        });
+    }
+    pool.wait();
+    write_profile(profiler.get(), program, options);
+    return failed;
+}
+
+// nullptr without --cache-dir or if the directory can not be used
+std::unique_ptr<miniplc0::CompileCache> open_cache(argparse::ArgumentParser& program, const char* argv0) {
+	auto cache_dir = program.get<std::string>("--cache-dir");
+	if (cache_dir.empty())
+		return nullptr;
+	// 以编译器本身的 hash 作为版本
+	auto memo = std::filesystem::path(cache_dir) / miniplc0::CompileCache::memoName;
+	auto compilerId = miniplc0::CompileCache::fingerprint("/proc/self/exe", memo);
+	if (compilerId.empty())
+		compilerId = miniplc0::CompileCache::fingerprint(argv0, memo);
+	if (compilerId.empty()) {
+		fmt::print(stderr, "Fail to identify the compiler, the cache is disabled.\n");
+		return nullptr;
+	}
+	try {
+		auto limit = static_cast<std::uintmax_t>(std::max(program.get<int>("--cache-size"), 0)) << 20;
+		return std::make_unique<miniplc0::CompileCache>(cache_dir, limit, compilerId);
+	}
+	catch (const std::filesystem::filesystem_error& e) {
+		fmt::print(stderr, "{}, the cache is disabled.\n", e.what());
+		return nullptr;
+	}
+}
+
 int main(int argc, char** argv) {
 	argparse::ArgumentParser program("cc0");
     program.add_argument("input")
-            .help("speicify the file to be compiled.");
+            .help("speicify the file to be compiled, or @list to compile every file listed in list.");
     program.add_argument("-s")
             .default_value(false)
             .implicit_value(true)
@@ -346,6 +679,83 @@ int main(int argc, char** argv) {
             .default_value(false)
             .implicit_value(true)
             .help("Translate the input c0 source code into a binary object file.");
+    program.add_argument("-r")
+            .default_value(false)
+            .implicit_value(true)
+            .help("Run the input binary object file with c0-vm.");
+    program.add_argument("--trace")
+            .default_value(std::string(""))
+            .help("stream the instruction trace of -r into the file.");
+    program.add_argument("--batch")
+            .default_value(std::string(""))
+            .help("with -r, run the program against every input file listed in the file, one per line.");
+    program.add_argument("--regvm")
+            .default_value(false)
+            .implicit_value(true)
+            .help("with -r, translate the program into register bytecode and run it on the experimental register vm.");
+    program.add_argument("--count-instructions")
+            .default_value(false)
+            .implicit_value(true)
+            .help("with -r and no --batch, print the number of instructions executed to stderr, with --regvm the register instructions.");
+    program.add_argument("--gc")
+            .default_value(false)
+            .implicit_value(true)
+            .help("with -r, collect the heap objects that are no longer reachable instead of running out of heap.");
+    program.add_argument("--max-instructions")
+            .default_value(0ULL)
+            .action([](const std::string& value) { return std::stoull(value); })
+            .help("with -r, stop a run after about this many instructions, 0 for no limit.");
+    program.add_argument("--max-heap")
+            .default_value(0ULL)
+            .action([](const std::string& value) { return std::stoull(value); })
+            .help("with -r, the bytes of heap a run may use besides the string literals, 0 for no limit.");
+    program.add_argument("--time-limit")
+            .default_value(0ULL)
+            .action([](const std::string& value) { return std::stoull(value); })
+            .help("with -r, stop a run after this many milliseconds, 0 for no limit.");
+    program.add_argument("--snapshot-after-start")
+            .default_value(std::string(""))
+            .help("with -r, begin at main with the state .start leaves, saved in the file by a run that finds none for the program there.");
+    program.add_argument("--profile")
+            .default_value(std::string(""))
+            .help("with -r, sample the running functions and instructions and write them into the file as folded stacks.");
+    program.add_argument("--profile-hz")
+            .default_value(1000)
+            .action([](const std::string& value) { return std::stoi(value); })
+            .help("the samples --profile takes per second of CPU time.");
+    program.add_argument("-j", "--jobs")
+            .default_value(1)
+            .action([](const std::string& value) { return std::stoi(value); })
+            .help("the number of threads for --batch or an @list input, 0 for all the cores.");
+    program.add_argument("--decode-trace")
+            .default_value(false)
+            .implicit_value(true)
+            .help("Decode the input trace file written by --trace.");
+    program.add_argument("--cache-dir")
+            .default_value(std::string(""))
+            .help("reuse the output of an unchanged source from the cache in the directory, with -r the decoded image of the binary file.");
+    program.add_argument("--cache-size")
+            .default_value(64)
+            .action([](const std::string& value) { return std::stoi(value); })
+            .help("the size limit of --cache-dir in MiB, the least recently used outputs are evicted.");
+    program.add_argument("--cache-stats")
+            .default_value(false)
+            .implicit_value(true)
+            .help("print the cache hits and misses to stderr.");
+    for (auto level : {"-O0", "-O1", "-O2"})
+        program.add_argument(level)
+                .default_value(false)
+                .implicit_value(true)
+                .help("the optimization level, -O1 propagates constants and copies and removes dead code, "
+                      "-O2 also hoists loop invariants and eliminates common subexpressions.");
+    program.add_argument("--inline-budget")
+            .default_value(16)
+            .action([](const std::string& value) { return std::stoi(value); })
+            .help("with -O1 or -O2, inline a call when the callee is a single return of at most this many instructions, 0 to disable.");
+    program.add_argument("--time-passes")
+            .default_value(false)
+            .implicit_value(true)
+            .help("print the time spent in each optimization pass to stderr.");
     program.add_argument("-o", "--output")
             .required()
             .default_value(std::string("-"))
@@ -362,6 +772,124 @@ int main(int argc, char** argv) {
 
 	auto input_file = program.get<std::string>("input");
 	auto output_file = program.get<std::string>("--output");
+	if (program["-r"] == true) {
+	    std::ifstream inf(input_file, std::ios::in | std::ios::binary);
+	    if (!inf) {
+	        fmt::print(stderr, "Fail to open {} for reading.\n", input_file);
+	        exit(2);
+	    }
+	    std::ofstream tracef;
+	    auto trace_file = program.get<std::string>("--trace");
+	    if (!trace_file.empty()) {
+	        tracef.open(trace_file, std::ios::out | std::ios::trunc | std::ios::binary);
+	        if (!tracef) {
+	            fmt::print(stderr, "Fail to open {} for writing.\n", trace_file);
+	            exit(2);
+	        }
+	    }
+	    auto batch_file = program.get<std::string>("--batch");
+	    // with -r the cache keeps the images of the binary files
+	    auto cache = program["--regvm"] == true ? nullptr : open_cache(program, argv[0]);
+	    RunOptions options;
+	    options.trace = trace_file.empty() ? nullptr : &tracef;
+	    options.cache = cache.get();
+	    options.gc = program["--gc"] == true;
+	    options.limits.instructions = program.get<unsigned long long>("--max-instructions");
+	    options.limits.heapBytes = program.get<unsigned long long>("--max-heap");
+	    options.limits.time = std::chrono::milliseconds(program.get<unsigned long long>("--time-limit"));
+	    bool limited = options.limits.instructions > 0 || options.limits.heapBytes > 0 || options.limits.time.count() > 0;
+	    options.snapshot = program.get<std::string>("--snapshot-after-start");
+	    if (!options.snapshot.empty() && program["--regvm"] == false) {
+	        // the VM is the compiler, the cache has hashed it already
+	        auto vm_id = cache ? cache->id() : miniplc0::CompileCache::fingerprint("/proc/self/exe");
+	        if (vm_id.empty())
+	            vm_id = miniplc0::CompileCache::fingerprint(argv[0]);
+	        options.snapshotKey = snapshot_key(&inf, vm_id);
+	    }
+	    options.profile = program.get<std::string>("--profile");
+	    options.profileHz = program.get<int>("--profile-hz");
+	    options.countInstructions = program["--count-instructions"] == true;
+	    if (options.profileHz <= 0) {
+	        fmt::print(stderr, "--profile-hz must be positive.\n");
+	        exit(2);
+	    }
+	    if (program["--regvm"] == true) {
+	        if (!batch_file.empty() || !trace_file.empty() || options.gc || limited || !options.snapshot.empty() || !options.profile.empty()) {
+	            fmt::print(stderr, "--regvm can not be used with --batch, --trace, --gc, --snapshot-after-start, --profile or the limits.\n");
+	            exit(2);
+	        }
+	        run_register(&inf, options);
+	    }
+	    else if (!batch_file.empty()) {
+	        std::ifstream listf(batch_file, std::ios::in);
+	        if (!listf) {
+	            fmt::print(stderr, "Fail to open {} for reading.\n", batch_file);
+	            exit(2);
+	        }
+	        int failed = run_batch(&inf, &listf, program.get<int>("--jobs"), options);
+	        if (cache && program["--cache-stats"] == true)
+	            cache->printStatistics(std::cerr);
+	        return failed == 0 ? 0 : 2;
+	    }
+	    else
+	        run_binary(&inf, options);
+	    if (cache && program["--cache-stats"] == true)
+	        cache->printStatistics(std::cerr);
+	    return 0;
+	}
+	if (program["--decode-trace"] == true) {
+	    std::ifstream inf(input_file, std::ios::in | std::ios::binary);
+	    if (!inf) {
+	        fmt::print(stderr, "Fail to open {} for reading.\n", input_file);
+	        exit(2);
+	    }
+	    try {
+	        vm::Tracer::decode(inf, std::cout);
+	    }
+	    catch (const std::exception& e) {
+	        println(std::cerr, e.what());
+	        exit(2);
+	    }
+	    return 0;
+	}
+	if (program["-s"] == true && program["-c"] == true) {
+		fmt::print(stderr, "You can only translate source code into an assembly file or a binary object file at one time.");
+		exit(2);
+	}
+	if (program["-s"] == false && program["-c"] == false) {
+		fmt::print(stderr, "You must choose translate to an assembly file or a binary object file.");
+		exit(2);
+	}
+	bool binary = program["-c"] == true;
+	// 给了多个的话取最高的
+	int level = program["-O2"] == true ? 2 : program["-O1"] == true ? 1 : 0;
+	int inlineBudget = level > 0 ? std::max(program.get<int>("--inline-budget"), 0) : 0;
+	std::string flags = fmt::format("{} -O{} --inline-budget {}", binary ? "-c" : "-s", level, inlineBudget);
+	// 所有线程共用，pass 本身没有状态
+	std::unique_ptr<miniplc0::PassManager> passes;
+	if (level > 0)
+		passes = std::make_unique<miniplc0::PassManager>(level, inlineBudget);
+
+	auto cache = open_cache(program, argv[0]);
+	const auto printStatistics = [&] {
+		if (cache && program["--cache-stats"] == true)
+			cache->printStatistics(std::cerr);
+		if (passes && program["--time-passes"] == true)
+			passes->printTimings(std::cerr);
+	};
+
+	// @list compiles every source listed in the file
+	if (!input_file.empty() && input_file.front() == '@') {
+		std::ifstream listf(input_file.substr(1), std::ios::in);
+		if (!listf) {
+			fmt::print(stderr, "Fail to open {} for reading.\n", input_file.substr(1));
+			exit(2);
+		}
+		int failed = compile_batch(&listf, binary, program.get<int>("--jobs"), passes.get(), cache.get(), flags);
+		printStatistics();
+		return failed == 0 ? 0 : 2;
+	}
+
 	std::istream* input;
 	std::ostream* output;
 	std::ifstream inf;
@@ -377,69 +905,25 @@ int main(int argc, char** argv) {
 	else
 		input = &std::cin;
 	if (output_file != "-") {
-	    // 将第一个的输出作为第二个的输入
-        std::stringstream ss;
-        std::string tmp = output_file;
-        ss << output_file << ".zrb";
-        if (program["-c"] == true)
-        {
-            input_file = ss.str();
-            tmp = ss.str();
-        }
-		outf.open(tmp, std::ios::out | std::ios::trunc);
+		outf.open(output_file, binary ? std::ios::out | std::ios::trunc | std::ios::binary : std::ios::out | std::ios::trunc);
 		if (!outf) {
 			fmt::print(stderr, "Fail to open {} for writing.\n", output_file);
 			exit(2);
 		}
 		output = &outf;
 	}
-
-	// 改成输出到 output.o0
 	else
 		output = &std::cout;
 
-	if (program["-s"] == true && program["-c"] == true) {
-		fmt::print(stderr, "You can only translate source code into an assembly file or a binary object file at one time.");
-		exit(2);
-	}
-
-	// 转换程序入口
-	if (program["-s"] == true) {
-	    // 生成汇编代码
-		translateToAssemblingFile(*input,*output);
-	}
-	else if (program["-c"] == true) {
-	    // 生成二进制文件
-        translateToAssemblingFile(*input,*output);
-        inf.close();
-        outf.close();
-        {
-            std::ifstream* input;
-            std::ostream* output;
-            std::ifstream inf;
-            std::ofstream outf;
-
-            inf.open(input_file, std::ios::in);
-            if (!inf) {
-                exit(2);
-            }
-            input = &inf;
-            outf.open(output_file, std::ios::out | std::ios::trunc|std::ios::binary);
-            if (!outf) {
-                inf.close();
-                exit(2);
-            }
-            output = &outf;
-            assemble_text(input, dynamic_cast<std::ofstream*>(output), false);
-            inf.close();
-            outf.close();
-        }
-        return 0;
+	try {
+		// 生成二进制文件或汇编代码
+		translate(*input, *output, binary, passes.get(), cache.get(), flags);
 	}
-
-	else {
-		fmt::print(stderr, "You must choose translate to an assembly file or a binary object file.");
+	catch (const std::exception& e) {
+		fmt::print(stderr, "{}\n", e.what());
+		printStatistics();
 		exit(2);
 	}
+	printStatistics();
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,232 @@
+#include "cfg.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace miniplc0 {
+
+    namespace {
+        // 把语法树的语句按顺序放进基本块
+        struct Builder {
+            ControlFlowGraph& graph;
+            int current;
+
+            int newBlock() {
+                BasicBlock block;
+                block.exit = BasicBlock::Exit::Return;
+                block.target = block.otherwise = -1;
+                block.value = nullptr;
+                block.condition = {nullptr, TokenType::NULL_TOKEN, nullptr};
+                graph.blocks.push_back(block);
+                return static_cast<int>(graph.blocks.size()) - 1;
+            }
+            void jump(int from, int to) {
+                graph.blocks[from].exit = BasicBlock::Exit::Jump;
+                graph.blocks[from].target = to;
+            }
+
+            void lower(const Statement* statement) {
+                switch (statement->kind) {
+                    case Statement::Kind::Block:
+                        for (auto s : statement->body)
+                            lower(s);
+                        break;
+                    case Statement::Kind::If: {
+                        auto branch = current;
+                        graph.blocks[branch].exit = BasicBlock::Exit::Branch;
+                        graph.blocks[branch].condition = statement->condition;
+                        current = graph.blocks[branch].target = newBlock();
+                        lower(statement->then);
+                        auto thenEnd = current;
+                        if (statement->otherwise) {
+                            current = graph.blocks[branch].otherwise = newBlock();
+                            lower(statement->otherwise);
+                            auto join = newBlock();
+                            jump(thenEnd, join);
+                            jump(current, join);
+                            current = join;
+                        }
+                        else {
+                            auto join = newBlock();
+                            graph.blocks[branch].otherwise = join;
+                            jump(thenEnd, join);
+                            current = join;
+                        }
+                        break;
+                    }
+                    case Statement::Kind::While: {
+                        auto header = newBlock();
+                        jump(current, header);
+                        graph.blocks[header].exit = BasicBlock::Exit::Branch;
+                        graph.blocks[header].condition = statement->condition;
+                        current = graph.blocks[header].target = newBlock();
+                        lower(statement->then);
+                        jump(current, header);
+                        current = graph.blocks[header].otherwise = newBlock();
+                        break;
+                    }
+                    case Statement::Kind::Return:
+                        graph.blocks[current].exit = BasicBlock::Exit::Return;
+                        graph.blocks[current].value = statement->expression;
+                        // return 之后的语句放进一个不可达的基本块
+                        current = newBlock();
+                        break;
+                    default:
+                        graph.blocks[current].statements.push_back(const_cast<Statement*>(statement));
+                        break;
+                }
+            }
+        };
+    }
+
+    ControlFlowGraph ControlFlowGraph::build(const FunctionNode& function, Arena& arena) {
+        ControlFlowGraph graph;
+        graph.index = function.index;
+        graph.isVoid = function.isVoid;
+        graph.frameSize = function.frameSize;
+        graph.temporaries = 0;
+        graph.arena = &arena;
+        Builder builder{graph, 0};
+        builder.current = builder.newBlock();
+        builder.lower(function.body);
+        // 函数末尾的 ret/iret
+        graph.blocks[builder.current].exit = BasicBlock::Exit::Return;
+        graph.blocks[builder.current].value = nullptr;
+        return graph;
+    }
+
+    std::vector<int> ControlFlowGraph::successors(int block) const {
+        auto& b = blocks[block];
+        switch (b.exit) {
+            case BasicBlock::Exit::Jump:
+                return {b.target};
+            case BasicBlock::Exit::Branch:
+                return {b.target, b.otherwise};
+            default:
+                return {};
+        }
+    }
+
+    std::vector<std::vector<int>> ControlFlowGraph::predecessors() const {
+        std::vector<std::vector<int>> result(blocks.size());
+        for (int b = 0; b < static_cast<int>(blocks.size()); b++)
+            for (auto s : successors(b))
+                result[s].push_back(b);
+        return result;
+    }
+
+    std::vector<int> ControlFlowGraph::reversePostOrder() const {
+        std::vector<int> order;
+        std::vector<bool> visited(blocks.size(), false);
+        // 显式的栈，避免很深的嵌套把调用栈用完
+        std::vector<std::pair<int, std::size_t>> stack;
+        stack.emplace_back(0, 0);
+        visited[0] = true;
+        while (!stack.empty()) {
+            auto& [b, next] = stack.back();
+            auto s = successors(b);
+            if (next < s.size()) {
+                auto n = s[next++];
+                if (!visited[n]) {
+                    visited[n] = true;
+                    stack.emplace_back(n, 0);
+                }
+            }
+            else {
+                order.push_back(b);
+                stack.pop_back();
+            }
+        }
+        std::reverse(order.begin(), order.end());
+        return order;
+    }
+
+    // Cooper, Harvey, Kennedy: A Simple, Fast Dominance Algorithm
+    std::vector<int> ControlFlowGraph::dominators() const {
+        auto order = reversePostOrder();
+        std::vector<int> position(blocks.size(), -1);
+        for (std::size_t i = 0; i < order.size(); i++)
+            position[order[i]] = static_cast<int>(i);
+        auto preds = predecessors();
+        std::vector<int> idom(blocks.size(), -1);
+        idom[0] = 0;
+        const auto intersect = [&](int a, int b) {
+            while (a != b) {
+                while (position[a] > position[b])
+                    a = idom[a];
+                while (position[b] > position[a])
+                    b = idom[b];
+            }
+            return a;
+        };
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (std::size_t i = 1; i < order.size(); i++) {
+                auto b = order[i];
+                int dom = -1;
+                for (auto p : preds[b]) {
+                    if (position[p] < 0 || idom[p] < 0)
+                        continue;
+                    dom = dom < 0 ? p : intersect(p, dom);
+                }
+                if (dom != idom[b]) {
+                    idom[b] = dom;
+                    changed = true;
+                }
+            }
+        }
+        idom[0] = -1;
+        return idom;
+    }
+
+    bool ControlFlowGraph::dominates(const std::vector<int>& idom, int a, int b) const {
+        for (; b >= 0; b = idom[b])
+            if (a == b)
+                return true;
+        return false;
+    }
+
+    int ControlFlowGraph::insertBlock(int position) {
+        for (auto& b : blocks) {
+            if (b.target >= position)
+                b.target++;
+            if (b.otherwise >= position)
+                b.otherwise++;
+        }
+        BasicBlock block;
+        block.exit = BasicBlock::Exit::Jump;
+        block.target = block.otherwise = -1;
+        block.value = nullptr;
+        block.condition = {nullptr, TokenType::NULL_TOKEN, nullptr};
+        blocks.insert(blocks.begin() + position, block);
+        return position;
+    }
+
+    bool ControlFlowGraph::removeUnreachable() {
+        auto order = reversePostOrder();
+        if (order.size() == blocks.size())
+            return false;
+        std::vector<bool> reachable(blocks.size(), false);
+        for (auto b : order)
+            reachable[b] = true;
+        // 保持原来的顺序
+        std::vector<int> renumber(blocks.size(), -1);
+        std::vector<BasicBlock> kept;
+        for (std::size_t b = 0; b < blocks.size(); b++) {
+            if (reachable[b]) {
+                renumber[b] = static_cast<int>(kept.size());
+                kept.push_back(std::move(blocks[b]));
+            }
+        }
+        for (auto& b : kept) {
+            if (b.target >= 0)
+                b.target = renumber[b.target];
+            if (b.otherwise >= 0)
+                b.otherwise = renumber[b.otherwise];
+        }
+        blocks = std::move(kept);
+        return true;
+    }
+
+}
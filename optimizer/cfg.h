@@ -0,0 +1,66 @@
+#ifndef CC0_CFG_H
+#define CC0_CFG_H
+
+#include "analyser/arena.h"
+#include "analyser/ast.h"
+
+#include <vector>
+
+// 控制流图
+// 语法树和指令之间的中间表示，每个函数一个
+// 基本块里只有不改变控制流的语句（声明、赋值、输入输出、函数调用），
+// 控制流都在基本块的出口上：无条件跳转、条件跳转、返回
+namespace miniplc0 {
+
+    struct BasicBlock {
+        enum class Exit {
+            Jump,       // target
+            Branch,     // condition 成立到 target，不成立到 otherwise
+            Return,     // value，void 函数或者函数末尾为空
+        };
+        std::vector<Statement*> statements;
+        Exit exit;
+        Condition condition;
+        int target;
+        int otherwise;
+        Expression* value;
+    };
+
+    class ControlFlowGraph final {
+    public:
+        // 语法树中的结点不会被修改，优化时新建的结点分配在 arena 里
+        static ControlFlowGraph build(const FunctionNode& function, Arena& arena);
+
+        // 出口指向的基本块
+        std::vector<int> successors(int block) const;
+        std::vector<std::vector<int>> predecessors() const;
+        // 从入口可达的基本块的逆后序
+        std::vector<int> reversePostOrder() const;
+        // dominators()[b] 是 b 的直接支配结点，入口和不可达的是 -1
+        std::vector<int> dominators() const;
+        bool dominates(const std::vector<int>& idom, int a, int b) const;
+
+        // 在 position 处插入一个空的基本块，之后的下标全部后移
+        int insertBlock(int position);
+        // 删掉不可达的基本块，返回是否删了
+        bool removeUnreachable();
+
+        // 在局部变量之后分配一个临时变量，返回它在栈帧中的偏移
+        int newTemporary() { return frameSize + temporaries++; }
+        int slotCount() const { return frameSize + temporaries; }
+
+    public:
+        int index;
+        bool isVoid;
+        // 参数和局部变量的个数，都在函数开头分配
+        int frameSize;
+        // 优化时增加的临时变量，紧跟在局部变量之后分配
+        int temporaries;
+        // 入口是 blocks[0]，也按这个顺序生成指令
+        std::vector<BasicBlock> blocks;
+        Arena* arena;
+    };
+
+}
+
+#endif //CC0_CFG_H
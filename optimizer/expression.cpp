@@ -0,0 +1,267 @@
+#include "expression.h"
+
+namespace miniplc0 {
+
+    bool isPure(const Expression* e) {
+        switch (e->kind) {
+            case Expression::Kind::Literal:
+            case Expression::Kind::Variable:
+                return true;
+            case Expression::Kind::Negate:
+                return isPure(e->lhs);
+            case Expression::Kind::Binary:
+                if (e->op == TokenType::DIVISION_SIGN
+                    && (e->rhs->kind != Expression::Kind::Literal || e->rhs->value == 0 || e->rhs->value == -1))
+                    return false;
+                return isPure(e->lhs) && isPure(e->rhs);
+            default:
+                return false;
+        }
+    }
+
+    bool readsGlobal(const Expression* e) {
+        switch (e->kind) {
+            case Expression::Kind::Variable:
+                return e->level != 0;
+            case Expression::Kind::Negate:
+                return readsGlobal(e->lhs);
+            case Expression::Kind::Binary:
+                return readsGlobal(e->lhs) || readsGlobal(e->rhs);
+            case Expression::Kind::Call:
+                for (auto a : e->arguments)
+                    if (readsGlobal(a))
+                        return true;
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    bool hasCall(const Expression* e) {
+        switch (e->kind) {
+            case Expression::Kind::Call:
+                return true;
+            case Expression::Kind::Negate:
+                return hasCall(e->lhs);
+            case Expression::Kind::Binary:
+                return hasCall(e->lhs) || hasCall(e->rhs);
+            default:
+                return false;
+        }
+    }
+
+    int cost(const Expression* e) {
+        switch (e->kind) {
+            case Expression::Kind::Literal:
+                return 1;
+            case Expression::Kind::Variable:
+                return 2;
+            case Expression::Kind::Negate:
+                return cost(e->lhs) + 1;
+            case Expression::Kind::Binary:
+                return cost(e->lhs) + cost(e->rhs) + 1;
+            default: {
+                int n = 1;
+                for (auto a : e->arguments)
+                    n += cost(a);
+                return n;
+            }
+        }
+    }
+
+    bool equal(const Expression* a, const Expression* b) {
+        if (a == b)
+            return true;
+        if (a->kind != b->kind)
+            return false;
+        switch (a->kind) {
+            case Expression::Kind::Literal:
+                return a->value == b->value;
+            case Expression::Kind::Variable:
+                return a->level == b->level && a->offset == b->offset;
+            case Expression::Kind::Negate:
+                return equal(a->lhs, b->lhs);
+            case Expression::Kind::Binary:
+                return a->op == b->op && equal(a->lhs, b->lhs) && equal(a->rhs, b->rhs);
+            default:
+                if (a->function != b->function || a->arguments.size != b->arguments.size)
+                    return false;
+                for (std::size_t i = 0; i < a->arguments.size; i++)
+                    if (!equal(a->arguments[i], b->arguments[i]))
+                        return false;
+                return true;
+        }
+    }
+
+    std::size_t hash(const Expression* e) {
+        const auto mix = [](std::size_t h, std::size_t v) {
+            return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+        };
+        std::size_t h = static_cast<std::size_t>(e->kind);
+        switch (e->kind) {
+            case Expression::Kind::Literal:
+                return mix(h, static_cast<std::size_t>(e->value));
+            case Expression::Kind::Variable:
+                return mix(mix(h, e->level), e->offset);
+            case Expression::Kind::Negate:
+                return mix(h, hash(e->lhs));
+            case Expression::Kind::Binary:
+                return mix(mix(mix(h, e->op), hash(e->lhs)), hash(e->rhs));
+            default:
+                h = mix(h, e->function);
+                for (auto a : e->arguments)
+                    h = mix(h, hash(a));
+                return h;
+        }
+    }
+
+    void forEachLocalRead(const Expression* e, const std::function<void(int)>& visit) {
+        switch (e->kind) {
+            case Expression::Kind::Variable:
+                if (e->level == 0)
+                    visit(e->offset);
+                break;
+            case Expression::Kind::Negate:
+                forEachLocalRead(e->lhs, visit);
+                break;
+            case Expression::Kind::Binary:
+                forEachLocalRead(e->lhs, visit);
+                forEachLocalRead(e->rhs, visit);
+                break;
+            case Expression::Kind::Call:
+                for (auto a : e->arguments)
+                    forEachLocalRead(a, visit);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void forEachLocalRead(const Statement* s, const std::function<void(int)>& visit) {
+        switch (s->kind) {
+            case Statement::Kind::Print:
+                for (auto e : s->printables)
+                    forEachLocalRead(e, visit);
+                break;
+            case Statement::Kind::Declaration:
+            case Statement::Kind::Assign:
+            case Statement::Kind::Call:
+                if (s->expression)
+                    forEachLocalRead(s->expression, visit);
+                break;
+            default:
+                break;
+        }
+    }
+
+    int localWritten(const Statement* s) {
+        switch (s->kind) {
+            case Statement::Kind::Declaration:
+            case Statement::Kind::Assign:
+            case Statement::Kind::Scan:
+                return isLocal(s) ? s->offset : -1;
+            default:
+                return -1;
+        }
+    }
+
+    Expression* transform(Expression* e, Arena& arena, const std::function<Expression*(Expression*)>& rewrite) {
+        Expression* result = e;
+        switch (e->kind) {
+            case Expression::Kind::Negate: {
+                auto lhs = transform(e->lhs, arena, rewrite);
+                if (lhs != e->lhs) {
+                    result = arena.make<Expression>(*e);
+                    result->lhs = lhs;
+                }
+                break;
+            }
+            case Expression::Kind::Binary: {
+                auto lhs = transform(e->lhs, arena, rewrite);
+                auto rhs = transform(e->rhs, arena, rewrite);
+                if (lhs != e->lhs || rhs != e->rhs) {
+                    result = arena.make<Expression>(*e);
+                    result->lhs = lhs;
+                    result->rhs = rhs;
+                }
+                break;
+            }
+            case Expression::Kind::Call: {
+                std::vector<Expression*> arguments;
+                bool changed = false;
+                for (auto a : e->arguments) {
+                    arguments.push_back(transform(a, arena, rewrite));
+                    changed = changed || arguments.back() != a;
+                }
+                if (changed) {
+                    result = arena.make<Expression>(*e);
+                    result->arguments = arena.copy(arguments);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        auto replaced = rewrite(result);
+        return replaced ? replaced : result;
+    }
+
+    Expression* foldConstant(Expression* e, Arena& arena) {
+        if (e->kind == Expression::Kind::Negate && e->lhs->kind == Expression::Kind::Literal)
+            return makeLiteral(arena, static_cast<int32_t>(0u - static_cast<uint32_t>(e->lhs->value)));
+        if (e->kind == Expression::Kind::Binary
+            && e->lhs->kind == Expression::Kind::Literal && e->rhs->kind == Expression::Kind::Literal) {
+            auto value = fold(e->op, e->lhs->value, e->rhs->value);
+            if (value.has_value())
+                return makeLiteral(arena, value.value());
+        }
+        return nullptr;
+    }
+
+    Expression* simplify(Expression* e, Arena& arena) {
+        return transform(e, arena, [&arena](Expression* x) { return foldConstant(x, arena); });
+    }
+
+    Expression* makeLiteral(Arena& arena, int32_t value) {
+        auto e = arena.make<Expression>();
+        e->kind = Expression::Kind::Literal;
+        e->value = value;
+        return e;
+    }
+
+    Expression* makeLocal(Arena& arena, int offset) {
+        auto e = arena.make<Expression>();
+        e->kind = Expression::Kind::Variable;
+        e->level = 0;
+        e->offset = offset;
+        return e;
+    }
+
+    std::optional<bool> evaluate(const Condition& condition) {
+        if (condition.lhs->kind != Expression::Kind::Literal)
+            return {};
+        auto lhs = condition.lhs->value;
+        if (!condition.rhs)
+            return lhs != 0;
+        if (condition.rhs->kind != Expression::Kind::Literal)
+            return {};
+        auto rhs = condition.rhs->value;
+        switch (condition.op) {
+            case TokenType::IS_EQUAL_SIGN:
+                return lhs == rhs;
+            case TokenType::NOT_EQUAL_SIGN:
+                return lhs != rhs;
+            case TokenType::LESS_THAN_SIGN:
+                return lhs < rhs;
+            case TokenType::LESS_OR_EQUAL_SIGN:
+                return lhs <= rhs;
+            case TokenType::MORE_THAN_SIGN:
+                return lhs > rhs;
+            case TokenType::MORE_OR_EQUAL_SIGN:
+                return lhs >= rhs;
+            default:
+                return {};
+        }
+    }
+
+}
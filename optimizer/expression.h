@@ -0,0 +1,56 @@
+#ifndef CC0_EXPRESSION_H
+#define CC0_EXPRESSION_H
+
+#include "analyser/arena.h"
+#include "analyser/ast.h"
+
+#include <cstddef>
+#include <functional>
+
+// 优化时对表达式的分析和改写
+// 局部变量只会被 loada 紧接着 iload/istore 使用，地址不会传出去，
+// 所以一个表达式读了哪些局部变量在语法树上就能直接看出来
+namespace miniplc0 {
+
+    inline bool isLocal(const Expression* e) {
+        return e->kind == Expression::Kind::Variable && e->level == 0;
+    }
+    inline bool isLocal(const Statement* s) {
+        return s->level == 0;
+    }
+
+    // 没有函数调用，也不会在运行时出错（除数不是非0、非-1的常数就可能出错）
+    // 这样的表达式可以删掉、提前算或者只算一次
+    bool isPure(const Expression* e);
+    // 有没有读全局变量
+    bool readsGlobal(const Expression* e);
+    bool hasCall(const Expression* e);
+    // 生成的指令条数
+    int cost(const Expression* e);
+    bool equal(const Expression* a, const Expression* b);
+    std::size_t hash(const Expression* e);
+
+    // 依次访问读到的每个局部变量的偏移
+    void forEachLocalRead(const Expression* e, const std::function<void(int)>& visit);
+    // 语句读的局部变量
+    void forEachLocalRead(const Statement* s, const std::function<void(int)>& visit);
+    // 语句写的局部变量，没有的话为 -1
+    int localWritten(const Statement* s);
+
+    // 自底向上改写表达式，rewrite 返回空表示这个结点不变
+    // 改过的结点和它的祖先都是新建的，原来的树不会被修改
+    Expression* transform(Expression* e, Arena& arena, const std::function<Expression*(Expression*)>& rewrite);
+    // 子结点都是字面量的话算出结果，不能算的返回空
+    Expression* foldConstant(Expression* e, Arena& arena);
+    // 子结点是字面量的运算算出结果
+    Expression* simplify(Expression* e, Arena& arena);
+
+    Expression* makeLiteral(Arena& arena, int32_t value);
+    Expression* makeLocal(Arena& arena, int offset);
+
+    // 条件的值，不是常量的话为空
+    std::optional<bool> evaluate(const Condition& condition);
+
+}
+
+#endif //CC0_EXPRESSION_H
@@ -0,0 +1,84 @@
+#include "passManager.h"
+#include "passes.h"
+
+#include <chrono>
+#include <iomanip>
+#include <string>
+
+namespace miniplc0 {
+
+    PassManager::PassManager(int level, int inlineBudget) : _level(level), _inlineBudget(inlineBudget) {
+        if (level >= 1) {
+            add(std::make_unique<ConstantPropagation>());
+            add(std::make_unique<CopyPropagation>());
+        }
+        if (level >= 2) {
+            add(std::make_unique<LoopInvariantCodeMotion>());
+            add(std::make_unique<CommonSubexpressionElimination>());
+            // 外提和公共子表达式留下的临时变量之间的复制
+            add(std::make_unique<CopyPropagation>());
+        }
+        if (level >= 1) {
+            add(std::make_unique<DeadStoreElimination>());
+            add(std::make_unique<UnreachableCodeElimination>());
+            add(std::make_unique<PeepholeOptimization>());
+        }
+    }
+
+    void PassManager::add(std::unique_ptr<Pass> pass) {
+        auto entry = std::make_unique<Entry>();
+        entry->pass = std::move(pass);
+        _passes.push_back(std::move(entry));
+    }
+
+    void PassManager::add(std::unique_ptr<InstructionPass> pass) {
+        auto entry = std::make_unique<Entry>();
+        entry->instructionPass = std::move(pass);
+        _passes.push_back(std::move(entry));
+    }
+
+    void PassManager::run(ControlFlowGraph& graph) {
+        for (auto& entry : _passes) {
+            if (!entry->pass)
+                continue;
+            auto start = std::chrono::steady_clock::now();
+            bool changed = entry->pass->run(graph);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            entry->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+            entry->runs++;
+            if (changed)
+                entry->changes++;
+        }
+    }
+
+    void PassManager::run(std::vector<Instruction>& function) {
+        for (auto& entry : _passes) {
+            if (!entry->instructionPass)
+                continue;
+            auto start = std::chrono::steady_clock::now();
+            bool changed = entry->instructionPass->run(function);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            entry->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+            entry->runs++;
+            if (changed)
+                entry->changes++;
+        }
+    }
+
+    void PassManager::printTimings(std::ostream& out) const {
+        const auto row = [&out](const std::string& name) -> std::ostream& {
+            return out << std::left << std::setw(34) << name << std::right;
+        };
+        row("pass") << std::setw(12) << "time(ms)" << std::setw(8) << "runs" << std::setw(9) << "changed" << '\n';
+        std::uint64_t total = 0;
+        out << std::fixed << std::setprecision(3);
+        for (auto& entry : _passes) {
+            total += entry->nanoseconds;
+            row(entry->pass ? entry->pass->name() : entry->instructionPass->name()) << std::setw(12) << entry->nanoseconds / 1e6
+                                     << std::setw(8) << entry->runs.load()
+                                     << std::setw(9) << entry->changes.load() << '\n';
+        }
+        row("total") << std::setw(12) << total / 1e6 << '\n';
+    }
+
+}
@@ -0,0 +1,70 @@
+#ifndef CC0_PASSMANAGER_H
+#define CC0_PASSMANAGER_H
+
+#include "instruction/instruction.h"
+#include "optimizer/cfg.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// 优化的 pass 和按优化等级组织它们的 PassManager
+namespace miniplc0 {
+
+    class Pass {
+    public:
+        virtual ~Pass() = default;
+        virtual const char* name() const = 0;
+        // 返回有没有改动
+        // 同一个 pass 会被多个线程同时用来优化不同的函数，所以不能有可变的状态
+        virtual bool run(ControlFlowGraph& graph) const = 0;
+    };
+
+    // 在生成的指令上运行的 pass，每次处理一个函数的指令
+    // 跳转的目标是函数内指令的下标
+    class InstructionPass {
+    public:
+        virtual ~InstructionPass() = default;
+        virtual const char* name() const = 0;
+        virtual bool run(std::vector<Instruction>& function) const = 0;
+    };
+
+    class PassManager final {
+    public:
+        // -O0 什么都不做
+        // -O1 常量传播、复制传播、死存储删除、不可达代码删除，最后在指令上做窥孔优化
+        // -O2 再加上循环不变量外提和公共子表达式删除
+        // inlineBudget 是内联之后函数体最多的指令数，0 不内联
+        explicit PassManager(int level, int inlineBudget = 0);
+        PassManager(const PassManager&) = delete;
+        PassManager& operator=(const PassManager&) = delete;
+
+        int level() const { return _level; }
+        int inlineBudget() const { return _inlineBudget; }
+        void add(std::unique_ptr<Pass> pass);
+        void add(std::unique_ptr<InstructionPass> pass);
+        void run(ControlFlowGraph& graph);
+        void run(std::vector<Instruction>& function);
+
+        // 每个 pass 累计的时间
+        void printTimings(std::ostream& out) const;
+
+    private:
+        // 两种 pass 只有一个不为空
+        struct Entry {
+            std::unique_ptr<Pass> pass;
+            std::unique_ptr<InstructionPass> instructionPass;
+            std::atomic<std::uint64_t> nanoseconds{0};
+            std::atomic<std::uint64_t> runs{0};
+            std::atomic<std::uint64_t> changes{0};
+        };
+        int _level;
+        int _inlineBudget;
+        std::vector<std::unique_ptr<Entry>> _passes;
+    };
+
+}
+
+#endif //CC0_PASSMANAGER_H
@@ -0,0 +1,640 @@
+#include "passes.h"
+#include "optimizer/expression.h"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+namespace miniplc0 {
+
+    namespace {
+        using Rewrite = std::function<Expression*(Expression*)>;
+
+        // 改写语句里的每个表达式，有改动的话返回新的语句，否则返回原来的
+        Statement* rewriteStatement(Statement* statement, Arena& arena, const Rewrite& rewrite) {
+            switch (statement->kind) {
+                case Statement::Kind::Declaration:
+                case Statement::Kind::Assign:
+                case Statement::Kind::Call: {
+                    if (!statement->expression)
+                        return statement;
+                    auto e = rewrite(statement->expression);
+                    if (e == statement->expression)
+                        return statement;
+                    auto result = arena.make<Statement>(*statement);
+                    result->expression = e;
+                    return result;
+                }
+                case Statement::Kind::Print: {
+                    std::vector<Expression*> printables;
+                    bool changed = false;
+                    for (auto e : statement->printables) {
+                        printables.push_back(rewrite(e));
+                        changed = changed || printables.back() != e;
+                    }
+                    if (!changed)
+                        return statement;
+                    auto result = arena.make<Statement>(*statement);
+                    result->printables = arena.copy(printables);
+                    return result;
+                }
+                default:
+                    return statement;
+            }
+        }
+
+        // 改写基本块出口上的表达式，返回有没有改动
+        bool rewriteExit(BasicBlock& block, const Rewrite& rewrite) {
+            bool changed = false;
+            const auto apply = [&](Expression*& e) {
+                if (!e)
+                    return;
+                auto replaced = rewrite(e);
+                changed = changed || replaced != e;
+                e = replaced;
+            };
+            if (block.exit == BasicBlock::Exit::Branch) {
+                apply(block.condition.lhs);
+                apply(block.condition.rhs);
+            }
+            else if (block.exit == BasicBlock::Exit::Return)
+                apply(block.value);
+            return changed;
+        }
+
+        // 依次访问基本块里的每个表达式（不进入子表达式）
+        void forEachExpression(const BasicBlock& block, const std::function<void(const Expression*)>& visit) {
+            for (auto s : block.statements) {
+                if (s->kind == Statement::Kind::Print) {
+                    for (auto e : s->printables)
+                        visit(e);
+                }
+                else if (s->expression)
+                    visit(s->expression);
+            }
+            if (block.exit == BasicBlock::Exit::Branch) {
+                visit(block.condition.lhs);
+                if (block.condition.rhs)
+                    visit(block.condition.rhs);
+            }
+            else if (block.exit == BasicBlock::Exit::Return && block.value)
+                visit(block.value);
+        }
+
+        void forEachLocalRead(const BasicBlock& block, const std::function<void(int)>& visit) {
+            if (block.exit == BasicBlock::Exit::Branch) {
+                miniplc0::forEachLocalRead(block.condition.lhs, visit);
+                if (block.condition.rhs)
+                    miniplc0::forEachLocalRead(block.condition.rhs, visit);
+            }
+            else if (block.exit == BasicBlock::Exit::Return && block.value)
+                miniplc0::forEachLocalRead(block.value, visit);
+        }
+
+        Statement* makeAssign(Arena& arena, int offset, Expression* value) {
+            auto s = arena.make<Statement>();
+            s->kind = Statement::Kind::Assign;
+            s->level = 0;
+            s->offset = offset;
+            s->expression = value;
+            return s;
+        }
+
+        // 条件跳转变成无条件跳转
+        void makeJump(BasicBlock& block, int target) {
+            block.exit = BasicBlock::Exit::Jump;
+            block.target = target;
+            block.otherwise = -1;
+            block.condition = {nullptr, TokenType::NULL_TOKEN, nullptr};
+        }
+
+        // 正向数据流分析的框架
+        // State 要能比较相等，meet 把 from 合并进 into
+        template<typename State, typename Meet, typename Transfer>
+        std::vector<State> forward(const ControlFlowGraph& graph, const State& entry, const State& top,
+                                   Meet meet, Transfer transfer) {
+            auto order = graph.reversePostOrder();
+            std::vector<State> in(graph.blocks.size(), top);
+            std::vector<bool> reached(graph.blocks.size(), false);
+            in[0] = entry;
+            reached[0] = true;
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (auto b : order) {
+                    if (!reached[b])
+                        continue;
+                    State out = in[b];
+                    for (auto s : graph.blocks[b].statements)
+                        transfer(s, out);
+                    for (auto n : graph.successors(b)) {
+                        if (!reached[n]) {
+                            reached[n] = true;
+                            in[n] = out;
+                            changed = true;
+                        }
+                        else if (meet(in[n], out))
+                            changed = true;
+                    }
+                }
+            }
+            return in;
+        }
+    }
+
+    // 常量传播
+    // 每个局部变量的格：未定义 < 常量 < 不确定
+    // 入口处参数和所有的局部变量都当作不确定，声明和赋值之后才可能是常量
+    bool ConstantPropagation::run(ControlFlowGraph& graph) const {
+        struct Value {
+            bool varying;
+            int32_t value;
+            bool operator==(const Value& rhs) const { return varying == rhs.varying && value == rhs.value; }
+        };
+        using State = std::vector<Value>;
+        auto& arena = *graph.arena;
+        const auto rewriteWith = [&arena](const State& state) -> Rewrite {
+            return [&arena, &state](Expression* e) {
+                return transform(e, arena, [&arena, &state](Expression* x) -> Expression* {
+                    if (isLocal(x) && !state[x->offset].varying)
+                        return makeLiteral(arena, state[x->offset].value);
+                    return foldConstant(x, arena);
+                });
+            };
+        };
+        std::function<std::optional<int32_t>(const Expression*, const State&)> valueOf =
+                [&valueOf](const Expression* e, const State& state) -> std::optional<int32_t> {
+            switch (e->kind) {
+                case Expression::Kind::Literal:
+                    return e->value;
+                case Expression::Kind::Variable:
+                    if (isLocal(e) && !state[e->offset].varying)
+                        return state[e->offset].value;
+                    return {};
+                case Expression::Kind::Negate: {
+                    auto value = valueOf(e->lhs, state);
+                    if (!value.has_value())
+                        return {};
+                    return static_cast<int32_t>(0u - static_cast<uint32_t>(value.value()));
+                }
+                case Expression::Kind::Binary: {
+                    auto lhs = valueOf(e->lhs, state);
+                    auto rhs = lhs.has_value() ? valueOf(e->rhs, state) : std::nullopt;
+                    if (!rhs.has_value())
+                        return {};
+                    return fold(e->op, lhs.value(), rhs.value());
+                }
+                default:
+                    return {};
+            }
+        };
+        const auto transfer = [&valueOf](Statement* s, State& state) {
+            auto slot = localWritten(s);
+            if (slot < 0)
+                return;
+            std::optional<int32_t> value;
+            if (s->kind != Statement::Kind::Scan && s->expression)
+                value = valueOf(s->expression, state);
+            state[slot] = value.has_value() ? Value{false, value.value()} : Value{true, 0};
+        };
+        const auto meet = [](State& into, const State& from) {
+            bool changed = false;
+            for (std::size_t i = 0; i < into.size(); i++) {
+                if (!into[i].varying && !(into[i] == from[i])) {
+                    into[i] = {true, 0};
+                    changed = true;
+                }
+            }
+            return changed;
+        };
+        auto slots = static_cast<std::size_t>(graph.slotCount());
+        State varying(slots, {true, 0});
+        auto in = forward(graph, varying, varying, meet, transfer);
+
+        bool changed = false;
+        for (auto b : graph.reversePostOrder()) {
+            auto& block = graph.blocks[b];
+            auto state = in[b];
+            for (auto& s : block.statements) {
+                auto rewritten = rewriteStatement(s, arena, rewriteWith(state));
+                changed = changed || rewritten != s;
+                s = rewritten;
+                transfer(s, state);
+            }
+            changed = rewriteExit(block, rewriteWith(state)) || changed;
+            if (block.exit == BasicBlock::Exit::Branch) {
+                auto taken = evaluate(block.condition);
+                if (taken.has_value()) {
+                    makeJump(block, taken.value() ? block.target : block.otherwise);
+                    changed = true;
+                }
+            }
+        }
+        return changed;
+    }
+
+    // 复制传播
+    // copies[x] == y 表示 x 现在的值就是 y 的值，-1 表示没有
+    bool CopyPropagation::run(ControlFlowGraph& graph) const {
+        using State = std::vector<int>;
+        auto& arena = *graph.arena;
+        const auto transfer = [](Statement* s, State& copies) {
+            auto slot = localWritten(s);
+            if (slot < 0)
+                return;
+            for (auto& c : copies)
+                if (c == slot)
+                    c = -1;
+            copies[slot] = -1;
+            if (s->kind != Statement::Kind::Scan && s->expression
+                && isLocal(s->expression) && s->expression->offset != slot)
+                copies[slot] = s->expression->offset;
+        };
+        const auto meet = [](State& into, const State& from) {
+            bool changed = false;
+            for (std::size_t i = 0; i < into.size(); i++) {
+                if (into[i] >= 0 && into[i] != from[i]) {
+                    into[i] = -1;
+                    changed = true;
+                }
+            }
+            return changed;
+        };
+        State none(static_cast<std::size_t>(graph.slotCount()), -1);
+        auto in = forward(graph, none, none, meet, transfer);
+
+        bool changed = false;
+        for (auto b : graph.reversePostOrder()) {
+            auto& block = graph.blocks[b];
+            auto copies = in[b];
+            const Rewrite rewrite = [&](Expression* e) {
+                return transform(e, arena, [&](Expression* x) -> Expression* {
+                    if (isLocal(x) && copies[x->offset] >= 0)
+                        return makeLocal(arena, copies[x->offset]);
+                    return nullptr;
+                });
+            };
+            for (auto& s : block.statements) {
+                auto rewritten = rewriteStatement(s, arena, rewrite);
+                changed = changed || rewritten != s;
+                s = rewritten;
+                transfer(s, copies);
+            }
+            changed = rewriteExit(block, rewrite) || changed;
+        }
+        return changed;
+    }
+
+    // 死存储删除
+    // 逆向的活跃变量分析，只删对局部变量的赋值
+    // 声明会分配栈空间，输入会读 stdin，都不能删
+    bool DeadStoreElimination::run(ControlFlowGraph& graph) const {
+        using State = std::vector<bool>;
+        auto slots = static_cast<std::size_t>(graph.slotCount());
+        auto order = graph.reversePostOrder();
+        bool changed = false;
+        bool removed = true;
+        while (removed) {
+            removed = false;
+            std::vector<State> liveIn(graph.blocks.size(), State(slots, false));
+            const auto liveOut = [&](int b) {
+                State live(slots, false);
+                for (auto n : graph.successors(b))
+                    for (std::size_t i = 0; i < slots; i++)
+                        if (liveIn[n][i])
+                            live[i] = true;
+                forEachLocalRead(graph.blocks[b], [&live](int slot) { live[slot] = true; });
+                return live;
+            };
+            const auto step = [](const Statement* s, State& live) {
+                auto slot = localWritten(s);
+                if (slot >= 0)
+                    live[slot] = false;
+                forEachLocalRead(s, [&live](int read) { live[read] = true; });
+            };
+            bool iterate = true;
+            while (iterate) {
+                iterate = false;
+                for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                    auto live = liveOut(*it);
+                    auto& statements = graph.blocks[*it].statements;
+                    for (auto s = statements.rbegin(); s != statements.rend(); ++s)
+                        step(*s, live);
+                    if (live != liveIn[*it]) {
+                        liveIn[*it] = std::move(live);
+                        iterate = true;
+                    }
+                }
+            }
+            for (auto b : order) {
+                auto live = liveOut(b);
+                auto& statements = graph.blocks[b].statements;
+                std::vector<Statement*> kept;
+                for (auto s = statements.rbegin(); s != statements.rend(); ++s) {
+                    auto slot = localWritten(*s);
+                    if ((*s)->kind == Statement::Kind::Assign && slot >= 0 && !live[slot]
+                        && isPure((*s)->expression)) {
+                        removed = true;
+                        continue;
+                    }
+                    step(*s, live);
+                    kept.push_back(*s);
+                }
+                if (kept.size() != statements.size()) {
+                    std::reverse(kept.begin(), kept.end());
+                    statements = std::move(kept);
+                }
+            }
+            changed = changed || removed;
+        }
+        return changed;
+    }
+
+    bool UnreachableCodeElimination::run(ControlFlowGraph& graph) const {
+        bool changed = false;
+        auto count = static_cast<int>(graph.blocks.size());
+        // 空的、只有一个无条件跳转的基本块，沿着它一直找到真正的目标
+        const auto destination = [&](int b) {
+            for (int steps = 0; steps < count; steps++) {
+                auto& block = graph.blocks[b];
+                if (!block.statements.empty() || block.exit != BasicBlock::Exit::Jump || block.target == b)
+                    break;
+                b = block.target;
+            }
+            return b;
+        };
+        for (auto& block : graph.blocks) {
+            if (block.exit == BasicBlock::Exit::Return)
+                continue;
+            auto target = destination(block.target);
+            if (target != block.target) {
+                block.target = target;
+                changed = true;
+            }
+            if (block.exit != BasicBlock::Exit::Branch)
+                continue;
+            auto otherwise = destination(block.otherwise);
+            if (otherwise != block.otherwise) {
+                block.otherwise = otherwise;
+                changed = true;
+            }
+            // 两边去同一个地方，条件没有副作用的话就不用算了
+            if (block.target == block.otherwise && isPure(block.condition.lhs)
+                && (!block.condition.rhs || isPure(block.condition.rhs))) {
+                makeJump(block, block.target);
+                changed = true;
+            }
+        }
+        return graph.removeUnreachable() || changed;
+    }
+
+    // 循环不变量外提
+    // 回边的目标是循环头，从回边的起点逆着走到循环头得到循环体
+    // 先处理里层的循环，外提到循环头前新建的前置块里，前置块也属于外层循环
+    bool LoopInvariantCodeMotion::run(ControlFlowGraph& graph) const {
+        auto& arena = *graph.arena;
+        auto idom = graph.dominators();
+        auto preds = graph.predecessors();
+        struct Loop {
+            int header;
+            std::set<int> body;
+        };
+        std::vector<Loop> loops;
+        for (int b = 0; b < static_cast<int>(graph.blocks.size()); b++) {
+            for (auto h : graph.successors(b)) {
+                if (!graph.dominates(idom, h, b))
+                    continue;
+                auto loop = std::find_if(loops.begin(), loops.end(), [h](const Loop& l) { return l.header == h; });
+                if (loop == loops.end()) {
+                    loops.push_back({h, {h}});
+                    loop = loops.end() - 1;
+                }
+                std::vector<int> work{b};
+                while (!work.empty()) {
+                    auto n = work.back();
+                    work.pop_back();
+                    if (!loop->body.insert(n).second)
+                        continue;
+                    for (auto p : preds[n])
+                        work.push_back(p);
+                }
+            }
+        }
+        // 循环头靠后的循环不会包含靠前的循环头，从后往前就是先里层
+        std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) { return a.header > b.header; });
+
+        bool changed = false;
+        for (std::size_t l = 0; l < loops.size(); l++) {
+            auto& loop = loops[l];
+            std::set<int> defined;
+            bool writesGlobal = false;
+            bool calls = false;
+            for (auto b : loop.body) {
+                for (auto s : graph.blocks[b].statements) {
+                    auto slot = localWritten(s);
+                    if (slot >= 0)
+                        defined.insert(slot);
+                    else if (s->kind == Statement::Kind::Assign || s->kind == Statement::Kind::Scan)
+                        writesGlobal = true;
+                    if (s->kind == Statement::Kind::Call)
+                        calls = true;
+                }
+                forEachExpression(graph.blocks[b], [&calls](const Expression* e) { calls = calls || hasCall(e); });
+            }
+            const auto invariant = [&](const Expression* e) {
+                if (!isPure(e) || cost(e) < 3 || e->kind == Expression::Kind::Literal)
+                    return false;
+                if (readsGlobal(e) && (writesGlobal || calls))
+                    return false;
+                bool result = true;
+                forEachLocalRead(e, [&](int slot) { result = result && defined.count(slot) == 0; });
+                return result;
+            };
+
+            // 外提的表达式和存放它的临时变量
+            std::vector<std::pair<Expression*, int>> hoisted;
+            std::function<Expression*(Expression*)> replace = [&](Expression* e) -> Expression* {
+                if (invariant(e)) {
+                    auto found = std::find_if(hoisted.begin(), hoisted.end(),
+                                              [e](const std::pair<Expression*, int>& h) { return equal(h.first, e); });
+                    if (found == hoisted.end()) {
+                        hoisted.emplace_back(e, graph.newTemporary());
+                        found = hoisted.end() - 1;
+                    }
+                    return makeLocal(arena, found->second);
+                }
+                Expression* result = e;
+                if (e->kind == Expression::Kind::Negate || e->kind == Expression::Kind::Binary) {
+                    auto lhs = replace(e->lhs);
+                    auto rhs = e->rhs ? replace(e->rhs) : nullptr;
+                    if (lhs != e->lhs || rhs != e->rhs) {
+                        result = arena.make<Expression>(*e);
+                        result->lhs = lhs;
+                        result->rhs = rhs;
+                    }
+                }
+                else if (e->kind == Expression::Kind::Call) {
+                    std::vector<Expression*> arguments;
+                    bool replaced = false;
+                    for (auto a : e->arguments) {
+                        arguments.push_back(replace(a));
+                        replaced = replaced || arguments.back() != a;
+                    }
+                    if (replaced) {
+                        result = arena.make<Expression>(*e);
+                        result->arguments = arena.copy(arguments);
+                    }
+                }
+                return result;
+            };
+            for (auto b : loop.body) {
+                for (auto& s : graph.blocks[b].statements)
+                    s = rewriteStatement(s, arena, replace);
+                rewriteExit(graph.blocks[b], replace);
+            }
+            if (hoisted.empty())
+                continue;
+
+            // 前置块放在循环头的前面，循环外进入循环头的边都改到前置块
+            auto preheader = graph.insertBlock(loop.header);
+            auto header = preheader + 1;
+            for (auto& other : loops) {
+                // 包含这个循环头的外层循环也包含前置块
+                bool contains = &other != &loop && other.body.count(preheader) != 0;
+                if (other.header >= preheader)
+                    other.header++;
+                std::set<int> shifted;
+                for (auto b : other.body)
+                    shifted.insert(b >= preheader ? b + 1 : b);
+                if (contains)
+                    shifted.insert(preheader);
+                other.body = std::move(shifted);
+            }
+            for (int b = 0; b < static_cast<int>(graph.blocks.size()); b++) {
+                if (b == preheader || loop.body.count(b))
+                    continue;
+                auto& block = graph.blocks[b];
+                if (block.exit == BasicBlock::Exit::Return)
+                    continue;
+                if (block.target == header)
+                    block.target = preheader;
+                if (block.exit == BasicBlock::Exit::Branch && block.otherwise == header)
+                    block.otherwise = preheader;
+            }
+            auto& block = graph.blocks[preheader];
+            for (auto& [e, temporary] : hoisted)
+                block.statements.push_back(makeAssign(arena, temporary, e));
+            block.target = header;
+            changed = true;
+        }
+        return changed;
+    }
+
+    // 基本块内的公共子表达式删除
+    // 变量每被写一次版本号加一，结构相同、读到的变量版本也相同的表达式值相同
+    // 每次选收益最大的一组，在第一次出现之前算到临时变量里，其他地方都读这个临时变量
+    bool CommonSubexpressionElimination::run(ControlFlowGraph& graph) const {
+        auto& arena = *graph.arena;
+        struct Occurrence {
+            Expression* expression;
+            std::size_t statement;
+            std::vector<std::pair<int, int>> versions;
+        };
+        bool changed = false;
+        for (auto& block : graph.blocks) {
+            // 每一轮至少少算一个表达式，轮数有上限
+            for (int round = 0; round < 64; round++) {
+                std::vector<int> version(static_cast<std::size_t>(graph.slotCount()), 0);
+                std::unordered_map<std::size_t, std::vector<std::vector<Occurrence>>> groups;
+                std::function<void(Expression*, std::size_t)> collect = [&](Expression* e, std::size_t at) {
+                    if (isPure(e) && !readsGlobal(e) && cost(e) >= 3
+                        && (e->kind == Expression::Kind::Negate || e->kind == Expression::Kind::Binary)) {
+                        Occurrence occurrence{e, at, {}};
+                        forEachLocalRead(e, [&](int slot) { occurrence.versions.emplace_back(slot, version[slot]); });
+                        auto& bucket = groups[hash(e)];
+                        auto group = std::find_if(bucket.begin(), bucket.end(), [&](const std::vector<Occurrence>& g) {
+                            return g.front().versions == occurrence.versions && equal(g.front().expression, e);
+                        });
+                        if (group == bucket.end())
+                            bucket.push_back({occurrence});
+                        else
+                            group->push_back(occurrence);
+                    }
+                    if (e->kind == Expression::Kind::Negate || e->kind == Expression::Kind::Binary) {
+                        collect(e->lhs, at);
+                        if (e->rhs)
+                            collect(e->rhs, at);
+                    }
+                    else if (e->kind == Expression::Kind::Call)
+                        for (auto a : e->arguments)
+                            collect(a, at);
+                };
+                for (std::size_t i = 0; i < block.statements.size(); i++) {
+                    auto s = block.statements[i];
+                    // 声明的初始值就是变量的空间，不能在它前面插入语句
+                    if (s->kind != Statement::Kind::Declaration) {
+                        if (s->kind == Statement::Kind::Print) {
+                            for (auto e : s->printables)
+                                collect(e, i);
+                        }
+                        else if (s->expression)
+                            collect(s->expression, i);
+                    }
+                    auto slot = localWritten(s);
+                    if (slot >= 0)
+                        version[slot]++;
+                }
+                auto end = block.statements.size();
+                if (block.exit == BasicBlock::Exit::Branch) {
+                    collect(block.condition.lhs, end);
+                    if (block.condition.rhs)
+                        collect(block.condition.rhs, end);
+                }
+                else if (block.exit == BasicBlock::Exit::Return && block.value)
+                    collect(block.value, end);
+
+                // 原来算 n 次，现在算一次加上一次存、n 次读（各两条指令）
+                const std::vector<Occurrence>* best = nullptr;
+                int bestBenefit = 0;
+                for (auto& [h, bucket] : groups) {
+                    for (auto& group : bucket) {
+                        if (group.size() < 2)
+                            continue;
+                        int n = static_cast<int>(group.size());
+                        int c = cost(group.front().expression);
+                        int benefit = (n - 1) * c - 2 * n - 2;
+                        if (benefit > bestBenefit) {
+                            best = &group;
+                            bestBenefit = benefit;
+                        }
+                    }
+                }
+                if (!best)
+                    break;
+
+                auto temporary = graph.newTemporary();
+                std::set<const Expression*> targets;
+                for (auto& o : *best)
+                    targets.insert(o.expression);
+                auto first = best->front();
+                std::function<Expression*(Expression*)> replace = [&](Expression* e) -> Expression* {
+                    if (targets.count(e))
+                        return makeLocal(arena, temporary);
+                    return transform(e, arena, [&](Expression* x) -> Expression* {
+                        return targets.count(x) ? makeLocal(arena, temporary) : nullptr;
+                    });
+                };
+                for (auto& s : block.statements)
+                    s = rewriteStatement(s, arena, replace);
+                rewriteExit(block, replace);
+                block.statements.insert(block.statements.begin() + static_cast<std::ptrdiff_t>(first.statement),
+                                        makeAssign(arena, temporary, first.expression));
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+}
@@ -0,0 +1,64 @@
+#ifndef CC0_PASSES_H
+#define CC0_PASSES_H
+
+#include "optimizer/passManager.h"
+
+// 所有的优化 pass
+// 数据流分析只针对局部变量：c0 里局部变量的地址不会传出 loada，
+// 一个变量的所有定义和使用在控制流图上都是可见的，函数调用也改不了调用者的局部变量
+namespace miniplc0 {
+
+    // 常量传播：到达某处的定义都是同一个常量的变量换成这个常量，然后折叠
+    // 条件是常量的条件跳转变成无条件跳转
+    class ConstantPropagation final : public Pass {
+    public:
+        const char* name() const override { return "constant-propagation"; }
+        bool run(ControlFlowGraph& graph) const override;
+    };
+
+    // 复制传播：x = y 之后，x 和 y 都没有被重新赋值的地方把 x 换成 y
+    class CopyPropagation final : public Pass {
+    public:
+        const char* name() const override { return "copy-propagation"; }
+        bool run(ControlFlowGraph& graph) const override;
+    };
+
+    // 死存储删除：赋值之后不再被读的局部变量，右边没有副作用的话删掉这个赋值
+    class DeadStoreElimination final : public Pass {
+    public:
+        const char* name() const override { return "dead-store-elimination"; }
+        bool run(ControlFlowGraph& graph) const override;
+    };
+
+    // 删掉不可达的基本块，只有一个跳转的空基本块让前驱直接跳过去
+    class UnreachableCodeElimination final : public Pass {
+    public:
+        const char* name() const override { return "unreachable-code-elimination"; }
+        bool run(ControlFlowGraph& graph) const override;
+    };
+
+    // 循环不变量外提：while 循环里值不变的表达式在循环前算到临时变量里
+    class LoopInvariantCodeMotion final : public Pass {
+    public:
+        const char* name() const override { return "loop-invariant-code-motion"; }
+        bool run(ControlFlowGraph& graph) const override;
+    };
+
+    // 公共子表达式删除：基本块里重复计算的表达式只算一次，存到临时变量里
+    class CommonSubexpressionElimination final : public Pass {
+    public:
+        const char* name() const override { return "common-subexpression-elimination"; }
+        bool run(ControlFlowGraph& graph) const override;
+    };
+
+    // 窥孔优化：存了马上又读的变量用 dup 留一份地址、跳到跳转的跳转直接跳到最终目标、
+    // 删掉执行不到的指令、化简和 0 比较以及条件是常量的跳转
+    class PeepholeOptimization final : public InstructionPass {
+    public:
+        const char* name() const override { return "peephole"; }
+        bool run(std::vector<Instruction>& function) const override;
+    };
+
+}
+
+#endif //CC0_PASSES_H
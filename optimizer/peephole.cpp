@@ -0,0 +1,276 @@
+#include "passes.h"
+#include "codegen/codeGenerator.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+namespace miniplc0 {
+
+    namespace {
+        // 操作数最多两个，不用 vector 省掉每条指令的分配
+        struct Code {
+            Operation opr;
+            std::array<int, 2> operand;
+            std::size_t count;
+        };
+        using Function = std::vector<Code>;
+
+        bool isJump(Operation opr) {
+            return opr >= Operation::JMP && opr <= Operation::JLE;
+        }
+        bool isConditional(Operation opr) {
+            return opr >= Operation::JE && opr <= Operation::JLE;
+        }
+        // 之后的指令不会接着执行
+        bool isReturn(Operation opr) {
+            return opr == Operation::RET || opr == Operation::IRET || opr == Operation::TAILCALL;
+        }
+        bool isPush(const Code& code, int32_t& value) {
+            if (code.opr != Operation::BIPUSH && code.opr != Operation::IPUSH)
+                return false;
+            value = code.operand[0];
+            return true;
+        }
+
+        // 和 0 比较，条件跳转用栈顶的值判断
+        bool taken(Operation opr, int32_t value) {
+            switch (opr) {
+                case Operation::JE:
+                    return value == 0;
+                case Operation::JNE:
+                    return value != 0;
+                case Operation::JL:
+                    return value < 0;
+                case Operation::JGE:
+                    return value >= 0;
+                case Operation::JG:
+                    return value > 0;
+                case Operation::JLE:
+                    return value <= 0;
+                default:
+                    return true;
+            }
+        }
+
+        // 表达式里可能出现的指令对栈的影响，其他指令返回空
+        std::optional<int> stackEffect(Operation opr) {
+            switch (opr) {
+                case Operation::BIPUSH:
+                case Operation::IPUSH:
+                case Operation::LOADA:
+                case Operation::LOADC:
+                case Operation::DUP:
+                case Operation::ISCAN:
+                    return 1;
+                case Operation::ILOAD:
+                case Operation::INEG:
+                    return 0;
+                case Operation::IADD:
+                case Operation::ISUB:
+                case Operation::IMUL:
+                case Operation::IDIV:
+                case Operation::ICMP:
+                    return -1;
+                default:
+                    return {};
+            }
+        }
+
+        std::vector<bool> jumpTargets(const Function& f) {
+            std::vector<bool> targets(f.size() + 1, false);
+            for (auto& code : f)
+                if (isJump(code.opr))
+                    targets[code.operand[0]] = true;
+            return targets;
+        }
+
+        // 改写时按顺序把留下的指令放进 out，where[i] 是原来第 i 条指令之后的位置
+        // 被删掉的指令只要不是跳转目标，跳到它的位置就等于跳到下一条留下的指令
+        struct Rewriter {
+            const Function& f;
+            Function out;
+            std::vector<int> where;
+
+            explicit Rewriter(const Function& function) : f(function), where(function.size() + 1, 0) {}
+            void mark(std::size_t i) { where[i] = static_cast<int>(out.size()); }
+            void emit(Code code) { out.push_back(std::move(code)); }
+            Function finish() {
+                where[f.size()] = static_cast<int>(out.size());
+                for (auto& code : out)
+                    if (isJump(code.opr))
+                        code.operand[0] = where[code.operand[0]];
+                return std::move(out);
+            }
+        };
+
+        // 跳到 jmp 的跳转直接跳到最终目标，跳到返回的 jmp 直接返回
+        bool threadJumps(Function& f) {
+            bool changed = false;
+            for (auto& code : f) {
+                if (!isJump(code.opr))
+                    continue;
+                auto target = code.operand[0];
+                for (std::size_t steps = 0; steps < f.size(); steps++) {
+                    if (target >= static_cast<int>(f.size()) || f[target].opr != Operation::JMP
+                        || f[target].operand[0] == target)
+                        break;
+                    target = f[target].operand[0];
+                }
+                if (target != code.operand[0]) {
+                    code.operand[0] = target;
+                    changed = true;
+                }
+                if (code.opr == Operation::JMP && target < static_cast<int>(f.size()) && isReturn(f[target].opr)) {
+                    code = f[target];
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        // 删掉从第一条指令开始执行不到的指令
+        bool removeUnreachable(Function& f) {
+            std::vector<bool> reachable(f.size() + 1, false);
+            std::vector<int> work{0};
+            while (!work.empty()) {
+                auto i = work.back();
+                work.pop_back();
+                if (i >= static_cast<int>(f.size()) || reachable[i])
+                    continue;
+                reachable[i] = true;
+                if (isJump(f[i].opr))
+                    work.push_back(f[i].operand[0]);
+                if (f[i].opr != Operation::JMP && !isReturn(f[i].opr))
+                    work.push_back(i + 1);
+            }
+            if (std::find(reachable.begin(), reachable.begin() + static_cast<std::ptrdiff_t>(f.size()), false)
+                == reachable.begin() + static_cast<std::ptrdiff_t>(f.size()))
+                return false;
+            Rewriter rewriter(f);
+            for (std::size_t i = 0; i < f.size(); i++) {
+                rewriter.mark(i);
+                if (reachable[i])
+                    rewriter.emit(f[i]);
+            }
+            f = rewriter.finish();
+            return true;
+        }
+
+        // loada a; <值>; istore; loada a; iload
+        // => loada a; dup; <值>; istore; iload
+        // 返回 <值> 之前的那条 loada 的位置，不能转换的话为 -1
+        int forwardedStore(const Function& f, const std::vector<bool>& targets, std::size_t store) {
+            if (store + 2 >= f.size() || f[store + 1].opr != Operation::LOADA || f[store + 2].opr != Operation::ILOAD
+                || targets[store] || targets[store + 1] || targets[store + 2])
+                return -1;
+            // 往前找到恰好算出一个值的那一段
+            int net = 0;
+            for (auto i = static_cast<int>(store) - 1; i > 0; i--) {
+                auto effect = stackEffect(f[i].opr);
+                if (!effect.has_value() || targets[i])
+                    return -1;
+                net += effect.value();
+                if (net == 1) {
+                    auto& address = f[i - 1];
+                    if (address.opr == Operation::LOADA && address.operand == f[store + 1].operand)
+                        return i - 1;
+                    return -1;
+                }
+            }
+            return -1;
+        }
+
+        bool simplify(Function& f) {
+            auto targets = jumpTargets(f);
+            std::vector<bool> duplicate(f.size(), false);
+            std::vector<bool> forwarded(f.size(), false);
+            for (std::size_t i = 0; i < f.size(); i++) {
+                if (f[i].opr != Operation::ISTORE)
+                    continue;
+                auto address = forwardedStore(f, targets, i);
+                if (address >= 0) {
+                    duplicate[address] = true;
+                    forwarded[i + 1] = true;
+                }
+            }
+
+            bool changed = false;
+            Rewriter rewriter(f);
+            for (std::size_t i = 0; i < f.size(); i++) {
+                rewriter.mark(i);
+                auto& code = f[i];
+                int32_t value;
+                if (forwarded[i]) {
+                    changed = true;
+                    continue;
+                }
+                if (duplicate[i]) {
+                    rewriter.emit(code);
+                    rewriter.emit({Operation::DUP, {}, 0});
+                    changed = true;
+                    continue;
+                }
+                // 和 0 比较的结果与原来的值符号相同：push 0; icmp; jcc => jcc
+                if (isPush(code, value) && value == 0 && i + 2 < f.size()
+                    && f[i + 1].opr == Operation::ICMP && isConditional(f[i + 2].opr)
+                    && !targets[i + 1] && !targets[i + 2]) {
+                    rewriter.mark(i + 1);
+                    i++;
+                    changed = true;
+                    continue;
+                }
+                // 条件是常量的跳转
+                if (isPush(code, value) && i + 1 < f.size() && isConditional(f[i + 1].opr) && !targets[i + 1]) {
+                    rewriter.mark(i + 1);
+                    if (taken(f[i + 1].opr, value))
+                        rewriter.emit({Operation::JMP, f[i + 1].operand, 1});
+                    i++;
+                    changed = true;
+                    continue;
+                }
+                // 跳到下一条指令
+                if (isJump(code.opr) && code.operand[0] == static_cast<int>(i) + 1) {
+                    if (isConditional(code.opr))
+                        rewriter.emit({Operation::POP, {}, 0});
+                    changed = true;
+                    continue;
+                }
+                rewriter.emit(code);
+            }
+            if (changed)
+                f = rewriter.finish();
+            return changed;
+        }
+    }
+
+    bool PeepholeOptimization::run(std::vector<Instruction>& function) const {
+        Function f;
+        f.reserve(function.size());
+        for (auto& instruction : function) {
+            auto operand = instruction.getOperand();
+            Code code{instruction.getOpr(), {}, operand.size()};
+            std::copy(operand.begin(), operand.end(), code.operand.begin());
+            f.push_back(code);
+        }
+        bool changed = false;
+        // 一种改写可能让另一种改写变得可行，直到没有变化为止
+        for (int round = 0; round < 8; round++) {
+            bool any = threadJumps(f);
+            any = removeUnreachable(f) || any;
+            any = simplify(f) || any;
+            if (!any)
+                break;
+            changed = true;
+        }
+        if (!changed)
+            return false;
+        function.clear();
+        for (std::size_t i = 0; i < f.size(); i++) {
+            std::vector<int> operand(f[i].operand.begin(), f[i].operand.begin() + static_cast<std::ptrdiff_t>(f[i].count));
+            function.push_back(CodeGenerator::makeInstruction(f[i].opr, std::move(operand), static_cast<int>(i)));
+        }
+        return true;
+    }
+
+}
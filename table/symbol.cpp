@@ -17,4 +17,8 @@ namespace miniplc0 {
         return offset;
     }
 
+    std::optional<int> Symbol::getValue() {
+        return value;
+    }
+
 }
\ No newline at end of file
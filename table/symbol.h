@@ -5,6 +5,7 @@
 #ifndef CC0_SYMBOL_H
 #define CC0_SYMBOL_H
 
+#include <optional>
 #include <string>
 #include <utility>
 
@@ -18,14 +19,17 @@ namespace miniplc0 {
         std::string name;
         int level;
         int offset;
+        // 用字面量初始化的常量，编译期就知道它的值
+        std::optional<int> value;
     public:
-        Symbol(std::string _name, int _level, int _offset)
-            : name(std::move(_name)), level(_level), offset(_offset) {}
+        Symbol(std::string _name, int _level, int _offset, std::optional<int> _value = {})
+            : name(std::move(_name)), level(_level), offset(_offset), value(_value) {}
 
     public:
         std::string getName();
         int getLevel();
         int getOffset();
+        std::optional<int> getValue();
     };
 
 }
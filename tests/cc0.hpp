@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs the cc0 built along with the tests (CC0_PATH, set by CMake) in a directory of its own
+// that is removed afterwards, for what can only be checked through the command line.
+namespace cc0test {
+
+	struct Result {
+		int status;
+		std::string out;
+		std::string err;
+	};
+
+	class Workspace {
+	public:
+		Workspace() {
+			static std::atomic<int> count{0};
+			_dir = std::filesystem::temp_directory_path()
+				/ ("cc0-test-" + std::to_string(getpid()) + "-" + std::to_string(count++));
+			std::filesystem::create_directories(_dir);
+		}
+		Workspace(const Workspace&) = delete;
+		Workspace& operator=(const Workspace&) = delete;
+		~Workspace() {
+			std::error_code ec;
+			std::filesystem::remove_all(_dir, ec);
+		}
+
+		std::string path(const std::string& name) const {
+			return (_dir / name).string();
+		}
+		bool exists(const std::string& name) const {
+			return std::filesystem::exists(_dir / name);
+		}
+		std::string write(const std::string& name, const std::string& content) const {
+			std::ofstream(path(name), std::ios::out | std::ios::trunc | std::ios::binary) << content;
+			return path(name);
+		}
+		std::string read(const std::string& name) const {
+			std::ifstream in(path(name), std::ios::in | std::ios::binary);
+			return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		}
+
+		// the arguments are given to the shell as they are, relative paths are in the workspace
+		Result run(const std::string& args, const std::string& input = "") const {
+			write(".stdin", input);
+			auto command = "cd '" + _dir.string() + "' && '" CC0_PATH "' " + args + " <.stdin >.stdout 2>.stderr";
+			int status = std::system(command.c_str());
+			return Result{WIFEXITED(status) ? WEXITSTATUS(status) : -1, read(".stdout"), read(".stderr")};
+		}
+		// the .s0 of the source compiled with the flags
+		std::string assembly(const std::string& source, const std::string& flags = "") const {
+			write("asm.c0", source);
+			run("-s " + flags + " asm.c0 -o asm.s0");
+			return read("asm.s0");
+		}
+		// the source compiled with the flags and run on the input
+		Result execute(const std::string& source, const std::string& flags = "", const std::string& input = "",
+		               const std::string& runFlags = "") const {
+			write("run.c0", source);
+			auto compiled = run("-c " + flags + " run.c0 -o run.o0");
+			if (compiled.status != 0) {
+				return compiled;
+			}
+			return run("-r run.o0 " + runFlags, input);
+		}
+
+	private:
+		std::filesystem::path _dir;
+	};
+
+}
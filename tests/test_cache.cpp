@@ -0,0 +1,116 @@
+#include "catch2/catch.hpp"
+
+#include "cache/compileCache.h"
+#include "cache/sha256.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+namespace {
+
+struct CacheDirectory {
+	std::filesystem::path path = std::filesystem::temp_directory_path() / ("cc0-cache-" + std::to_string(getpid()));
+	~CacheDirectory() {
+		std::error_code ec;
+		std::filesystem::remove_all(path, ec);
+	}
+};
+
+}
+
+TEST_CASE("Storing a key again does not count its old output against the size limit.") {
+	CacheDirectory dir;
+	miniplc0::CompileCache cache(dir.path, 1000, "compiler");
+	std::string output(400, 'x');
+	cache.store("a", output);
+	cache.store("a", output);
+	// 800 bytes on disk, under the limit
+	cache.store("b", output);
+	REQUIRE(cache.lookup("a") == output);
+	REQUIRE(cache.lookup("b") == output);
+	std::ostringstream statistics;
+	cache.printStatistics(statistics);
+	REQUIRE(statistics.str() == "cache: 2 hits, 0 misses, 0 evicted\n");
+
+	// over the limit, the least recently used go until 3/4 of it are left
+	cache.store("c", output);
+	statistics.str("");
+	cache.printStatistics(statistics);
+	REQUIRE(statistics.str() != "cache: 2 hits, 0 misses, 0 evicted\n");
+}
+
+TEST_CASE("The key of a compilation depends on the compiler, the flags and the source.") {
+	CacheDirectory dir;
+	miniplc0::CompileCache cache(dir.path, 1000, "compiler");
+	miniplc0::CompileCache other(dir.path, 1000, "other compiler");
+	auto key = cache.key("int main() {}", "-c -O0");
+	REQUIRE(key == cache.key("int main() {}", "-c -O0"));
+	REQUIRE(key != cache.key("int main() {}", "-c -O1"));
+	REQUIRE(key != cache.key("int main() { }", "-c -O0"));
+	REQUIRE(key != other.key("int main() {}", "-c -O0"));
+	// the flags and the source do not run into each other
+	REQUIRE(cache.key("O0 int", "-c -") != cache.key("int", "-c -O0 "));
+}
+
+TEST_CASE("SHA-256 gives the digest of what it was fed however it was split.") {
+	REQUIRE(miniplc0::Sha256().hex() == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	REQUIRE(miniplc0::Sha256().update("abc").hex() == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	std::string message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	auto digest = "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1";
+	REQUIRE(miniplc0::Sha256().update(message).hex() == digest);
+	for (std::size_t split : {1, 7, 55, 56}) {
+		REQUIRE(miniplc0::Sha256().update(message.substr(0, split)).update(message.substr(split)).hex() == digest);
+	}
+	std::string million(1000000, 'a');
+	REQUIRE(miniplc0::Sha256().update(million).hex() == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST_CASE("The fingerprint of an executable is remembered until it changes.") {
+	CacheDirectory dir;
+	std::filesystem::create_directories(dir.path);
+	auto executable = dir.path / "cc0";
+	auto memo = dir.path / miniplc0::CompileCache::memoName;
+	std::ofstream(executable) << "abc";
+	auto abc = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+	REQUIRE(miniplc0::CompileCache::fingerprint(executable) == abc);
+	REQUIRE(miniplc0::CompileCache::fingerprint(executable, memo) == abc);
+	REQUIRE(std::filesystem::exists(memo));
+	// the memo is used as long as the path, the size and the time match
+	auto time = std::filesystem::last_write_time(executable);
+	std::ofstream(executable) << "abd";
+	std::filesystem::last_write_time(executable, time);
+	REQUIRE(miniplc0::CompileCache::fingerprint(executable, memo) == abc);
+	std::filesystem::last_write_time(executable, time + std::chrono::seconds(1));
+	REQUIRE(miniplc0::CompileCache::fingerprint(executable, memo) == miniplc0::CompileCache::fingerprint(executable));
+	REQUIRE(miniplc0::CompileCache::fingerprint(executable, memo) != abc);
+	REQUIRE(miniplc0::CompileCache::fingerprint(dir.path / "missing", memo).empty());
+
+	// the memo is no entry of the cache
+	miniplc0::CompileCache cache(dir.path, 1000, "compiler");
+	cache.store("a", std::string(880, 'x'));
+	cache.store("b", std::string(90, 'x'));
+	std::ostringstream statistics;
+	cache.printStatistics(statistics);
+	REQUIRE(statistics.str() == "cache: 0 hits, 0 misses, 0 evicted\n");
+}
+
+TEST_CASE("An entry is only given back for the key it was stored with and as long as it was stored.") {
+	CacheDirectory dir;
+	miniplc0::CompileCache cache(dir.path, 1000, "compiler");
+	cache.store("a", "output of a");
+	REQUIRE(cache.lookup("a") == "output of a");
+	std::filesystem::copy_file(dir.path / "a", dir.path / "b");
+	REQUIRE(cache.lookup("b") == std::nullopt);
+	std::filesystem::resize_file(dir.path / "a", std::filesystem::file_size(dir.path / "a") - 1);
+	REQUIRE(cache.lookup("a") == std::nullopt);
+	cache.storeFile("c", "output of c");
+	REQUIRE(cache.lookup("c") == std::nullopt);
+	REQUIRE(cache.locate("c") == dir.path / "c");
+	std::ostringstream statistics;
+	cache.printStatistics(statistics);
+	REQUIRE(statistics.str() == "cache: 2 hits, 3 misses, 0 evicted\n");
+}
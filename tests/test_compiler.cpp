@@ -0,0 +1,425 @@
+#include "catch2/catch.hpp"
+
+#include "tests/cc0.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+// the instructions of .F<index> in the assembly without their offsets, "loada  0,  1"
+std::vector<std::string> functionCode(const std::string& assembly, int index) {
+	std::vector<std::string> code;
+	std::istringstream in(assembly);
+	bool inside = false;
+	for (std::string line; std::getline(in, line); ) {
+		if (!line.empty() && line[0] == '.') {
+			inside = line == ".F" + std::to_string(index) + ":";
+			continue;
+		}
+		if (inside) {
+			auto begin = line.find_first_not_of(' ', line.find(' '));
+			auto end = line.find_last_not_of(' ');
+			code.push_back(line.substr(begin, end - begin + 1));
+		}
+	}
+	return code;
+}
+
+std::size_t count(const std::vector<std::string>& code, const std::string& instruction) {
+	return static_cast<std::size_t>(std::count(code.begin(), code.end(), instruction));
+}
+
+// where the first backward jump goes, -1 without a loop
+int loopHeader(const std::vector<std::string>& code) {
+	for (std::size_t i = 0; i < code.size(); ++i) {
+		if (code[i].rfind("jmp  ", 0) == 0) {
+			auto target = std::stoi(code[i].substr(5));
+			if (target <= static_cast<int>(i)) {
+				return target;
+			}
+		}
+	}
+	return -1;
+}
+
+// every optimization level prints what -O0 prints
+void requireSameOutput(const cc0test::Workspace& ws, const std::string& source, const std::string& input = "") {
+	auto expected = ws.execute(source, "-O0", input);
+	REQUIRE(expected.status == 0);
+	REQUIRE(expected.err.empty());
+	for (auto flags : {"-O1", "-O2"}) {
+		auto result = ws.execute(source, flags, input);
+		REQUIRE(result.out == expected.out);
+		REQUIRE(result.err.empty());
+	}
+}
+
+}
+
+TEST_CASE("An @list compiles every source on its own and reports the ones that fail.") {
+	cc0test::Workspace ws;
+	ws.write("good.c0", "int main() {\n    print(6 * 7);\n    return 0;\n}\n");
+	ws.write("bad.c0", "int main() {\n    print(6 * );\n    return 0;\n}\n");
+	ws.write("list", "good.c0\nbad.c0\nmissing.c0\n");
+
+	auto result = ws.run("-c @list -j 2");
+	REQUIRE(result.status == 2);
+	REQUIRE(result.err.find("bad.c0: ") != std::string::npos);
+	REQUIRE(result.err.find("missing.c0: Fail to open missing.c0 for reading.") != std::string::npos);
+	REQUIRE(result.err.find("good.c0") == std::string::npos);
+	REQUIRE_FALSE(ws.exists("bad.o0"));
+	REQUIRE(ws.run("-r good.o0").out == "42\n");
+
+	ws.write("list", "good.c0\n");
+	REQUIRE(ws.run("-s @list").status == 0);
+	REQUIRE(ws.read("good.s0").find(".F0:") != std::string::npos);
+}
+
+TEST_CASE("--cache-dir gives the output of a source back only for that source.") {
+	cc0test::Workspace ws;
+	// these two had the same 64-bit key
+	ws.write("a.c0", "int a =2;int b=2;int main(){print(a);print(b);return 0;}");
+	ws.write("b.c0", "int a =8;int b=0;int main(){print(a);print(b);return 0;}");
+	REQUIRE(ws.run("-c a.c0 -o a.o0 --cache-dir cc").status == 0);
+	REQUIRE(ws.run("-c b.c0 -o b.o0 --cache-dir cc").status == 0);
+	REQUIRE(ws.run("-r a.o0").out == "2\n2\n");
+	REQUIRE(ws.run("-r b.o0").out == "8\n0\n");
+	auto result = ws.run("-c b.c0 -o b.o0 --cache-dir cc --cache-stats");
+	REQUIRE(result.err == "cache: 1 hits, 0 misses, 0 evicted\n");
+	REQUIRE(ws.run("-r b.o0").out == "8\n0\n");
+}
+
+TEST_CASE("Constant expressions and the values of constants are folded at compile time.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"const int K = 5;\n"
+		"int main() {\n"
+		"    const int L = K * 3;\n"
+		"    int x = 7;\n"
+		"    print(2 * 3 + 4, L - 1, x * (8 / 2), -K, 2147483647 + 1);\n"
+		"    return 0;\n"
+		"}\n";
+	auto assembly = ws.assembly(source);
+	REQUIRE(assembly.find("bipush  10\n") != std::string::npos);
+	REQUIRE(assembly.find("bipush  14\n") != std::string::npos);
+	REQUIRE(assembly.find("ipush  -5\n") != std::string::npos);
+	// wraps around like the VM does
+	REQUIRE(assembly.find("ipush  -2147483648\n") != std::string::npos);
+	// x is a variable, only 8 / 2 is folded
+	REQUIRE(assembly.find("bipush  4\n13    imul") != std::string::npos);
+	REQUIRE(assembly.find("idiv") == std::string::npos);
+	REQUIRE(assembly.find("iadd") == std::string::npos);
+	REQUIRE(ws.execute(source).out == "10 14 28 -5 -2147483648\n");
+
+	// left to the VM to report
+	auto divided = ws.execute("int main() {\n    print(1 / 0);\n    return 0;\n}\n");
+	REQUIRE(divided.err.find("divide integer by zero") != std::string::npos);
+}
+
+TEST_CASE("Code is generated from the syntax tree in the order of the source.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int g;\n"
+		"int max(int a, int b) {\n"
+		"    if (a > b) return a;\n"
+		"    return b;\n"
+		"}\n"
+		"void count(int n) {\n"
+		"    int i = 0;\n"
+		"    while (i < n) {\n"
+		"        print(i);\n"
+		"        i = i + 1;\n"
+		"    }\n"
+		"    return;\n"
+		"}\n"
+		"int main() {\n"
+		"    g = max(3, 9);\n"
+		"    count(g / 3);\n"
+		"    return 0;\n"
+		"}\n";
+	REQUIRE(ws.assembly(source) ==
+		".constants:\n"
+		"0  S  \"max\"\n"
+		"1  S  \"count\"\n"
+		"2  S  \"main\"\n"
+		".start:\n"
+		"0    snew  1\n"
+		".functions:\n"
+		"0  0  2  1\n"
+		"1  1  1  1\n"
+		"2  2  0  1\n"
+		".F0:\n"
+		"0    loada  0,  0\n"
+		"1    iload  \n"
+		"2    loada  0,  1\n"
+		"3    iload  \n"
+		"4    icmp  \n"
+		"5    jle  9\n"
+		"6    loada  0,  0\n"
+		"7    iload  \n"
+		"8    iret  \n"
+		"9    loada  0,  1\n"
+		"10    iload  \n"
+		"11    iret  \n"
+		"12    iret  \n"
+		".F1:\n"
+		"0    bipush  0\n"
+		"1    loada  0,  1\n"
+		"2    iload  \n"
+		"3    loada  0,  0\n"
+		"4    iload  \n"
+		"5    icmp  \n"
+		"6    jge  18\n"
+		"7    loada  0,  1\n"
+		"8    iload  \n"
+		"9    iprint  \n"
+		"10    printl  \n"
+		"11    loada  0,  1\n"
+		"12    loada  0,  1\n"
+		"13    iload  \n"
+		"14    bipush  1\n"
+		"15    iadd  \n"
+		"16    istore  \n"
+		"17    jmp  1\n"
+		"18    ret  \n"
+		"19    ret  \n"
+		".F2:\n"
+		"0    loada  1,  0\n"
+		"1    bipush  3\n"
+		"2    bipush  9\n"
+		"3    call  0\n"
+		"4    istore  \n"
+		"5    loada  1,  0\n"
+		"6    iload  \n"
+		"7    bipush  3\n"
+		"8    idiv  \n"
+		"9    call  1\n"
+		"10    bipush  0\n"
+		"11    iret  \n"
+		"12    iret  \n");
+	REQUIRE(ws.execute(source).out == "0\n1\n2\n");
+}
+
+TEST_CASE("Constant propagation replaces a variable that only holds a constant.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int main() {\n"
+		"    int x = 3;\n"
+		"    int y = x * 4;\n"
+		"    print(y);\n"
+		"    return 0;\n"
+		"}\n";
+	REQUIRE(count(functionCode(ws.assembly(source, "-O0"), 0), "imul") == 1);
+	auto code = functionCode(ws.assembly(source, "-O1"), 0);
+	REQUIRE(count(code, "imul") == 0);
+	auto printed = std::find(code.begin(), code.end(), "iprint");
+	REQUIRE(printed != code.end());
+	REQUIRE(*(printed - 1) == "bipush  12");
+	requireSameOutput(ws, source);
+}
+
+TEST_CASE("Copy propagation reads the original and the copy becomes a dead store.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int main() {\n"
+		"    int a;\n"
+		"    int c;\n"
+		"    scan(a);\n"
+		"    c = a;\n"
+		"    print(c + c);\n"
+		"    a = 1;\n"
+		"    print(a);\n"
+		"    return 0;\n"
+		"}\n";
+	REQUIRE(count(functionCode(ws.assembly(source, "-O0"), 0), "loada  0,  1") == 3);
+	REQUIRE(count(functionCode(ws.assembly(source, "-O1"), 0), "loada  0,  1") == 0);
+	requireSameOutput(ws, source, "21");
+}
+
+TEST_CASE("Dead store elimination keeps the side effects of the value stored.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int noisy() {\n"
+		"    print(7);\n"
+		"    return 3;\n"
+		"}\n"
+		"int main() {\n"
+		"    int x;\n"
+		"    x = noisy();\n"
+		"    x = 1;\n"
+		"    print(x);\n"
+		"    return 0;\n"
+		"}\n";
+	REQUIRE(count(functionCode(ws.assembly(source, "-O1"), 1), "call  0") == 1);
+	requireSameOutput(ws, source);
+	REQUIRE(ws.execute(source, "-O1").out == "7\n1\n");
+}
+
+TEST_CASE("Unreachable code elimination drops the branches a constant condition never takes.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int main() {\n"
+		"    int x = 1;\n"
+		"    while (0) {\n"
+		"        print(111);\n"
+		"    }\n"
+		"    if (x > 2) print(222);\n"
+		"    else print(333);\n"
+		"    return 0;\n"
+		"}\n";
+	auto assembly = ws.assembly(source, "-O1");
+	REQUIRE(assembly.find("111") == std::string::npos);
+	REQUIRE(assembly.find("222") == std::string::npos);
+	REQUIRE(assembly.find("333") != std::string::npos);
+	requireSameOutput(ws, source);
+}
+
+TEST_CASE("Loop invariant code motion hoists what no iteration changes, but no global read past a call.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int g = 1;\n"
+		"void bump() {\n"
+		"    g = g + 1;\n"
+		"    return;\n"
+		"}\n"
+		"int main() {\n"
+		"    int a;\n"
+		"    int b;\n"
+		"    int i = 0;\n"
+		"    int s = 0;\n"
+		"    scan(a);\n"
+		"    scan(b);\n"
+		"    while (i < 3) {\n"
+		"        s = s + a * b;\n"
+		"        print(g * 2);\n"
+		"        bump();\n"
+		"        i = i + 1;\n"
+		"    }\n"
+		"    print(s);\n"
+		"    return 0;\n"
+		"}\n";
+	auto before = functionCode(ws.assembly(source, "-O1"), 1);
+	auto header = loopHeader(before);
+	REQUIRE(header >= 0);
+	REQUIRE(std::find(before.begin(), before.end(), "imul") > before.begin() + header);
+
+	// a * b before the loop, g * 2 still in it
+	auto code = functionCode(ws.assembly(source, "-O2"), 1);
+	header = loopHeader(code);
+	REQUIRE(header >= 0);
+	auto first = std::find(code.begin(), code.end(), "imul");
+	REQUIRE(first < code.begin() + header);
+	auto second = std::find(first + 1, code.end(), "imul");
+	REQUIRE(second > code.begin() + header);
+	REQUIRE(*(second - 1) == "bipush  2");
+	requireSameOutput(ws, source, "3 4");
+	REQUIRE(ws.execute(source, "-O2", "3 4").out == "2\n4\n6\n36\n");
+}
+
+TEST_CASE("Common subexpression elimination reuses a value until a store or a call may change it.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int g = 1;\n"
+		"void bump() {\n"
+		"    g = g + 1;\n"
+		"    return;\n"
+		"}\n"
+		"int main() {\n"
+		"    int a;\n"
+		"    int b;\n"
+		"    int x;\n"
+		"    int y;\n"
+		"    scan(a);\n"
+		"    scan(b);\n"
+		"    print(a * b + a * b);\n"
+		"    y = a * b;\n"
+		"    a = b;\n"
+		"    print(y, a * b);\n"
+		"    x = g * 3;\n"
+		"    bump();\n"
+		"    y = g * 3;\n"
+		"    print(x, y);\n"
+		"    return 0;\n"
+		"}\n";
+	REQUIRE(count(functionCode(ws.assembly(source, "-O1"), 1), "imul") == 6);
+	// a * b once before the store to a, once after, g * 3 on both sides of the call
+	REQUIRE(count(functionCode(ws.assembly(source, "-O2"), 1), "imul") == 4);
+	requireSameOutput(ws, source, "3 4");
+	REQUIRE(ws.execute(source, "-O2", "3 4").out == "24\n12 16\n3 6\n");
+}
+
+TEST_CASE("A returned call is compiled to a tail call.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int count(int n, int acc) {\n"
+		"    if (n == 0) return acc;\n"
+		"    return count(n - 1, acc + 1);\n"
+		"}\n"
+		"int depth(int n) {\n"
+		"    if (n == 0) return 0;\n"
+		"    return 1 + depth(n - 1);\n"
+		"}\n"
+		"int main() {\n"
+		"    int n;\n"
+		"    scan(n);\n"
+		"    print(count(n, 0));\n"
+		"    return 0;\n"
+		"}\n";
+	auto code = functionCode(ws.assembly(source), 0);
+	REQUIRE(count(code, "tailcall  0") == 1);
+	// the result of depth is used after the call
+	REQUIRE(count(functionCode(ws.assembly(source), 1), "call  1") == 1);
+	auto result = ws.execute(source, "", "1000000");
+	REQUIRE(result.status == 0);
+	REQUIRE(result.out == "1000000\n");
+	REQUIRE(result.err.empty());
+}
+
+TEST_CASE("A small function is inlined unless an argument has side effects, which happen once.") {
+	cc0test::Workspace ws;
+	const char* source =
+		"int g = 0;\n"
+		"int sq(int x) {\n"
+		"    return x * x;\n"
+		"}\n"
+		"int next() {\n"
+		"    g = g + 1;\n"
+		"    return g + 2;\n"
+		"}\n"
+		"int main() {\n"
+		"    int a;\n"
+		"    scan(a);\n"
+		"    print(sq(a + 1));\n"
+		"    print(sq(next()), g);\n"
+		"    return 0;\n"
+		"}\n";
+	REQUIRE(count(functionCode(ws.assembly(source, "-O1 --inline-budget 0"), 2), "call  0") == 2);
+	// sq(next()) is still a call, inlining it would call next twice
+	auto code = functionCode(ws.assembly(source, "-O1"), 2);
+	REQUIRE(count(code, "call  0") == 1);
+	REQUIRE(count(code, "call  1") == 1);
+	requireSameOutput(ws, source, "4");
+	REQUIRE(ws.execute(source, "-O1", "4").out == "25\n9 1\n");
+}
+
+TEST_CASE("An object file compiled with optimizations leaves out the functions main does not reach.") {
+	cc0test::Workspace ws;
+	ws.write("strip.c0",
+		"int neverused(int x) {\n"
+		"    return x * 2;\n"
+		"}\n"
+		"int main() {\n"
+		"    print(7);\n"
+		"    return 0;\n"
+		"}\n");
+	for (auto [flags, kept] : {std::make_tuple("-O0", true), std::make_tuple("-O1", false)}) {
+		REQUIRE(ws.run(std::string("-c ") + flags + " strip.c0 -o strip.o0").status == 0);
+		auto object = ws.read("strip.o0");
+		REQUIRE((object.find("neverused") != std::string::npos) == kept);
+		REQUIRE(ws.run("-r strip.o0").out == "7\n");
+	}
+}
@@ -0,0 +1,145 @@
+#include "catch2/catch.hpp"
+
+#include "tests/cc0.hpp"
+
+#include "c0-vm/file.h"
+#include "c0-vm/vm.h"
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+
+namespace {
+
+// main jumps over `skipped` nops, prints 5 and calls show(7)
+std::string jumpProgram(int skipped) {
+	std::string text =
+		".constants:\n"
+		"0  S  \"main\"\n"
+		"1  S  \"show\"\n"
+		".start:\n"
+		".functions:\n"
+		"0  0  0  1\n"
+		"1  1  1  1\n"
+		".F0:\n"
+		"0    jmp  " + std::to_string(skipped + 1) + "\n";
+	int offset = 1;
+	for (; offset <= skipped; ++offset) {
+		text += std::to_string(offset) + "    nop\n";
+	}
+	for (auto instruction : {"bipush  5", "iprint", "bipush  7", "call  1", "ret"}) {
+		text += std::to_string(offset++) + "    " + instruction + "\n";
+	}
+	return text +
+		".F1:\n"
+		"0    loada  0,  0\n"
+		"1    iload\n"
+		"2    iprint\n"
+		"3    ret\n";
+}
+
+// main returns at once or calls broken first, broken is the last function of the file
+std::string lazyProgram(bool calls) {
+	return std::string(
+		".constants:\n"
+		"0  S  \"main\"\n"
+		"1  S  \"broken\"\n"
+		".start:\n"
+		".functions:\n"
+		"0  0  0  1\n"
+		"1  1  0  1\n"
+		".F0:\n") +
+		(calls ? "0    call  1\n1    ret\n" : "0    ret\n") +
+		".F1:\n"
+		"0    ret\n";
+}
+
+File parseText(const std::string& text) {
+	std::istringstream in(text);
+	return File::parse_file_text(in);
+}
+
+std::string binary(File& file, vm::u4 version) {
+	file.version = version;
+	std::ostringstream out(std::ios::out | std::ios::binary);
+	file.output_binary(out);
+	return out.str();
+}
+
+File parseBinary(const cc0test::Workspace& ws, const std::string& bytes) {
+	std::ifstream in(ws.write("file.o0", bytes), std::ios::in | std::ios::binary);
+	return File::parse_file_binary(in);
+}
+
+// the big-endian version after the magic
+vm::u4 versionOf(const std::string& bytes) {
+	vm::u4 version = 0;
+	for (int i = 4; i < 8; ++i) {
+		version = version << 8 | static_cast<unsigned char>(bytes.at(i));
+	}
+	return version;
+}
+
+std::pair<vm::VM::Status, std::string> run(File file) {
+	auto avm = vm::VM::make_vm(std::move(file));
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	auto status = avm->start();
+	return {status, out.str()};
+}
+
+}
+
+TEST_CASE("A file is written in the oldest version that holds it and both versions load.") {
+	cc0test::Workspace ws;
+	auto file = parseText(jumpProgram(10));
+	REQUIRE(file.minimumVersion() == 1);
+	for (vm::u4 version : {1, 2}) {
+		auto bytes = binary(file, version);
+		REQUIRE(versionOf(bytes) == version);
+		auto loaded = parseBinary(ws, bytes);
+		REQUIRE(loaded.version == version);
+		REQUIRE(loaded.functions.size() == 2);
+		REQUIRE(run(std::move(loaded)) == std::make_pair(vm::VM::Status::FINISHED, std::string("57")));
+	}
+}
+
+TEST_CASE("An operand larger than 2 bytes needs version 2.") {
+	cc0test::Workspace ws;
+	auto file = parseText(jumpProgram(70000));
+	REQUIRE(file.minimumVersion() == 2);
+	REQUIRE_THROWS(binary(file, 1));
+	auto loaded = parseBinary(ws, binary(file, 2));
+	REQUIRE(loaded.version == 2);
+	REQUIRE(loaded.functions.at(0).instructions().at(0).x == 70001);
+	REQUIRE(run(std::move(loaded)) == std::make_pair(vm::VM::Status::FINISHED, std::string("57")));
+}
+
+TEST_CASE("A binary file that ends early or goes on is rejected.") {
+	cc0test::Workspace ws;
+	auto file = parseText(jumpProgram(10));
+	for (vm::u4 version : {1, 2}) {
+		auto bytes = binary(file, version);
+		REQUIRE_THROWS(parseBinary(ws, bytes.substr(0, bytes.size() - 1)));
+		REQUIRE_THROWS(parseBinary(ws, bytes + '\0'));
+	}
+}
+
+TEST_CASE("The code of a function in a version 2 file is only decoded when it is needed.") {
+	cc0test::Workspace ws;
+	for (bool calls : {false, true}) {
+		auto file = parseText(lazyProgram(calls));
+		// the ret of broken is the last byte of the file, 0xff is no opcode
+		auto v1 = binary(file, 1);
+		v1.back() = '\xff';
+		REQUIRE_THROWS(parseBinary(ws, v1));
+		auto v2 = binary(file, 2);
+		v2.back() = '\xff';
+		auto loaded = parseBinary(ws, v2);
+		REQUIRE(std::as_const(loaded.functions.at(0)).instructions().size() == (calls ? 2 : 1));
+		REQUIRE_THROWS(std::as_const(loaded.functions.at(1)).instructions());
+		REQUIRE(run(std::move(loaded)).first == (calls ? vm::VM::Status::FAILED : vm::VM::Status::FINISHED));
+	}
+}
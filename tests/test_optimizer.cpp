@@ -0,0 +1,158 @@
+#include "catch2/catch.hpp"
+
+#include "codegen/codeGenerator.h"
+#include "optimizer/passes.h"
+
+#include <ostream>
+#include <vector>
+
+namespace {
+
+using miniplc0::Operation;
+
+// an instruction of a function, the operand of a jump is the index of its target
+struct Code {
+	Operation opr;
+	std::vector<int> operand;
+
+	bool operator==(const Code& rhs) const {
+		return opr == rhs.opr && operand == rhs.operand;
+	}
+};
+
+std::ostream& operator<<(std::ostream& out, const Code& code) {
+	out << "0x" << std::hex << static_cast<int>(code.opr) << std::dec;
+	for (auto operand : code.operand) {
+		out << ' ' << operand;
+	}
+	return out;
+}
+
+// the function after the peephole pass, which reports whether it changed something
+std::vector<Code> peephole(const std::vector<Code>& function, bool changes = true) {
+	std::vector<miniplc0::Instruction> instructions;
+	for (std::size_t i = 0; i < function.size(); ++i) {
+		instructions.push_back(miniplc0::CodeGenerator::makeInstruction(function[i].opr, function[i].operand, static_cast<int>(i)));
+	}
+	REQUIRE(miniplc0::PeepholeOptimization().run(instructions) == changes);
+	std::vector<Code> result;
+	for (auto& instruction : instructions) {
+		result.push_back(Code{instruction.getOpr(), instruction.getOperand()});
+	}
+	return result;
+}
+
+}
+
+TEST_CASE("A variable loaded right after it is stored keeps its address with a dup.") {
+	auto result = peephole({
+		{Operation::LOADA, {0, 0}},
+		{Operation::ISCAN, {}},
+		{Operation::ISTORE, {}},
+		{Operation::LOADA, {0, 0}},
+		{Operation::ILOAD, {}},
+		{Operation::IPRINT, {}},
+		{Operation::RET, {}},
+	});
+	REQUIRE(result == std::vector<Code>{
+		{Operation::LOADA, {0, 0}},
+		{Operation::DUP, {}},
+		{Operation::ISCAN, {}},
+		{Operation::ISTORE, {}},
+		{Operation::ILOAD, {}},
+		{Operation::IPRINT, {}},
+		{Operation::RET, {}},
+	});
+}
+
+TEST_CASE("A store followed by a load of another variable or a jump target is kept.") {
+	std::vector<Code> other = {
+		{Operation::LOADA, {0, 0}},
+		{Operation::ISCAN, {}},
+		{Operation::ISTORE, {}},
+		{Operation::LOADA, {0, 1}},
+		{Operation::ILOAD, {}},
+		{Operation::IPRINT, {}},
+		{Operation::RET, {}},
+	};
+	REQUIRE(peephole(other, false) == other);
+
+	// the loop comes back to the load without the store
+	std::vector<Code> target = {
+		{Operation::LOADA, {0, 0}},
+		{Operation::ISCAN, {}},
+		{Operation::ISTORE, {}},
+		{Operation::LOADA, {0, 0}},
+		{Operation::ILOAD, {}},
+		{Operation::IPRINT, {}},
+		{Operation::ISCAN, {}},
+		{Operation::JNE, {3}},
+		{Operation::RET, {}},
+	};
+	REQUIRE(peephole(target, false) == target);
+}
+
+TEST_CASE("A jump to a jump goes to the final target and a jump to a return returns.") {
+	auto result = peephole({
+		{Operation::ISCAN, {}},
+		{Operation::JE, {4}},
+		{Operation::BIPUSH, {1}},
+		{Operation::JMP, {6}},
+		{Operation::JMP, {5}},
+		{Operation::JMP, {7}},
+		{Operation::IRET, {}},
+		{Operation::BIPUSH, {2}},
+		{Operation::IRET, {}},
+	});
+	// the jumps in between are no longer reached and removed
+	REQUIRE(result == std::vector<Code>{
+		{Operation::ISCAN, {}},
+		{Operation::JE, {4}},
+		{Operation::BIPUSH, {1}},
+		{Operation::IRET, {}},
+		{Operation::BIPUSH, {2}},
+		{Operation::IRET, {}},
+	});
+}
+
+TEST_CASE("A comparison with 0 is left to the conditional jump.") {
+	auto result = peephole({
+		{Operation::ISCAN, {}},
+		{Operation::BIPUSH, {0}},
+		{Operation::ICMP, {}},
+		{Operation::JL, {6}},
+		{Operation::BIPUSH, {1}},
+		{Operation::IRET, {}},
+		{Operation::BIPUSH, {2}},
+		{Operation::IRET, {}},
+	});
+	REQUIRE(result == std::vector<Code>{
+		{Operation::ISCAN, {}},
+		{Operation::JL, {4}},
+		{Operation::BIPUSH, {1}},
+		{Operation::IRET, {}},
+		{Operation::BIPUSH, {2}},
+		{Operation::IRET, {}},
+	});
+}
+
+TEST_CASE("A jump on a constant is taken always or never and a jump to the next instruction is dropped.") {
+	auto result = peephole({
+		{Operation::BIPUSH, {0}},
+		{Operation::JNE, {5}},
+		{Operation::ISCAN, {}},
+		{Operation::JE, {4}},
+		{Operation::BIPUSH, {3}},
+		{Operation::IPUSH, {-1}},
+		{Operation::JL, {8}},
+		{Operation::BIPUSH, {4}},
+		{Operation::IRET, {}},
+	});
+	// the value scanned is still popped, bipush 4 can not be reached
+	REQUIRE(result == std::vector<Code>{
+		{Operation::ISCAN, {}},
+		{Operation::POP, {}},
+		{Operation::BIPUSH, {3}},
+		{Operation::IRET, {}},
+	});
+}
@@ -0,0 +1,194 @@
+#include "catch2/catch.hpp"
+
+#include "tests/cc0.hpp"
+
+#include <filesystem>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace {
+
+const char* doubleProgram =
+	"int main() {\n"
+	"    int x;\n"
+	"    scan(x);\n"
+	"    print(x * 2);\n"
+	"    return 0;\n"
+	"}\n";
+
+// reads a global into a local, then overwrites the global with an expression that reads both
+const char* globalWriteProgram =
+	"int G0 = 0;\n"
+	"int f1() {\n"
+	"    const int K1 = G0;\n"
+	"    G0 = 147;\n"
+	"    G0 = (K1 * -1 * G0) / 7;\n"
+	"    print(G0, K1);\n"
+	"    return 0;\n"
+	"}\n"
+	"int main() {\n"
+	"    return f1();\n"
+	"}\n";
+
+const char* tripleProgram =
+	"int main() {\n"
+	"    int x;\n"
+	"    scan(x);\n"
+	"    print(x * 3);\n"
+	"    return 0;\n"
+	"}\n";
+
+const char* fibProgram =
+	"int fib(int n) {\n"
+	"    if (n < 2) return n;\n"
+	"    return fib(n - 1) + fib(n - 2);\n"
+	"}\n"
+	"int main() {\n"
+	"    int n;\n"
+	"    scan(n);\n"
+	"    print(fib(n));\n"
+	"    return 0;\n"
+	"}\n";
+
+// the names of the files in the directory of the workspace
+std::vector<std::string> entries(const cc0test::Workspace& ws, const std::string& directory) {
+	std::vector<std::string> names;
+	for (auto& entry : std::filesystem::directory_iterator(ws.path(directory))) {
+		// the hash of cc0 kept in the cache directory is no entry
+		if (auto name = entry.path().filename().string(); name.front() != '.') {
+			names.push_back(name);
+		}
+	}
+	return names;
+}
+
+// the count printed by --count-instructions
+long long executed(const std::string& err) {
+	auto at = err.find("executed ");
+	REQUIRE(at != std::string::npos);
+	return std::stoll(err.substr(at + 9));
+}
+
+}
+
+TEST_CASE("The register vm prints what the stack vm prints.") {
+	cc0test::Workspace ws;
+	for (auto [source, input, output] : {std::make_tuple(globalWriteProgram, "", "0 0\n"),
+	                                     std::make_tuple(doubleProgram, "-21", "-42\n"),
+	                                     std::make_tuple(fibProgram, "15", "610\n")}) {
+		auto stack = ws.execute(source, "", input);
+		REQUIRE(stack.out == output);
+		REQUIRE(stack.err.empty());
+		auto reg = ws.run("-r run.o0 --regvm", input);
+		REQUIRE(reg.out == output);
+		REQUIRE(reg.err.empty());
+	}
+}
+
+TEST_CASE("The register vm executes fewer instructions than the stack vm.") {
+	cc0test::Workspace ws;
+	auto stack = ws.execute(fibProgram, "", "15", "--count-instructions");
+	REQUIRE(stack.out == "610\n");
+	auto reg = ws.run("-r run.o0 --regvm --count-instructions", "15");
+	REQUIRE(reg.out == "610\n");
+	REQUIRE(executed(reg.err) > 0);
+	REQUIRE(executed(reg.err) < executed(stack.err));
+}
+
+TEST_CASE("A batch run writes x.out for every input x and leaves the output of a missing one alone.") {
+	cc0test::Workspace ws;
+	ws.write("a.in", "21");
+	ws.write("b.in", "-4");
+	ws.write("missing.in.out", "kept");
+	ws.write("list", "a.in\nmissing.in\n\nb.in\n");
+	ws.write("double.c0", doubleProgram);
+	REQUIRE(ws.run("-c double.c0 -o double.o0").status == 0);
+
+	auto result = ws.run("-r double.o0 --batch list -j 2");
+	REQUIRE(result.status != 0);
+	REQUIRE(result.err.find("Fail to open missing.in for reading.") != std::string::npos);
+	REQUIRE(ws.read("a.in.out") == "42\n");
+	REQUIRE(ws.read("b.in.out") == "-8\n");
+	REQUIRE(ws.read("missing.in.out") == "kept");
+
+	ws.write("list", "a.in\nb.in\n");
+	REQUIRE(ws.run("-r double.o0 --batch list -j 2").status == 0);
+}
+
+TEST_CASE("A batch run reports an input whose profiling timer can not be created and goes on.") {
+	cc0test::Workspace ws;
+	ws.write("a.in", "21");
+	ws.write("b.in", "-4");
+	ws.write("list", "a.in\nb.in\n");
+	ws.write("double.c0", doubleProgram);
+	REQUIRE(ws.run("-c double.c0 -o double.o0").status == 0);
+
+	// cc0 inherits the limit, a timer needs a pending signal allowed
+	rlimit pending;
+	REQUIRE(getrlimit(RLIMIT_SIGPENDING, &pending) == 0);
+	auto none = pending;
+	none.rlim_cur = 0;
+	REQUIRE(setrlimit(RLIMIT_SIGPENDING, &none) == 0);
+	auto result = ws.run("-r double.o0 --batch list -j 2 --profile profile");
+	REQUIRE(setrlimit(RLIMIT_SIGPENDING, &pending) == 0);
+	REQUIRE(result.status == 2);
+	REQUIRE(result.err.find("a.in:\ntimer_create: ") != std::string::npos);
+	REQUIRE(result.err.find("b.in:\ntimer_create: ") != std::string::npos);
+}
+
+TEST_CASE("-r --cache-dir reuses the image of an unchanged binary file and ignores a stale or broken one.") {
+	cc0test::Workspace ws;
+	ws.write("program.c0", doubleProgram);
+	REQUIRE(ws.run("-c program.c0 -o program.o0").status == 0);
+	const std::string run = "-r program.o0 --cache-dir cache --cache-stats";
+	auto result = ws.run(run, "21");
+	REQUIRE(result.out == "42\n");
+	REQUIRE(result.err == "cache: 0 hits, 1 misses, 0 evicted\n");
+	result = ws.run(run, "21");
+	REQUIRE(result.out == "42\n");
+	REQUIRE(result.err == "cache: 1 hits, 0 misses, 0 evicted\n");
+	auto doubled = entries(ws, "cache");
+	REQUIRE(doubled.size() == 1);
+
+	// a new program in the same file is a new key
+	ws.write("program.c0", tripleProgram);
+	REQUIRE(ws.run("-c program.c0 -o program.o0").status == 0);
+	result = ws.run(run, "21");
+	REQUIRE(result.out == "63\n");
+	REQUIRE(result.err == "cache: 0 hits, 1 misses, 0 evicted\n");
+	std::string tripled;
+	for (auto& name : entries(ws, "cache")) {
+		if (name != doubled[0]) {
+			tripled = name;
+		}
+	}
+	REQUIRE(!tripled.empty());
+	auto image = ws.read("cache/" + tripled);
+
+	// a truncated image and the image of the other program under this key are not used, but replaced
+	for (auto broken : {image.substr(0, image.size() / 2), ws.read("cache/" + doubled[0])}) {
+		ws.write("cache/" + tripled, broken);
+		result = ws.run(run, "21");
+		REQUIRE(result.out == "63\n");
+		REQUIRE(result.err.find("cache: ") != std::string::npos);
+		REQUIRE(ws.read("cache/" + tripled) == image);
+		REQUIRE(ws.run(run, "21").err == "cache: 1 hits, 0 misses, 0 evicted\n");
+	}
+}
+
+TEST_CASE("The limits of -r stop a run with the error and the stack trace.") {
+	cc0test::Workspace ws;
+	auto result = ws.execute(fibProgram, "", "25", "--max-instructions 5000");
+	REQUIRE(result.out.empty());
+	REQUIRE(result.err.find("runtime error: instruction limit exceeded") != std::string::npos);
+	REQUIRE(result.err.find("called by function fib") != std::string::npos);
+	result = ws.run("-r run.o0 --time-limit 50", "40");
+	REQUIRE(result.out.empty());
+	REQUIRE(result.err.find("runtime error: time limit exceeded") != std::string::npos);
+	// the limits only apply to the stack vm
+	REQUIRE(ws.run("-r run.o0 --regvm --max-instructions 5000", "25").status != 0);
+	REQUIRE(ws.run("-r run.o0 --max-instructions 0", "15").out == "610\n");
+}
@@ -0,0 +1,80 @@
+#include "catch2/catch.hpp"
+
+#include "c0-vm/trace.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+vm::TraceRecord recordAt(vm::u4 i) {
+	return vm::TraceRecord{static_cast<vm::i4>(i % 3) - 1, i, i % 2 ? vm::OpCode::iadd : vm::OpCode::ipush,
+	                       static_cast<vm::addr_t>(i + 1), static_cast<vm::slot_t>(-static_cast<vm::i4>(i))};
+}
+
+void record(vm::Tracer& tracer, vm::u4 from, vm::u4 to) {
+	for (auto i = from; i < to; ++i) {
+		auto r = recordAt(i);
+		tracer.record(r.functionIndex, r.ip, r.op, r.sp, r.top);
+	}
+}
+
+std::vector<std::string> lines(const std::string& text) {
+	std::vector<std::string> result;
+	std::istringstream in(text);
+	for (std::string line; std::getline(in, line); ) {
+		result.push_back(line);
+	}
+	return result;
+}
+
+}
+
+TEST_CASE("A streamed trace decodes to every record once, flushed in the middle or not.") {
+	std::ostringstream stream(std::ios::out | std::ios::binary);
+	{
+		vm::Tracer tracer(8, &stream);
+		// a flush at the end of a run, the resumed run wraps the buffer twice after it
+		record(tracer, 0, 5);
+		tracer.flush();
+		record(tracer, 5, 25);
+	}
+	std::istringstream in(stream.str(), std::ios::in | std::ios::binary);
+	std::ostringstream decoded;
+	vm::Tracer::decode(in, decoded);
+
+	std::ostringstream expected;
+	for (vm::u4 i = 0; i < 25; ++i) {
+		println(expected, recordAt(i));
+	}
+	REQUIRE(lines(decoded.str()) == lines(expected.str()));
+}
+
+TEST_CASE("A truncated trace is rejected by the decoder.") {
+	std::ostringstream stream(std::ios::out | std::ios::binary);
+	{
+		vm::Tracer tracer(8, &stream);
+		record(tracer, 0, 3);
+	}
+	auto bytes = stream.str();
+	std::istringstream in(bytes.substr(0, bytes.size() - 1), std::ios::in | std::ios::binary);
+	std::ostringstream decoded;
+	REQUIRE_THROWS(vm::Tracer::decode(in, decoded));
+}
+
+TEST_CASE("A runtime error only prints the last few records of the ring buffer.") {
+	vm::Tracer tracer;
+	record(tracer, 0, 100);
+	std::ostringstream dumped;
+	tracer.dump(dumped);
+	auto printed = lines(dumped.str());
+	REQUIRE(printed.size() == vm::Tracer::dumpCount);
+	std::ostringstream last;
+	println(last, "   ", recordAt(99));
+	REQUIRE(printed.back() + "\n" == last.str());
+
+	std::ostringstream all;
+	tracer.dump(all, tracer.defaultCapacity);
+	REQUIRE(lines(all.str()).size() == 100);
+}
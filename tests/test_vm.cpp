@@ -0,0 +1,851 @@
+#include "catch2/catch.hpp"
+
+#include "c0-vm/exception.h"
+#include "c0-vm/vm.h"
+#include "c0-vm/multiplexer.h"
+#include "c0-vm/profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// scan(n); then n more ints, prints their sum followed by a scanned char
+const char* sumProgram =
+	".constants:\n"
+	"0  S  \"main\"\n"
+	".start:\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	".F0:\n"
+	"0    snew  1\n"
+	"1    snew  1\n"
+	"2    bipush  0\n"
+	"3    loada  0,  0\n"
+	"4    iscan\n"
+	"5    istore\n"
+	"6    loada  0,  0\n"
+	"7    iload\n"
+	"8    jle  26\n"
+	"9    loada  0,  1\n"
+	"10    iscan\n"
+	"11    istore\n"
+	"12    loada  0,  2\n"
+	"13    loada  0,  2\n"
+	"14    iload\n"
+	"15    loada  0,  1\n"
+	"16    iload\n"
+	"17    iadd\n"
+	"18    istore\n"
+	"19    loada  0,  0\n"
+	"20    loada  0,  0\n"
+	"21    iload\n"
+	"22    bipush  1\n"
+	"23    isub\n"
+	"24    istore\n"
+	"25    jmp  6\n"
+	"26    loada  0,  2\n"
+	"27    iload\n"
+	"28    iprint\n"
+	"29    cscan\n"
+	"30    cprint\n"
+	"31    printl\n"
+	"32    bipush  0\n"
+	"33    iret\n";
+
+std::shared_ptr<const File> sumFile() {
+	std::istringstream in(sumProgram);
+	return std::make_shared<const File>(File::parse_file_text(in));
+}
+
+// .start leaves 42 in a global and in a heap object, main prints their sum plus a scanned int
+const char* globalProgram =
+	".constants:\n"
+	"0  S  \"main\"\n"
+	".start:\n"
+	"0    ipush  41\n"
+	"1    ipush  1\n"
+	"2    iadd\n"
+	"3    ipush  1\n"
+	"4    new\n"
+	"5    dup\n"
+	"6    loada  0,  0\n"
+	"7    iload\n"
+	"8    istore\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	".F0:\n"
+	"0    loada  1,  0\n"
+	"1    iload\n"
+	"2    loada  1,  1\n"
+	"3    iload\n"
+	"4    iload\n"
+	"5    iadd\n"
+	"6    iscan\n"
+	"7    iadd\n"
+	"8    iprint\n"
+	"9    ipush  0\n"
+	"10    iret\n";
+
+// main prints a string literal and then overwrites it, increments the global .start set to 7,
+// allocates and prints 8 divided by a scanned int
+const char* reuseProgram =
+	".constants:\n"
+	"0  S  \"main\"\n"
+	"1  S  \"abc\"\n"
+	".start:\n"
+	"0    ipush  7\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	".F0:\n"
+	"0    loadc  1\n"
+	"1    sprint\n"
+	"2    loadc  1\n"
+	"3    bipush  88\n"
+	"4    istore\n"
+	"5    loada  1,  0\n"
+	"6    loada  1,  0\n"
+	"7    iload\n"
+	"8    bipush  1\n"
+	"9    iadd\n"
+	"10    istore\n"
+	"11    loada  1,  0\n"
+	"12    iload\n"
+	"13    iprint\n"
+	"14    ipush  16\n"
+	"15    new\n"
+	"16    pop\n"
+	"17    bipush  8\n"
+	"18    iscan\n"
+	"19    idiv\n"
+	"20    iprint\n"
+	"21    bipush  0\n"
+	"22    iret\n";
+
+// main calls spin, which counts down from 1000000
+const char* spinProgram =
+	".constants:\n"
+	"0  S  \"main\"\n"
+	"1  S  \"spin\"\n"
+	".start:\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	"1  1  0  1\n"
+	".F0:\n"
+	"0    call  1\n"
+	"1    ret\n"
+	".F1:\n"
+	"0    ipush  1000000\n"
+	"1    ipush  1\n"
+	"2    isub\n"
+	"3    dup\n"
+	"4    jne  1\n"
+	"5    ret\n";
+
+// .start calls init, main calls used, nothing calls dead or loads "unused"
+const char* stripProgram =
+	".constants:\n"
+	"0  S  \"dead\"\n"
+	"1  S  \"used\"\n"
+	"2  S  \"unused\"\n"
+	"3  S  \"main\"\n"
+	"4  S  \"text\"\n"
+	"5  S  \"init\"\n"
+	".start:\n"
+	"0    call  3\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	"1  1  0  1\n"
+	"2  3  0  1\n"
+	"3  5  0  1\n"
+	".F0:\n"
+	"0    loadc  2\n"
+	"1    sprint\n"
+	"2    ret\n"
+	".F1:\n"
+	"0    loadc  4\n"
+	"1    sprint\n"
+	"2    ret\n"
+	".F2:\n"
+	"0    call  1\n"
+	"1    ret\n"
+	".F3:\n"
+	"0    ret\n";
+
+// outer(n) at level 1 calls inner at level 2 while n > 0, inner prints the n of the outer
+// that called it plus the global 100 before and after calling outer(n - 1)
+const char* nestedProgram =
+	".constants:\n"
+	"0  S  \"main\"\n"
+	"1  S  \"outer\"\n"
+	"2  S  \"inner\"\n"
+	".start:\n"
+	"0    ipush  100\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	"1  1  1  1\n"
+	"2  2  0  2\n"
+	".F0:\n"
+	"0    bipush  2\n"
+	"1    call  1\n"
+	"2    ret\n"
+	".F1:\n"
+	"0    loada  0,  0\n"
+	"1    iload\n"
+	"2    je  4\n"
+	"3    call  2\n"
+	"4    ret\n"
+	".F2:\n"
+	"0    loada  1,  0\n"
+	"1    iload\n"
+	"2    loada  2,  0\n"
+	"3    iload\n"
+	"4    iadd\n"
+	"5    iprint\n"
+	"6    printl\n"
+	"7    loada  1,  0\n"
+	"8    iload\n"
+	"9    bipush  1\n"
+	"10    isub\n"
+	"11    call  1\n"
+	"12    loada  1,  0\n"
+	"13    iload\n"
+	"14    loada  2,  0\n"
+	"15    iload\n"
+	"16    iadd\n"
+	"17    iprint\n"
+	"18    printl\n"
+	"19    ret\n";
+
+// main stores 77 in a new object and reads it back through a loada whose offset, the address
+// of the object, does not fit in the 24 bits of a packed loada
+const char* farProgram =
+	".constants:\n"
+	"0  S  \"main\"\n"
+	".start:\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	".F0:\n"
+	"0    bipush  2\n"
+	"1    new\n"
+	"2    dup\n"
+	"3    iprint\n"
+	"4    printl\n"
+	"5    bipush  77\n"
+	"6    istore\n"
+	"7    loada  1,  16777221\n"
+	"8    iload\n"
+	"9    iprint\n"
+	"10    printl\n"
+	"11    ipush  -2147483648\n"
+	"12    iprint\n"
+	"13    printl\n"
+	"14    ipush  2147483647\n"
+	"15    iprint\n"
+	"16    printl\n"
+	"17    ret\n";
+
+// .start keeps an object holding 42 in a global, main allocates and drops 1000 objects
+// of 100 slots and prints what the kept object holds
+const char* garbageProgram =
+	".constants:\n"
+	"0  S  \"main\"\n"
+	".start:\n"
+	"0    bipush  1\n"
+	"1    new\n"
+	"2    dup\n"
+	"3    bipush  42\n"
+	"4    istore\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	".F0:\n"
+	"0    ipush  1000\n"
+	"1    loada  0,  0\n"
+	"2    iload\n"
+	"3    je  14\n"
+	"4    ipush  100\n"
+	"5    new\n"
+	"6    pop\n"
+	"7    loada  0,  0\n"
+	"8    loada  0,  0\n"
+	"9    iload\n"
+	"10    bipush  1\n"
+	"11    isub\n"
+	"12    istore\n"
+	"13    jmp  1\n"
+	"14    loada  1,  0\n"
+	"15    iload\n"
+	"16    iload\n"
+	"17    iprint\n"
+	"18    ret\n";
+
+// if main scans 0 it takes all but about 200 slots of the stack and pushes until it overflows,
+// it prints 7 otherwise
+const char* pushProgram =
+	".constants:\n"
+	"0  S  \"main\"\n"
+	".start:\n"
+	".functions:\n"
+	"0  0  0  1\n"
+	".F0:\n"
+	"0    iscan\n"
+	"1    jne  5\n"
+	"2    snew  16777000\n"
+	"3    bipush  1\n"
+	"4    jmp  3\n"
+	"5    bipush  7\n"
+	"6    iprint\n"
+	"7    ret\n";
+
+// runs pushProgram on one VM with the inputs 0, 1, 0, 1, true if every run ends as it should
+bool overflowAndRecover() {
+	std::istringstream text(pushProgram);
+	auto avm = vm::VM::make_vm(File::parse_file_text(text));
+	for (auto input : {"0", "1", "0", "1"}) {
+		std::istringstream in(input);
+		std::ostringstream out, err;
+		avm->setIO(in, out, err);
+		auto status = avm->start();
+		bool overflows = input[0] == '0';
+		if (status != (overflows ? vm::VM::Status::FAILED : vm::VM::Status::FINISHED)
+		    || out.str() != (overflows ? "" : "7")
+		    || (err.str().find("stack overflow") != std::string::npos) != overflows
+		    || (err.str().find("at instruction 3 : bipush") != std::string::npos) != overflows) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// main calls the function given with a scanned int and prints the result,
+// divide is named by the constant given and returns 10 divided by its argument
+std::string linkProgram(int divideName, int callee) {
+	return ".constants:\n"
+		"0  S  \"main\"\n"
+		"1  S  \"divide\"\n"
+		"2  I  5\n"
+		".start:\n"
+		".functions:\n"
+		"0  0  0  1\n"
+		"1  " + std::to_string(divideName) + "  1  1\n"
+		".F0:\n"
+		"0    iscan\n"
+		"1    call  " + std::to_string(callee) + "\n"
+		"2    iprint\n"
+		"3    ret\n"
+		".F1:\n"
+		"0    bipush  10\n"
+		"1    loada  0,  0\n"
+		"2    iload\n"
+		"3    idiv\n"
+		"4    iret\n";
+}
+
+std::unique_ptr<vm::VM> linkVM(int divideName, int callee) {
+	std::istringstream text(linkProgram(divideName, callee));
+	return vm::VM::make_vm(File::parse_file_text(text));
+}
+
+// main calls down(20000), which takes a frame of 1000 slots and returns down(n - 1) with the call
+// given, 20000 of those frames are more than the stack holds
+std::string recursionProgram(const std::string& call) {
+	return ".constants:\n"
+		"0  S  \"main\"\n"
+		"1  S  \"down\"\n"
+		".start:\n"
+		".functions:\n"
+		"0  0  0  1\n"
+		"1  1  1  1\n"
+		".F0:\n"
+		"0    ipush  20000\n"
+		"1    call  1\n"
+		"2    ret\n"
+		".F1:\n"
+		"0    snew  1000\n"
+		"1    loada  0,  0\n"
+		"2    iload\n"
+		"3    je  9\n"
+		"4    loada  0,  0\n"
+		"5    iload\n"
+		"6    bipush  1\n"
+		"7    isub\n"
+		"8    " + call + "  1\n"
+		"9    ret\n";
+}
+
+void feed(vm::VM& avm, const std::string& s) {
+	avm.feed(s.data(), s.size());
+}
+
+}
+
+TEST_CASE("A VM runs again from a clean state after a run, even one that failed.") {
+	std::istringstream text(reuseProgram);
+	auto avm = vm::VM::make_vm(File::parse_file_text(text));
+	for (auto [input, output, status] : {std::make_tuple("2", "abc84", vm::VM::Status::FINISHED),
+	                                     std::make_tuple("0", "abc8", vm::VM::Status::FAILED),
+	                                     std::make_tuple("4", "abc82", vm::VM::Status::FINISHED)}) {
+		std::istringstream in(input);
+		std::ostringstream out, err;
+		avm->setIO(in, out, err);
+		REQUIRE(avm->start() == status);
+		REQUIRE(out.str() == output);
+		REQUIRE(err.str().empty() == (status == vm::VM::Status::FINISHED));
+	}
+}
+
+TEST_CASE("Stripping keeps the functions reached from .start and main and the constants they use.") {
+	std::istringstream text(stripProgram);
+	auto file = File::parse_file_text(text);
+	file.strip();
+
+	auto name = [&](const vm::Constant& constant) { return std::get<vm::str_t>(constant.value); };
+	std::vector<std::string> constants;
+	for (auto& constant : file.constants) {
+		constants.push_back(name(constant));
+	}
+	REQUIRE(constants == std::vector<std::string>{"used", "main", "text", "init"});
+	std::vector<std::string> functions;
+	for (auto& function : file.functions) {
+		functions.push_back(name(file.constants.at(function.nameIndex)));
+	}
+	REQUIRE(functions == std::vector<std::string>{"used", "main", "init"});
+	// the operands are renumbered
+	REQUIRE(file.start.at(0).x == 2);
+	REQUIRE(file.functions.at(1).instructions().at(0).x == 0);
+	REQUIRE(file.functions.at(0).instructions().at(0).x == 2);
+
+	auto avm = vm::VM::make_vm(std::move(file));
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+	REQUIRE(out.str() == "text");
+}
+
+TEST_CASE("A function of a deeper level reads the frame of the latest active function of each outer level.") {
+	std::istringstream text(nestedProgram);
+	auto avm = vm::VM::make_vm(File::parse_file_text(text));
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+	// the frame of outer(2) is seen again after outer(1) returns
+	REQUIRE(out.str() == "102\n101\n101\n102\n");
+	REQUIRE(err.str().empty());
+}
+
+TEST_CASE("Operands too large for the packed form of an instruction are read in full.") {
+	std::istringstream text(farProgram);
+	auto avm = vm::VM::make_vm(File::parse_file_text(text));
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+	// the object is the first one after the literal "main" in the heap
+	REQUIRE(out.str() == "16777221\n77\n-2147483648\n2147483647\n");
+	REQUIRE(err.str().empty());
+
+	// 0xffffff, the marker of a far offset, is an offset like any other: above the stack, below the heap
+	std::istringstream marker(std::string(farProgram).replace(std::string(farProgram).find("16777221"), 8, "16777215"));
+	avm = vm::VM::make_vm(File::parse_file_text(marker));
+	avm->setIO(in, out, err);
+	REQUIRE(avm->start() == vm::VM::Status::FAILED);
+	REQUIRE(err.str().find("unexistent memory") != std::string::npos);
+}
+
+TEST_CASE("The collector keeps a program within a heap limit that its garbage exceeds.") {
+	for (bool gc : {false, true}) {
+		std::istringstream text(garbageProgram);
+		auto avm = vm::VM::make_vm(File::parse_file_text(text));
+		vm::VM::Limits limits;
+		limits.heapBytes = 40000;
+		avm->setLimits(limits);
+		avm->setGC(gc);
+		std::istringstream in;
+		std::ostringstream out, err;
+		avm->setIO(in, out, err);
+		if (gc) {
+			REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+			REQUIRE(out.str() == "42");
+			REQUIRE(err.str().empty());
+		}
+		else {
+			REQUIRE(avm->start() == vm::VM::Status::FAILED);
+			REQUIRE(err.str().find("heap limit exceeded") != std::string::npos);
+		}
+	}
+}
+
+TEST_CASE("Pushing past the end of the stack is reported as a stack overflow and the VM runs again.") {
+	REQUIRE(overflowAndRecover());
+	// the guard page belongs to the VM running on each thread
+	std::atomic<int> recovered{0};
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 2; ++i) {
+		threads.emplace_back([&recovered] {
+			if (overflowAndRecover()) {
+				++recovered;
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	REQUIRE(recovered == 2);
+}
+
+TEST_CASE("Calls are linked to their functions when the VM is made.") {
+	auto avm = linkVM(1, 1);
+	for (auto [input, status, output] : {std::make_tuple("2", vm::VM::Status::FINISHED, "5"),
+	                                     std::make_tuple("0", vm::VM::Status::FAILED, "")}) {
+		std::istringstream in(input);
+		std::ostringstream out, err;
+		avm->setIO(in, out, err);
+		REQUIRE(avm->start() == status);
+		REQUIRE(out.str() == output);
+		if (status == vm::VM::Status::FAILED) {
+			REQUIRE(err.str().find("function divide at instruction 3 : idiv") != std::string::npos);
+			REQUIRE(err.str().find("called by function main at instruction 1 : call 1") != std::string::npos);
+		}
+	}
+
+	// every function needs a string constant for its name, not only the ones up to main
+	REQUIRE_THROWS_AS(linkVM(2, 1), InvalidFile);
+	REQUIRE_THROWS_AS(linkVM(9, 1), InvalidFile);
+
+	// a call of a function that does not exist fails when it runs
+	avm = linkVM(1, 7);
+	std::istringstream in("2");
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	REQUIRE(avm->start() == vm::VM::Status::FAILED);
+	REQUIRE(out.str().empty());
+	REQUIRE(!err.str().empty());
+}
+
+TEST_CASE("A run that reaches a limit fails with a stack trace and the VM runs again without it.") {
+	std::istringstream text(spinProgram);
+	auto avm = vm::VM::make_vm(File::parse_file_text(text));
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	vm::VM::Limits limits;
+	limits.instructions = 10000;
+	avm->setLimits(limits);
+	REQUIRE(avm->start() == vm::VM::Status::FAILED);
+	REQUIRE(err.str().find("instruction limit exceeded") != std::string::npos);
+	REQUIRE(err.str().find("function spin at instruction") != std::string::npos);
+	// checked at the backward jump of the loop of 4 instructions
+	REQUIRE(avm->executed() >= 10000);
+	REQUIRE(avm->executed() < 10000 + 4);
+
+	avm->setLimits(vm::VM::Limits{});
+	REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+
+	std::istringstream forever(
+		".constants:\n"
+		"0  S  \"main\"\n"
+		".start:\n"
+		".functions:\n"
+		"0  0  0  1\n"
+		".F0:\n"
+		"0    nop\n"
+		"1    jmp  0\n");
+	avm = vm::VM::make_vm(File::parse_file_text(forever));
+	err.str("");
+	avm->setIO(in, out, err);
+	limits = vm::VM::Limits{};
+	limits.time = std::chrono::milliseconds(50);
+	avm->setLimits(limits);
+	auto begin = std::chrono::steady_clock::now();
+	REQUIRE(avm->start() == vm::VM::Status::FAILED);
+	REQUIRE(std::chrono::steady_clock::now() - begin < std::chrono::seconds(5));
+	REQUIRE(err.str().find("time limit exceeded") != std::string::npos);
+}
+
+TEST_CASE("A tail call reuses the frame of the caller, a call does not.") {
+	for (auto [call, status] : {std::make_tuple("tailcall", vm::VM::Status::FINISHED),
+	                            std::make_tuple("call", vm::VM::Status::FAILED)}) {
+		std::istringstream text(recursionProgram(call));
+		auto avm = vm::VM::make_vm(File::parse_file_text(text));
+		std::istringstream in;
+		std::ostringstream out, err;
+		avm->setIO(in, out, err);
+		REQUIRE(avm->start() == status);
+		REQUIRE((err.str().find("stack overflow") != std::string::npos) == (status == vm::VM::Status::FAILED));
+	}
+}
+
+TEST_CASE("A resumable VM stops at a scan until a whole token has been fed.") {
+	auto avm = vm::VM::make_vm(sumFile());
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	avm->setResumable(true);
+	feed(*avm, "3 1");
+	REQUIRE(avm->start() == vm::VM::Status::NEEDS_INPUT);
+	// 1 may go on as 10
+	feed(*avm, "0 2");
+	REQUIRE(avm->resume() == vm::VM::Status::NEEDS_INPUT);
+	feed(*avm, "0\n5 ");
+	REQUIRE(avm->resume() == vm::VM::Status::NEEDS_INPUT);
+	feed(*avm, "x");
+	REQUIRE(avm->resume() == vm::VM::Status::FINISHED);
+	REQUIRE(avm->resume() == vm::VM::Status::FINISHED);
+	REQUIRE(out.str() == "35x\n");
+	REQUIRE(err.str().empty());
+}
+
+TEST_CASE("A scan of a resumable VM that overflows the stack is reported like any other push.") {
+	// takes all but about 200 slots of the stack and scans into the rest
+	std::istringstream text(
+		".constants:\n"
+		"0  S  \"main\"\n"
+		".start:\n"
+		".functions:\n"
+		"0  0  0  1\n"
+		".F0:\n"
+		"0    snew  16777000\n"
+		"1    iscan\n"
+		"2    jmp  1\n");
+	auto avm = vm::VM::make_vm(File::parse_file_text(text));
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	avm->setResumable(true);
+	std::string tokens;
+	for (int i = 0; i < 1000; ++i) {
+		tokens += "12345 ";
+	}
+	for (int run = 0; run < 2; ++run) {
+		feed(*avm, tokens);
+		REQUIRE(avm->start() == vm::VM::Status::FAILED);
+		REQUIRE(err.str().find("stack overflow") != std::string::npos);
+		REQUIRE(err.str().find("at instruction 1 : iscan") != std::string::npos);
+		err.str("");
+	}
+}
+
+TEST_CASE("A resumable VM reads up to the end of a closed input and then fails.") {
+	auto avm = vm::VM::make_vm(sumFile());
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	avm->setResumable(true);
+	feed(*avm, "2 4");
+	REQUIRE(avm->start() == vm::VM::Status::NEEDS_INPUT);
+	feed(*avm, "0");
+	avm->closeInput();
+	REQUIRE(avm->resume() == vm::VM::Status::FAILED);
+	REQUIRE(out.str().empty());
+	REQUIRE(err.str().find("I/O error") != std::string::npos);
+}
+
+TEST_CASE("A VM starts at main from the snapshot of .start.") {
+	std::istringstream text(globalProgram);
+	auto file = std::make_shared<const File>(File::parse_file_text(text));
+	auto avm = vm::VM::make_vm(file);
+	std::istringstream in("1");
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	std::ostringstream snapshot;
+	const std::string key(64, 'a');
+	avm->saveSnapshot(snapshot, key);
+	REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+	REQUIRE(out.str() == "85");
+
+	auto path = std::filesystem::temp_directory_path() / ("c0-snapshot-" + std::to_string(getpid()));
+	std::ofstream(path, std::ios::binary) << snapshot.str();
+	auto other = vm::VM::make_vm(file);
+	REQUIRE_FALSE(other->restoreSnapshot(path.string(), std::string(63, 'a') + 'b'));
+	REQUIRE(other->restoreSnapshot(path.string(), key));
+	std::filesystem::remove(path);
+	for (auto input : {"2", "3"}) {
+		std::istringstream otherIn(input);
+		std::ostringstream otherOut;
+		other->setIO(otherIn, otherOut, err);
+		REQUIRE(other->start() == vm::VM::Status::FINISHED);
+		REQUIRE(otherOut.str() == std::to_string(84 + std::stoi(input)));
+	}
+	REQUIRE(err.str().empty());
+}
+
+// .start sets the global to what f returns, main prints it plus a scanned int,
+// f prints 42 first if `prints`
+std::string callingStartProgram(bool prints) {
+	return std::string(
+		".constants:\n"
+		"0  S  \"main\"\n"
+		"1  S  \"f\"\n"
+		".start:\n"
+		"0    ipush  0\n"
+		"1    loada  0,  0\n"
+		"2    call  1\n"
+		"3    istore\n"
+		".functions:\n"
+		"0  0  0  1\n"
+		"1  1  0  1\n"
+		".F0:\n"
+		"0    loada  1,  0\n"
+		"1    iload\n"
+		"2    iscan\n"
+		"3    iadd\n"
+		"4    iprint\n"
+		"5    ipush  0\n"
+		"6    iret\n"
+		".F1:\n") +
+		(prints ? "0    nop\n1    bipush  42\n2    iprint\n" : "0    nop\n1    nop\n2    nop\n") +
+		"3    ipush  40\n"
+		"4    ipush  2\n"
+		"5    iadd\n"
+		"6    iret\n";
+}
+
+TEST_CASE("The snapshot of a .start that calls a function ends with .start and rules out the I/O of the callee.") {
+	std::istringstream text(callingStartProgram(false));
+	auto file = std::make_shared<const File>(File::parse_file_text(text));
+	auto avm = vm::VM::make_vm(file);
+	std::istringstream in("1");
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	std::ostringstream snapshot;
+	const std::string key(64, 'a');
+	avm->saveSnapshot(snapshot, key);
+	// .start and f ran, main has not
+	REQUIRE(out.str().empty());
+	REQUIRE(avm->executed() == 4 + 7);
+	REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+	REQUIRE(out.str() == "43");
+
+	auto path = std::filesystem::temp_directory_path() / ("c0-snapshot-" + std::to_string(getpid()));
+	std::ofstream(path, std::ios::binary) << snapshot.str();
+	auto other = vm::VM::make_vm(file);
+	REQUIRE(other->restoreSnapshot(path.string(), key));
+	std::filesystem::remove(path);
+	std::istringstream otherIn("2");
+	std::ostringstream otherOut;
+	other->setIO(otherIn, otherOut, err);
+	REQUIRE(other->start() == vm::VM::Status::FINISHED);
+	REQUIRE(otherOut.str() == "44");
+	REQUIRE(err.str().empty());
+
+	std::istringstream printingText(callingStartProgram(true));
+	auto printing = vm::VM::make_vm(File::parse_file_text(printingText));
+	std::ostringstream printingOut;
+	printing->setIO(in, printingOut, err);
+	REQUIRE_THROWS_AS(printing->saveSnapshot(snapshot, key), InvalidFile);
+	REQUIRE(printingOut.str().empty());
+}
+
+TEST_CASE("One thread runs many VMs fed through sockets.") {
+	const int count = 32;
+	auto file = sumFile();
+	std::vector<std::unique_ptr<vm::VM>> vms;
+	std::vector<std::ostringstream> outs(count);
+	std::istringstream in;
+	std::ostringstream err;
+	std::vector<int> writers;
+	vm::Multiplexer multiplexer;
+	int finished = 0;
+	for (int i = 0; i < count; ++i) {
+		int fds[2];
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		vms.push_back(vm::VM::make_vm(file));
+		vms.back()->setIO(in, outs[i], err);
+		multiplexer.add(*vms.back(), fds[0], [&finished, fd = fds[0]](vm::VM&, vm::VM::Status status) {
+			REQUIRE(status == vm::VM::Status::FINISHED);
+			close(fd);
+			++finished;
+		});
+		writers.push_back(fds[1]);
+	}
+	REQUIRE(multiplexer.size() == count);
+
+	// every program gets its input in pieces that split the tokens, in reverse order,
+	// the writer only counts what failed since Catch2 assertions are not thread safe
+	std::atomic<int> failedWrites{0};
+	std::thread writer([&writers, &failedWrites] {
+		const char* pieces[] = {"4 1", "00 ", "2", "0 3", "0", " 4", "0 z"};
+		for (auto piece : pieces) {
+			for (auto it = writers.rbegin(); it != writers.rend(); ++it) {
+				if (write(*it, piece, std::char_traits<char>::length(piece)) <= 0) {
+					++failedWrites;
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+		for (auto fd : writers) {
+			close(fd);
+		}
+	});
+	multiplexer.run();
+	writer.join();
+
+	REQUIRE(failedWrites == 0);
+	REQUIRE(finished == count);
+	REQUIRE(multiplexer.size() == 0);
+	for (auto& out : outs) {
+		REQUIRE(out.str() == "190z\n");
+	}
+	REQUIRE(err.str().empty());
+}
+
+TEST_CASE("The samples of a profiled VM are folded into the stacks of the running functions.") {
+	std::istringstream text(spinProgram);
+	auto file = std::make_shared<const File>(File::parse_file_text(text));
+	auto avm = vm::VM::make_vm(file);
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	auto profiler = std::make_shared<vm::Profiler>(10000);
+	avm->setProfiler(profiler);
+	// a run may be too short for a sample on a loaded machine
+	for (int i = 0; i < 1000 && profiler->samples() < 10; ++i) {
+		avm->reset();
+		REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+	}
+	REQUIRE(profiler->samples() >= 10);
+	REQUIRE(err.str().empty());
+
+	std::ostringstream folded;
+	profiler->write(folded, *file);
+	std::istringstream lines(folded.str());
+	std::size_t total = 0;
+	for (std::string line; std::getline(lines, line); ) {
+		auto space = line.rfind(' ');
+		REQUIRE(space != std::string::npos);
+		auto stack = line.substr(0, space);
+		REQUIRE(stack.rfind(".start;main", 0) == 0);
+		total += std::stoul(line.substr(space + 1));
+	}
+	REQUIRE(total == profiler->samples());
+	REQUIRE(folded.str().find(".start;main;spin@") != std::string::npos);
+}
+
+TEST_CASE("A profiling timer takes any positive rate.") {
+	// a period of exactly a second, and one below the shortest the timer takes
+	for (int hz : {1, 2, 1000, 10000000}) {
+		REQUIRE_NOTHROW(vm::Profiler::Timer(hz));
+	}
+	std::istringstream text(spinProgram);
+	auto avm = vm::VM::make_vm(File::parse_file_text(text));
+	std::istringstream in;
+	std::ostringstream out, err;
+	avm->setIO(in, out, err);
+	auto profiler = std::make_shared<vm::Profiler>(1);
+	avm->setProfiler(profiler);
+	REQUIRE(avm->start() == vm::VM::Status::FINISHED);
+	REQUIRE(err.str().empty());
+}